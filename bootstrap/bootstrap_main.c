@@ -25,8 +25,10 @@ int main(void)
 {
 	uint16_t prog = 0;
 	uint16_t boot_pid;
+	const bootstrap_prog_header *header;
 
-	// basic start up
+	// basic start up (profile the boot from here, see bootstrap_prof_get)
+	bootstrap_prof_start();
 	sys_init();
 
 	// see if we were asked to boot a specific program
@@ -44,16 +46,26 @@ requested_boot:
 		if (bootstrap_program_headers[prog]->pid == boot_pid)
 		{
 			if (bootstrap_validate_prog(bootstrap_program_headers[prog]))
-				boot(bootstrap_program_headers[prog]);
+			{
+				bootstrap_prof_mark("validate");
+				header = bootstrap_unpack_prog(bootstrap_program_headers[prog]);
+				if (header != NULL)
+					boot(header);
+			}
 		}
 	}
 
 default_boot:
-	// look for the next valid program to run
+	// look for the next valid program to run (packed ones are unpacked first)
 	for (prog = 0; prog < PROGRAM_HEADERS; prog++)
 	{
 		if (bootstrap_validate_prog(bootstrap_program_headers[prog]))
-			boot(bootstrap_program_headers[prog]);
+		{
+			bootstrap_prof_mark("validate");
+			header = bootstrap_unpack_prog(bootstrap_program_headers[prog]);
+			if (header != NULL)
+				boot(header);
+		}
 	}
 	goto bricked_boot; // just quit warnings
 
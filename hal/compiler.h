@@ -24,6 +24,8 @@
 
 	// placement (ram/rom/etc */
 	#define at_symbol(sym) __attribute__((section(sym)))        // place a object (ie struct var etc) at a position in code
+	#define ramfunc __attribute__((section(".ramfunc")))           // run this function from ram (copied in with .data by the startup)
+	#define ccmram __attribute__((section(".ccmram")))             // place this object in core coupled ram (f4 only, not initialised, no dma)
 
 	// inlining
 	#define force_inline __forceinline                          // force this function to inline
@@ -44,6 +46,8 @@
 
 	// placement (ram/rom/etc */
 	#define at_symbol(sym) __attribute__((section(sym)))            // place a object (ie struct var etc) at a position in code
+	#define ramfunc __attribute__((section(".ramfunc"), noinline, long_call)) // run this function from ram (copied in with .data by the startup)
+	#define ccmram __attribute__((section(".ccmram")))                 // place this object in core coupled ram (f4 only, not initialised, no dma)
 
 	// inlining
 	#define force_inline __attribute__((always_inline))             // force this function to inline
@@ -64,6 +68,8 @@
 
 	// placement (ram/rom/etc)
 	#define at_symbol(sym) @ sym                                    // place a object (ie struct var etc) at a position in code (not available yet)
+	#define ramfunc __ramfunc                                       // run this function from ram
+	#define ccmram @ ".ccmram"                                      // place this object in core coupled ram (not available yet)
 
 	// inlining
 	#define force_inline                                            // not supported
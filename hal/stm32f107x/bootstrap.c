@@ -59,6 +59,20 @@ uint16_t bootstrap_get_boot_pid(void)
 }
 
 
+// backup registers used to cache program validation (BKP_DR1 is the boot pid),
+// each cached program takes 3 words (see lib/boot.c) and they are only 16 bits
+// so each word takes 2 of them
+static const uint16_t bkp_regs[] =
+{
+	BKP_DR2, BKP_DR3, BKP_DR4, BKP_DR5, BKP_DR6, BKP_DR7, BKP_DR8,
+	BKP_DR9, BKP_DR10, BKP_DR11, BKP_DR12, BKP_DR13, BKP_DR14, BKP_DR15,
+};
+#define BKP_CACHE_MAX		(2)				// sizeof(bkp_regs) / 2 / 3
+#if BOOTSTRAP_VALIDATE_CACHE > BKP_CACHE_MAX
+#error "not enough backup registers for BOOTSTRAP_VALIDATE_CACHE"
+#endif
+
+
 static void crc_setup(void)
 {
 	static bool do_crc_init = true;
@@ -68,29 +82,120 @@ static void crc_setup(void)
 }
 
 
+static uint32_t bkp_read(int n)
+{
+	uint32_t v;
+
+	PWR_BackupAccessCmd(ENABLE);
+	v = BKP_ReadBackupRegister(bkp_regs[2*n]) | ((uint32_t)BKP_ReadBackupRegister(bkp_regs[2*n + 1]) << 16);
+	PWR_BackupAccessCmd(DISABLE);
+
+	return v;
+}
+
+
+static void bkp_write(int n, uint32_t v)
+{
+	PWR_BackupAccessCmd(ENABLE);
+	BKP_WriteBackupRegister(bkp_regs[2*n], v);
+	BKP_WriteBackupRegister(bkp_regs[2*n + 1], v >> 16);
+	PWR_BackupAccessCmd(DISABLE);
+}
+
+
+#if BOOTSTRAP_UNPACK_BUF < 32 || BOOTSTRAP_UNPACK_BUF % 4
+#error "BOOTSTRAP_UNPACK_BUF must be whole words and hold more than a program header"
+#endif
+
+
+// lib/boot.c skips BOOT_HEADER_LEN to get to the packed/delta header
+typedef char boot_header_len_check[(sizeof(bootstrap_prog_header) == BOOT_HEADER_LEN)? 1: -1];
+
+
+// validation cache and unpacking (see lib/boot.h)
+static struct boot_h boot_h =
+{
+	.crc = &stm32f10x_crc_h,
+	.bkp_read = bkp_read,
+	.bkp_write = bkp_write,
+	.cache = BOOTSTRAP_VALIDATE_CACHE,
+	.reverify = BOOTSTRAP_VALIDATE_REVERIFY,
+	.flash = (uint8_t *)NVM_START_ADDRESS,
+	.flash_size = NVM_END_ADDRESS - NVM_START_ADDRESS,
+	.flash_addr = NVM_START_ADDRESS,
+	.page_size = 0x800,		// flash page
+	.erase = nvm_erase,
+	.write = nvm_write,
+	.mark = bootstrap_prof_mark,
+};
+
+
 bool bootstrap_validate_prog(const bootstrap_prog_header *header)
 {
-	uint32_t crc;
-
-	// null header is invalid
-	if (header == NULL || header == (void *)0xffffffff)
-		return false;
-
-	// check len
-	if (header->len == 0)
-		return false;
-	
-	// check type
-	if (header->type != BOOTSTRAP_PROG_HEADER)
-		return false;
-	
-	// check the crc
 	crc_setup();
-	crc = crc_buf(&stm32f10x_crc_h, &header->len, header->len - sizeof(header->crc), true);
-	if (header->crc != crc)
-		return false;
-	
-	return true;
+	return boot_validate(&boot_h, header);
+}
+
+
+void bootstrap_flash_changed(const void *addr, uint32_t len)
+{
+	boot_flash_changed(&boot_h, addr, len);
+}
+
+
+const bootstrap_prog_header *bootstrap_unpack_prog(const bootstrap_prog_header *header)
+{
+	// staging buffer, each time it fills it is crc'd and written out (it is on
+	// the stack as only the bootstrap unpacks, apps just use bootstrap_flash_changed)
+	uint32_t buf[BOOTSTRAP_UNPACK_BUF / sizeof(uint32_t)];
+	const bootstrap_prog_header *prog;
+
+	crc_setup();
+	boot_h.buf = (uint8_t *)buf;
+	boot_h.buf_size = sizeof(buf);
+	prog = boot_unpack(&boot_h, header);
+	boot_h.buf = NULL;
+
+	return prog;
+}
+
+
+// boot profile, this lives in its own bit of ram so it survives boot() and the app startup
+static struct boot_prof boot_prof at_symbol(".boot_prof");
+
+
+// the cmsis for the f107 does not have the dwt so do it by hand
+#define DWT_CTRL			(*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT			(*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA	(1 << 0)
+
+
+void bootstrap_prof_start(void)
+{
+	// start the cycle counter from 0
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+	boot_prof_start(&boot_prof, DWT_CYCCNT);
+}
+
+
+void bootstrap_prof_mark(const char *stage)
+{
+	boot_prof_mark(&boot_prof, stage, DWT_CYCCNT);
+}
+
+
+int bootstrap_prof_count(void)
+{
+	return boot_prof_count(&boot_prof);
+}
+
+
+bool bootstrap_prof_get(int n, const char **stage, uint32_t *cycles)
+{
+	return boot_prof_get(&boot_prof, n, stage, cycles);
 }
 
 
@@ -113,6 +218,7 @@ void boot(const bootstrap_prog_header *header)
 	src = (vecttab *)header->isr_vector;
 	for (k = 0; k < 128; k++)
 		dst[k] = src[k];
+	bootstrap_prof_mark("boot");
 
 	// set cpu to run vector table from ram
 	NVIC_SetVectorTable(NVIC_VectTab_RAM, 0);
@@ -13,9 +13,12 @@
 #define __BOOTSTRAP__
 
 
+// header types, packed/delta headers and the shared validate/unpack/profile code
+#include "../../lib/boot.h"
+
+
 // describes a program the bootstrap can run
 ///@todo this should be stm32f107 specific
-#define BOOTSTRAP_PROG_HEADER 0x01
 #define BOOTSTRAP_PROG_HEADER_HW_ID 1
 packed_start
 packed(struct) bootstrap_prog_header
@@ -32,6 +35,24 @@ packed(struct) bootstrap_prog_header
 packed_end
 
 
+// bootstrap_validate_prog remembers the programs it has crc'd in the backup
+// registers and skips the crc on later boots until they are written over
+// (see bootstrap_flash_changed), set to 0 to always do the crc
+#ifndef BOOTSTRAP_VALIDATE_CACHE
+#define BOOTSTRAP_VALIDATE_CACHE 2 // number of programs to remember
+#endif
+
+// even with the cache do a full crc every this many boots
+#ifndef BOOTSTRAP_VALIDATE_REVERIFY
+#define BOOTSTRAP_VALIDATE_REVERIFY 16
+#endif
+
+// bytes bootstrap_unpack_prog unpacks (or rebuilds) before each write to the program slot
+#ifndef BOOTSTRAP_UNPACK_BUF
+#define BOOTSTRAP_UNPACK_BUF 256
+#endif
+
+
 // opaque description of a program the bootstrap can start
 typedef struct bootstrap_prog_header bootstrap_prog_header;
 
@@ -61,11 +82,76 @@ uint16_t bootstrap_get_boot_pid(void);
 /**
  * @brief checks the header to see if it describes a valid program
  * @param header points to a program header for the program to check
- * @return true if len > 0, type == BOOTSTRAP_PROG_HEADER, crc match; otherwise false
+ * @note the crc is skipped if this program passed on an earlier boot and has
+ * not been written over since (see BOOTSTRAP_VALIDATE_CACHE)
+ * @return true if len > 0, type == BOOTSTRAP_PROG_HEADER (or _LZ4/_DELTA), crc match; otherwise false
  */
 bool bootstrap_validate_prog(const bootstrap_prog_header *header);
 
 
+/**
+ * @brief drop the cached validations of the programs a range of flash overlaps
+ * because it is about to change
+ * @param addr start of the range
+ * @param len number of bytes in the range
+ * @note nvm_erase and nvm_write call this so anything going through nvm is
+ * covered (writes that miss the programs, like kv and journal, keep the cache),
+ * flashing over swd/jtag is not but that changes the header crc
+ */
+void bootstrap_flash_changed(const void *addr, uint32_t len);
+
+
+/**
+ * @brief get the program described by header ready to boot
+ * @param header points to a valid program header (see bootstrap_validate_prog)
+ * @note a packed program (or delta) is unpacked to its slot (erasing it if it
+ * is in flash), crc'd as it is written then checked with bootstrap_validate_prog,
+ * this is skipped if the slot already holds it from an earlier boot. Plain
+ * programs are just passed through
+ * @return header of the program to boot, NULL if it could not be unpacked
+ */
+const bootstrap_prog_header *bootstrap_unpack_prog(const bootstrap_prog_header *header);
+
+
+// boot profiler, each boot stage is time stamped with the dwt cycle counter and
+// kept in the .boot_prof ram section (see the linker scripts) which the startup
+// does not clear, so an app can see the bootstrap stages as well as its own
+#define BOOTSTRAP_PROF_SAMPLES BOOT_PROF_SAMPLES // fixed as the bootstrap and apps must agree on the layout
+
+
+/**
+ * @brief start a new boot profile
+ * @note the bootstrap calls this first thing, apps without a bootstrap can call
+ * it at the top of main. It restarts the dwt cycle counter and clears the samples
+ */
+void bootstrap_prof_start(void);
+
+
+/**
+ * @brief time stamp the end of a boot stage
+ * @param stage name of the stage (this is kept by pointer so pass a string literal)
+ * @note does nothing if bootstrap_prof_start has not been called or the samples are full
+ */
+void bootstrap_prof_mark(const char *stage);
+
+
+/**
+ * @brief get the number of boot stages recorded so far
+ * @return number of stages (0 if there is no profile)
+ */
+int bootstrap_prof_count(void);
+
+
+/**
+ * @brief get a boot stage from the profile
+ * @param n stage number (0 is the call to bootstrap_prof_start)
+ * @param stage set to the name of the stage
+ * @param cycles set to the number of cycles since the stage before
+ * @return false if there is no stage n
+ */
+bool bootstrap_prof_get(int n, const char **stage, uint32_t *cycles);
+
+
 /**
  * @brief boot the program described in the program header
  * @param header points to a header describing the program to boot
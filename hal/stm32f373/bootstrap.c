@@ -59,6 +59,14 @@ uint16_t bootstrap_get_boot_pid(void)
 }
 
 
+// backup registers used to cache program validation (RTC_BKP_DR0 is the boot pid),
+// each cached program takes 3 of them (see lib/boot.c)
+#define BKP_CACHE_MAX		(6)				// RTC_BKP_DR1..19
+#if BOOTSTRAP_VALIDATE_CACHE > BKP_CACHE_MAX
+#error "not enough backup registers for BOOTSTRAP_VALIDATE_CACHE"
+#endif
+
+
 static void crc_setup(void)
 {
 	static bool do_crc_init = true;
@@ -68,29 +76,113 @@ static void crc_setup(void)
 }
 
 
+static uint32_t bkp_read(int n)
+{
+	uint32_t v;
+
+	PWR_BackupAccessCmd(ENABLE);
+	v = RTC_ReadBackupRegister(RTC_BKP_DR1 + n);
+	PWR_BackupAccessCmd(DISABLE);
+
+	return v;
+}
+
+
+static void bkp_write(int n, uint32_t v)
+{
+	PWR_BackupAccessCmd(ENABLE);
+	RTC_WriteBackupRegister(RTC_BKP_DR1 + n, v);
+	PWR_BackupAccessCmd(DISABLE);
+}
+
+
+#if BOOTSTRAP_UNPACK_BUF < 32 || BOOTSTRAP_UNPACK_BUF % 4
+#error "BOOTSTRAP_UNPACK_BUF must be whole words and hold more than a program header"
+#endif
+
+
+// lib/boot.c skips BOOT_HEADER_LEN to get to the packed/delta header
+typedef char boot_header_len_check[(sizeof(bootstrap_prog_header) == BOOT_HEADER_LEN)? 1: -1];
+
+
+// validation cache and unpacking (see lib/boot.h)
+static struct boot_h boot_h =
+{
+	.crc = &stm32f373_crc_h,
+	.bkp_read = bkp_read,
+	.bkp_write = bkp_write,
+	.cache = BOOTSTRAP_VALIDATE_CACHE,
+	.reverify = BOOTSTRAP_VALIDATE_REVERIFY,
+	.flash = (uint8_t *)NVM_START_ADDRESS,
+	.flash_size = NVM_END_ADDRESS - NVM_START_ADDRESS,
+	.flash_addr = NVM_START_ADDRESS,
+	.page_size = 0x800,		// flash page
+	.erase = nvm_erase,
+	.write = nvm_write,
+	.mark = bootstrap_prof_mark,
+};
+
+
 bool bootstrap_validate_prog(const bootstrap_prog_header *header)
 {
-	uint32_t crc;
-
-	// null header is invalid
-	if (header == NULL || header == (void *)0xffffffff)
-		return false;
-
-	// check len
-	if (header->len == 0)
-		return false;
-	
-	// check type
-	if (header->type != BOOTSTRAP_PROG_HEADER)
-		return false;
-	
-	// check the crc
 	crc_setup();
-	crc = crc_buf(&stm32f373_crc_h, &header->len, header->len - sizeof(header->crc), true);
-	if (header->crc != crc)
-		return false;
-	
-	return true;
+	return boot_validate(&boot_h, header);
+}
+
+
+void bootstrap_flash_changed(const void *addr, uint32_t len)
+{
+	boot_flash_changed(&boot_h, addr, len);
+}
+
+
+const bootstrap_prog_header *bootstrap_unpack_prog(const bootstrap_prog_header *header)
+{
+	// staging buffer, each time it fills it is crc'd and written out (it is on
+	// the stack as only the bootstrap unpacks, apps just use bootstrap_flash_changed)
+	uint32_t buf[BOOTSTRAP_UNPACK_BUF / sizeof(uint32_t)];
+	const bootstrap_prog_header *prog;
+
+	crc_setup();
+	boot_h.buf = (uint8_t *)buf;
+	boot_h.buf_size = sizeof(buf);
+	prog = boot_unpack(&boot_h, header);
+	boot_h.buf = NULL;
+
+	return prog;
+}
+
+
+// boot profile, this lives in its own bit of ram so it survives boot() and the app startup
+static struct boot_prof boot_prof at_symbol(".boot_prof");
+
+
+void bootstrap_prof_start(void)
+{
+	// start the cycle counter from 0
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	boot_prof_start(&boot_prof, DWT->CYCCNT);
+}
+
+
+void bootstrap_prof_mark(const char *stage)
+{
+	boot_prof_mark(&boot_prof, stage, DWT->CYCCNT);
+}
+
+
+int bootstrap_prof_count(void)
+{
+	return boot_prof_count(&boot_prof);
+}
+
+
+bool bootstrap_prof_get(int n, const char **stage, uint32_t *cycles)
+{
+	return boot_prof_get(&boot_prof, n, stage, cycles);
 }
 
 
@@ -113,6 +205,7 @@ void boot(const bootstrap_prog_header *header)
 	src = (vecttab *)header->isr_vector;
 	for (k = 0; k < 128; k++)
 		dst[k] = src[k];
+	bootstrap_prof_mark("boot");
 
 	// set cpu to run vector table from ram
 	NVIC_SetVectorTable(NVIC_VectTab_RAM, 0);
@@ -40,29 +40,19 @@ struct crc_h stm32f373_crc_h =
 static bool clk_running = false;
 
 
-#define cm_t_elem_compare(a, b, elem) (a->elem == b->elem)
-bool cm_t_compare(const cm_t *a, const cm_t *b)
+// the hw register is never reflected or xor'd on the way out, so do the
+// output stage of the model here
+static uint32_t crc_hard_out(struct crc_h *h, uint32_t reg)
 {
-	if (!cm_t_elem_compare(a, b, cm_width))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_poly))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_init))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_refin))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_refot))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_xorot))
-		return false;
-	// note do not compare cm_reg (not setup just working reg)
-
-	return true;
+	if (h->cm.cm_refot)
+		reg = __RBIT(reg);
+	return reg ^ h->cm.cm_xorot;
 }
 
 
 uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 {
+	const uint32_t *_buf = buf;
 	uint32_t r; 
 
 	// crc hw is a shared resource so we need to lock around it
@@ -78,19 +68,86 @@ uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset
 	else
 		len = (len >> 2);
 
-	// crc buf
-	r = CRC_CalcBlockCRC((uint32_t *)buf, len);
+	// crc buf (reflected models want the bits of each byte reversed on the
+	// way in, the bytes of each word still go msb first like the soft method)
+	if (h->cm.cm_refin)
+	{
+		while (len--)
+			CRC->DR = __RBIT(__REV(*_buf++));
+		r = CRC->DR;
+	}
+	else
+		r = CRC_CalcBlockCRC((uint32_t *)_buf, len);
 
 	// return result
 	sys_leave_critical_section();
-	return r;
+	return crc_hard_out(h, r);
+}
+
+
+// run the crc register back 32 bits, writing the result to the freshly reset
+// hw lands the hw register on reg (so the hw can carry on from a crc started in
+// software or in an earlier call)
+static uint32_t crc_hard_unshift(uint32_t reg)
+{
+	int k;
+
+	for (k = 0; k < 32; k++)
+	{
+		if (reg & 1)
+			reg = ((reg ^ stm32f373_crc_h.cm.cm_poly) >> 1) | 0x80000000;
+		else
+			reg >>= 1;
+	}
+	return reg;
+}
+
+
+// crc_buf_hard crc's whole words so a partial last word takes in the bytes after it
+uint32_t crc_buf_hard_len(struct crc_h *h, uint32_t len)
+{
+	return (len + 3) & ~3;
+}
+
+
+bool crc_update_hard(struct crc_h *h, const uint32_t *buf, uint32_t len)
+{
+	// crc hw is a shared resource so we need to lock around it
+	sys_enter_critical_section();
+
+	// load the running crc into the hw
+	CRC_ResetDR();
+	if (h->cm.cm_reg != h->cm.cm_init)
+		CRC->DR = h->cm.cm_init ^ crc_hard_unshift(h->cm.cm_reg);
+
+	// the hw eats words msb first, so reverse them to crc the bytes in memory
+	// order (for reflected models reversing all 32 bits also gets each byte lsb first)
+	if (h->cm.cm_refin)
+	{
+		while (len--)
+			CRC->DR = __RBIT(*buf++);
+	}
+	else
+	{
+		while (len--)
+			CRC->DR = __REV(*buf++);
+	}
+
+	// save the running crc so the hw is free for others
+	h->cm.cm_reg = CRC->DR;
+	sys_leave_critical_section();
+	return true;
 }
 
 
 bool crc_init_hard(struct crc_h *h)
 {
-	// if the cm config matches the hardware we are good to go !!
-	if (!cm_t_compare(&h->cm, &stm32f373_crc_h.cm))
+	// the hw is stuck with its poly and reset value, but the input can be bit
+	// reversed on the way in and the output stage done on the way out, so any
+	// refin/refot/xorot is fine (ie mpeg2, bzip2 and the zlib/ethernet crc32)
+	if (h->cm.cm_width != stm32f373_crc_h.cm.cm_width ||
+		h->cm.cm_poly != stm32f373_crc_h.cm.cm_poly ||
+		h->cm.cm_init != stm32f373_crc_h.cm.cm_init)
 		return false;
 
 	// crc hw is a shared resource so we need to lock around it
@@ -34,6 +34,18 @@ static bool _nvm_erase(uint32_t addr, uint32_t len)
 }
 
 
+// check a word aligned range is erased, a word at a time (much quicker than an erase)
+static bool blank(uint32_t addr, uint32_t len)
+{
+	const uint32_t *p = (const uint32_t *)addr;
+
+	for (len /= sizeof(uint32_t); len; len--)
+		if (*p++ != 0xffffffff)
+			return false;
+	return true;
+}
+
+
 #define PAGE_SIZE 0x00000800UL		/* 2K Page Size */
 uint32_t nvm_erase(void *addr, uint32_t len)
 {
@@ -55,8 +67,13 @@ uint32_t nvm_erase(void *addr, uint32_t len)
 		///@todo if we had enough RAM spare we could
 		///back up the whole page and just erase len
 		///bytes and restore the rest
-		if (!_nvm_erase(_addr, PAGE_SIZE))
-			goto done;
+		// already blank so save the erase, else anything validated from it has to be checked again
+		if (!blank(_addr, PAGE_SIZE))
+		{
+			bootstrap_flash_changed((void *)_addr, PAGE_SIZE);
+			if (!_nvm_erase(_addr, PAGE_SIZE))
+				goto done;
+		}
 		_addr += PAGE_SIZE;
 		b += PAGE_SIZE;
 	}
@@ -74,6 +91,27 @@ bool nvm_read(void *dst, const void *src, uint32_t len)
 	return true;
 }
 
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data)
+{
+	const uint8_t *flash = addr, *src = data;
+
+	// a word at a time while both are aligned, programming can only clear bits
+	if ((((uint32_t)flash | (uint32_t)src) & 0x03) == 0)
+	{
+		for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t))
+		{
+			if (*(const uint32_t *)src & ~*(const uint32_t *)flash)
+				return true;
+			flash += sizeof(uint32_t);
+			src += sizeof(uint32_t);
+		}
+	}
+	while (len--)
+		if (*src++ & ~*flash++)
+			return true;
+	return false;
+}
+
 
 #define FLASH_WRITE_TIMEOUT 0x2000
 static bool flash_wait(void)
@@ -135,6 +173,9 @@ bool nvm_write(void *dst, const void *src, uint32_t len)
 		///@todo page must be 2 byte aligned
 		return false;
 
+	// anything validated from flash here has to be checked again
+	bootstrap_flash_changed(dst, len);
+
 	// since we cannot read from the flash during a write/erase cycle
 	// letting interrupts run could cause a read and an error, or it 
 	// could cause the unlock to fail, so lets do the lot in a critical
@@ -13,6 +13,11 @@
 #ifndef __NVM__
 #define __NVM__
 
+
+#define NVM_START_ADDRESS (0x08000000)
+#define NVM_END_ADDRESS   (0x08040000) // biggest part in the family (256K)
+
+
 /**
  * @brief erase pages from addr to len
  * @param addr points to anywhere in the first page to erase
@@ -39,6 +44,17 @@ bool nvm_read(void *dst, const void *src, uint32_t len);
  */
 bool nvm_write(void *dst, const void *src, uint32_t len);
 
+/**
+ * @brief check if data can be written over what is in the flash without an erase
+ * @param addr flash address that would be written
+ * @param len number of bytes
+ * @param data what would be written
+ * @note programming can only clear bits (1 to 0), so this is true if data has a
+ * 1 anywhere the flash has a 0
+ * @return true if the range has to be erased before data can be written
+ */
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data);
+
 
 #endif
 
@@ -34,10 +34,12 @@ static void sys_clk_init(void)
 
 	// set clocks registers back to defaults (for debugging, st_demo)
 	RCC_DeInit();
+	bootstrap_prof_mark("rcc_deinit");
 
 	// enable the high speed external osc (HSE) and spin for it to stabilise
 	RCC_HSEConfig(RCC_HSE_ON);
 	HSEStartUpStatus = RCC_WaitForHSEStartUp();
+	bootstrap_prof_mark("hse");
 	if (HSEStartUpStatus != SUCCESS)
 	{
 		///@todo handle error better
@@ -69,6 +71,7 @@ static void sys_clk_init(void)
 	RCC_PLLCmd(ENABLE);
 	while(RCC_GetFlagStatus(RCC_FLAG_PLLRDY) == RESET)
 	{}
+	bootstrap_prof_mark("pll");
 
 	// Switch the system clock over to the PLL output and spin until it is ready
 	RCC_SYSCLKConfig(RCC_SYSCLKSource_PLLCLK);
@@ -334,10 +337,12 @@ void sys_spin(uint32_t time)
 void sys_init(void)
 {
 	sys_clk_init();
+	bootstrap_prof_mark("sys_clk");
 	sys_interrupt_init();
 	sys_tick_init();
 	sys_temp_init();
 	sys_log_init();
+	bootstrap_prof_mark("sys_init");
 }
 
 
@@ -49,9 +49,9 @@ static void adc_init(adc_t *adc)
 	// init the adc
 	ADC_CommonInit(&common_init);
 
-	// int the dma if given
-	if (adc->dma)
-		dma_init(adc->dma);
+	// int the dma if given (a stream dma_acquire has handed out is refused, then adc_start does nothing)
+	if (adc->dma && !dma_init(adc->dma))
+		adc->dma = NULL;
 
 	ADC_Cmd(adc->base, ENABLE);
 	if (__sys_temperature_sensor != NULL)
@@ -110,7 +110,7 @@ static void adc_dma_complete(dma_request_t *req, void *param)
 	adc_channel_t *ch = (adc_channel_t *)param;
 	adc_t * adc = ch->adc;
 	adc_trace_complete_t cb;
-	int count;
+	int count = 0;
 
 	sys_enter_critical_section();
 
@@ -155,7 +155,18 @@ static void adc_dma_complete(dma_request_t *req, void *param)
 }
 
 
-void adc_trace(adc_channel_t *ch, uint16_t *dst, int count, int trigger, adc_trace_complete_t cb, void *param)
+static void *adc_dma_buffer_complete(dma_request_t *req, void *buf, void *param)
+{
+	adc_channel_t *ch = (adc_channel_t *)param;
+
+	if (ch->stream == NULL)
+		return NULL;
+	return ch->stream(ch, buf, ch->count, ch->complete_param);
+}
+
+
+// start a trace (buf1 NULL) or a double buffered stream
+static void adc_start(adc_channel_t *ch, uint16_t *dst, uint16_t *buf1, int count, int trigger)
 {
 	adc_t *adc = ch->adc;
 	ADC_InitTypeDef init =
@@ -172,16 +183,17 @@ void adc_trace(adc_channel_t *ch, uint16_t *dst, int count, int trigger, adc_tra
 	if (adc->dma == NULL)
 		///@todo error current implementation does not support interrupts so we need a dma
 		goto done;
-	dma_cancel(adc->dma); // cancel any pending/running dma
+	dma_cancel_request(&adc->dma_req); // cancel any pending/running dma
 	adc->dma_req.complete = adc_dma_complete;
 	ch->buf = dst;
 	ch->count = count;
-	ch->complete = cb;
-	ch->complete_param = param;
 	adc->dma_req.complete_param = ch;
 	adc->dma_req.dma = adc->dma;
 	adc_dma_cfg(adc, &adc->dma_req, (void *)dst, count);
-	dma_request(&adc->dma_req);
+	if (buf1 != NULL)
+		dma_request_double_buffer(&adc->dma_req, buf1, adc_dma_buffer_complete);
+	else
+		dma_request(&adc->dma_req);
 	ADC_DMACmd(adc->base, ENABLE);
 
 	// setup the trigger that keeps the adc running count times, if no trigger is given
@@ -217,6 +229,32 @@ done:
 }
 
 
+void adc_trace(adc_channel_t *ch, uint16_t *dst, int count, int trigger, adc_trace_complete_t cb, void *param)
+{
+	sys_enter_critical_section();
+	ch->complete = cb;
+	ch->stream = NULL;
+	ch->complete_param = param;
+	adc_start(ch, dst, NULL, count, trigger);
+	sys_leave_critical_section();
+}
+
+
+void adc_stream(adc_channel_t *ch, uint16_t *buf0, uint16_t *buf1, int count, int trigger, adc_stream_t cb, void *param)
+{
+	if (buf0 == NULL || buf1 == NULL)
+		///@todo error both buffers are needed
+		return;
+
+	sys_enter_critical_section();
+	ch->complete = NULL;
+	ch->stream = cb;
+	ch->complete_param = param;
+	adc_start(ch, buf0, buf1, count, trigger);
+	sys_leave_critical_section();
+}
+
+
 void adc_cancel_trace(adc_channel_t *ch)
 {
 	adc_t *adc = ch->adc;
@@ -237,7 +275,7 @@ void adc_cancel_trace(adc_channel_t *ch)
 		///@todo error current implementation does not support interrupts so we need a dma
 		return;
 	ADC_DMACmd(adc->base, DISABLE);
-	dma_cancel(adc->dma); // cancel any pending/running dma
+	dma_cancel_request(&adc->dma_req); // cancel any pending/running dma
 	
 	// clean up like we would on adc_dma_complete and just reset everything to default state
 	ADC_Init(adc->base, &init);
@@ -32,6 +32,23 @@ typedef void (*adc_trace_complete_t)(adc_channel_t *ch, uint16_t *dst, int count
 void adc_trace(adc_channel_t *ch, uint16_t *dst, int count, int trigger, adc_trace_complete_t cb, void *param);
 
 
+/**
+ * @brief read into two buffers in turn without stopping (dma double buffer mode)
+ * @param ch channel to read from
+ * @param buf0 first buffer to fill
+ * @param buf1 second buffer, filled while cb has buf0 and so on
+ * @param count number of conversions in each buffer
+ * @param trigger 0 start now, 1 honour any trigger setup in hw.c
+ * @param cb called from the dma isr with each buffer as it fills, it can return a new
+ * buffer to fill next time in place of the one it was given (NULL keeps it)
+ * @param param pass this to cb
+ * @note runs until adc_cancel_trace, cb must be done with its buffer (or swap it)
+ * before the other one fills
+ */
+typedef uint16_t *(*adc_stream_t)(adc_channel_t *ch, uint16_t *buf, int count, void *param);
+void adc_stream(adc_channel_t *ch, uint16_t *buf0, uint16_t *buf1, int count, int trigger, adc_stream_t cb, void *param);
+
+
 /**
  * @brief cancel any pending trace above
  * @param ch channel to cancel trace on
@@ -48,6 +48,7 @@ struct adc_channel_t
 	gpio_pin_t *pin;		///< input pin
 
 	adc_trace_complete_t complete;
+	adc_stream_t stream;
 	void *complete_param;
 	uint16_t *buf;
 	int count;
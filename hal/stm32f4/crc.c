@@ -13,6 +13,7 @@
 #include <crc.h>
 #include <stm32f4xx_conf.h>
 #include "hal.h"
+#include "crc_hw.h"
 
 
 struct crc_h stm32f4_crc_h =
@@ -40,37 +41,136 @@ struct crc_h stm32f4_crc_h =
 static bool clk_running = false;
 
 
-#define cm_t_elem_compare(a, b, elem) (a->elem == b->elem)
-bool cm_t_compare(const cm_t *a, const cm_t *b)
+// the crc hw belongs to the dma while this is set (see crc_buf_async in crc_async.c)
+static volatile bool crc_hard_claimed = false;
+
+
+// crc hw is a shared resource so we need to lock around it, false (and not
+// locked) if the dma owns it, the caller does it in software rather than wait
+static bool crc_hard_lock(void)
 {
-	if (!cm_t_elem_compare(a, b, cm_width))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_poly))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_init))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_refin))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_refot))
-		return false;
-	if (!cm_t_elem_compare(a, b, cm_xorot))
-		return false;
-	// note do not compare cm_reg (not setup just working reg)
+	sys_enter_critical_section();
+	if (!crc_hard_claimed)
+		return true;
+	sys_leave_critical_section();
+	return false;
+}
+
+
+static void crc_hard_unlock(void)
+{
+	sys_leave_critical_section();
+}
+
 
+bool crc_hard_claim(void)
+{
+	sys_enter_critical_section();
+	if (crc_hard_claimed)
+	{
+		sys_leave_critical_section();
+		return false;
+	}
+	CRC_ResetDR();
+	crc_hard_claimed = true;
+	sys_leave_critical_section();
 	return true;
 }
 
 
+void crc_hard_release(void)
+{
+	crc_hard_claimed = false;
+}
+
+
+uint32_t crc_hard_out(struct crc_h *h, uint32_t reg)
+{
+	if (h->cm.cm_refot)
+		reg = __RBIT(reg);
+	return reg ^ h->cm.cm_xorot;
+}
+
+
+// run the crc register back 32 bits, writing the result to the freshly reset
+// hw lands the hw register on reg (so the hw can carry on from a crc started in
+// software or in an earlier call)
+static uint32_t crc_hard_unshift(uint32_t reg)
+{
+	int k;
+
+	for (k = 0; k < 32; k++)
+	{
+		if (reg & 1)
+			reg = ((reg ^ stm32f4_crc_h.cm.cm_poly) >> 1) | 0x80000000;
+		else
+			reg >>= 1;
+	}
+	return reg;
+}
+
+
+// load the running crc of h into the hw
+static void crc_hard_load(struct crc_h *h)
+{
+	CRC_ResetDR();
+	if (h->cm.cm_reg != h->cm.cm_init)
+		CRC->DR = h->cm.cm_init ^ crc_hard_unshift(h->cm.cm_reg);
+}
+
+
+// crc_buf_hard in software for while the dma has the hw, the same words msb
+// first carrying on from h->cm.cm_reg, through the table if crc_init gave it one
+static uint32_t crc_buf_hard_soft(struct crc_h *h, const void *buf, uint32_t len, bool reset)
+{
+	const uint32_t *_buf = buf, *tbl = NULL;
+	uint32_t w, k;
+	uint8_t b;
+
+	if (h->ctable != NULL)
+		tbl = h->ctable;
+	else if (h->table != NULL && h->table_size >= 256*sizeof(uint32_t))
+		tbl = h->table;
+
+	if (reset)
+		cm_ini(&h->cm);
+
+	// whole words like the hw (see crc_buf_hard_len)
+	for (len = (len + 3) >> 2; len; len--)
+	{
+		w = *_buf++;
+		for (k = 0; k < 4; k++, w <<= 8)
+		{
+			b = (uint8_t)(w >> 24);
+			if (tbl == NULL)
+				cm_nxt(&h->cm, b);
+			else
+			{
+				b = (h->cm.cm_refin)? __RBIT(b) >> 24: b;
+				h->cm.cm_reg = tbl[(uint8_t)(h->cm.cm_reg >> 24) ^ b] ^ (h->cm.cm_reg << 8);
+			}
+		}
+	}
+
+	return crc_hard_out(h, h->cm.cm_reg);
+}
+
+
 uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 {
+	const uint32_t *_buf = buf;
 	uint32_t r; 
 
-	// crc hw is a shared resource so we need to lock around it
-	sys_enter_critical_section();
+	// crc hw is a shared resource so we need to lock around it, while the dma
+	// has it (see crc_buf_async) do it in software rather than wait
+	if (!crc_hard_lock())
+		return crc_buf_hard_soft(h, buf, len, reset);
 
-	// reset
+	// reset, or carry on from the last call on h (the hw may have been used since)
 	if (reset)
 		CRC_ResetDR();
+	else if (CRC->DR != h->cm.cm_reg)
+		crc_hard_load(h);
 
 	// mangle length so it is 4 byte aligned as hard requires this
 	if (len & 0x03)
@@ -78,23 +178,79 @@ uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset
 	else
 		len = (len >> 2);
 
-	// crc buf
-	r = CRC_CalcBlockCRC((uint32_t *)buf, len);
+	// crc buf (reflected models want the bits of each byte reversed on the
+	// way in, the bytes of each word still go msb first like the soft method)
+	if (h->cm.cm_refin)
+	{
+		while (len--)
+			CRC->DR = __RBIT(__REV(*_buf++));
+		r = CRC->DR;
+	}
+	else
+		r = CRC_CalcBlockCRC((uint32_t *)_buf, len);
 
-	// return result
-	sys_leave_critical_section();
-	return r;
+	// return result (keeping the register so the next call can carry on from it)
+	h->cm.cm_reg = r;
+	crc_hard_unlock();
+	return crc_hard_out(h, r);
+}
+
+
+// crc_buf_hard crc's whole words so a partial last word takes in the bytes after it
+uint32_t crc_buf_hard_len(struct crc_h *h, uint32_t len)
+{
+	return (len + 3) & ~3;
+}
+
+
+bool crc_update_hard(struct crc_h *h, const uint32_t *buf, uint32_t len)
+{
+	// crc hw is a shared resource so we need to lock around it, while the dma
+	// has it crc_update does the words in software rather than wait
+	if (!crc_hard_lock())
+		return false;
+
+	// load the running crc into the hw
+	crc_hard_load(h);
+
+	// the hw eats words msb first, so reverse them to crc the bytes in memory
+	// order (for reflected models reversing all 32 bits also gets each byte lsb first)
+	if (h->cm.cm_refin)
+	{
+		while (len--)
+			CRC->DR = __RBIT(*buf++);
+	}
+	else
+	{
+		while (len--)
+			CRC->DR = __REV(*buf++);
+	}
+
+	// save the running crc so the hw is free for others
+	h->cm.cm_reg = CRC->DR;
+	crc_hard_unlock();
+	return true;
+}
+
+
+bool crc_async_busy(void)
+{
+	return crc_hard_claimed;
 }
 
 
 bool crc_init_hard(struct crc_h *h)
 {
-	// if the cm config matches the hardware we are good to go !!
-	if (!cm_t_compare(&h->cm, &stm32f4_crc_h.cm))
+	// the hw is stuck with its poly and reset value, but the input can be bit
+	// reversed on the way in and the output stage done on the way out, so any
+	// refin/refot/xorot is fine (ie mpeg2, bzip2 and the zlib/ethernet crc32)
+	if (h->cm.cm_width != stm32f4_crc_h.cm.cm_width ||
+		h->cm.cm_poly != stm32f4_crc_h.cm.cm_poly ||
+		h->cm.cm_init != stm32f4_crc_h.cm.cm_init)
 		return false;
 
 	// crc hw is a shared resource so we need to lock around it
-	sys_enter_critical_section();
+	crc_hard_lock();
 
 	// start crc hw clock if needed
 	if (!clk_running)
@@ -103,7 +259,7 @@ bool crc_init_hard(struct crc_h *h)
 
 	// do initial reset
 	CRC_ResetDR();
-	sys_leave_critical_section();
+	crc_hard_unlock();
 
 	// mark as hard
 	h->method = CRC_METHOD_HARD;
@@ -14,6 +14,46 @@
 
 /* use this setup to use the hardware accelerated crc module */
 #include "../../lib/crc.h"
+#include "dma.h"
 extern struct crc_h stm32f4_crc_h;
 
+
+/* words handed to the dma per request by crc_buf_async (max 0xFFFF) */
+#ifndef CRC_ASYNC_CHUNK
+#define CRC_ASYNC_CHUNK (0x4000)
+#endif
+
+
+/**
+ * @brief called from the dma isr when crc_buf_async is done
+ * @param h crc handle passed to crc_buf_async
+ * @param crc result (same as crc_buf(h, buf, len, true) would give), 0 if !ok
+ * @param ok false if the dma failed part way (the crc hw is free again either way)
+ */
+typedef void (*crc_async_complete_event_t)(struct crc_h *h, uint32_t crc, bool ok);
+
+
+/**
+ * @brief crc a buffer in the background by feeding the crc hw from a dma stream
+ * @param h crc handle setup for the hard method (ie stm32f4_crc_h)
+ * @param dma a dma2 stream (this is a mem to mem transfer) ready for requests,
+ * either one from hw.c after dma_init or dma_acquire(NULL, DMA_DIR_MemoryToMemory, priority)
+ * @param buf word aligned buffer to crc (must stay valid until complete is called)
+ * @param len number of bytes (rounded up to whole words like crc_buf)
+ * @param complete called from the dma isr with the result (or the failure)
+ * @note only built with CONFIG_DMA. The crc hw belongs to the dma until
+ * complete is called, other hard crc calls are done in software until then
+ * (through the table if crc_init gave the handle one)
+ * @return false if h is not using the crc hw (or is a reflected model the dma
+ * cannot feed), dma is not a dma2 stream or an async crc is already running
+ */
+bool crc_buf_async(struct crc_h *h, dma_t *dma, const void *buf, uint32_t len, crc_async_complete_event_t complete);
+
+
+/**
+ * @brief check if an async crc is running
+ * @return true until the complete callback of the running crc_buf_async is called
+ */
+bool crc_async_busy(void);
+
 #endif
@@ -0,0 +1,131 @@
+/**
+ * @file crc_async.c
+ *
+ * @brief crc a buffer in the background by feeding the stm32f4 crc hw from a dma stream
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+
+#include <crc.h>
+#include <stm32f4xx_conf.h>
+#include "hal.h"
+#include "dma_hw.h"
+#include "crc_hw.h"
+
+
+// dma fed crc state (see crc_buf_async)
+static struct
+{
+	struct crc_h *h;
+	const uint32_t *buf;		// next word to hand to the dma
+	uint32_t len;				// words left to hand to the dma
+	crc_async_complete_event_t complete;
+	dma_request_t req;
+} crc_async = {NULL,};
+
+
+// hand the next chunk of the buffer to the dma
+static void crc_async_chunk(void)
+{
+	uint32_t n = crc_async.len;
+
+	if (n > CRC_ASYNC_CHUNK)
+		n = CRC_ASYNC_CHUNK;
+
+	crc_async.req.st_dma_init.DMA_PeripheralBaseAddr = (uint32_t)crc_async.buf;
+	crc_async.req.st_dma_init.DMA_BufferSize = n;
+	crc_async.buf += n;
+	crc_async.len -= n;
+	dma_request(&crc_async.req);
+}
+
+
+// dma isr, queue the next chunk or report the result
+static void crc_async_dma_complete(dma_request_t *req, void *param)
+{
+	struct crc_h *h = crc_async.h;
+	uint32_t r;
+
+	if (crc_async.len)
+	{
+		crc_async_chunk();
+		return;
+	}
+
+	// grab the result before we let anyone else at the hw
+	r = crc_hard_out(h, CRC->DR);
+	crc_hard_release();
+
+	if (crc_async.complete != NULL)
+		crc_async.complete(h, r, true);
+}
+
+
+// dma isr, the transfer failed so the hw holds a bad crc, drop the rest of
+// the buffer, give the hw back and report the failure
+static void crc_async_dma_error(dma_request_t *req, void *param)
+{
+	struct crc_h *h = crc_async.h;
+
+	crc_async.len = 0;
+	crc_hard_release();
+
+	if (crc_async.complete != NULL)
+		crc_async.complete(h, 0, false);
+}
+
+
+bool crc_buf_async(struct crc_h *h, dma_t *dma, const void *buf, uint32_t len, crc_async_complete_event_t complete)
+{
+	dma_request_t *req = &crc_async.req;
+
+	// only the hw can do this, and only from dma2 as it is mem to mem (the
+	// dma cannot bit reverse the words so reflected models are out too)
+	if (h->method != CRC_METHOD_HARD || h->cm.cm_refin || dma == NULL ||
+		((uint32_t)dma->stream & ~0xff) != DMA2_BASE)
+		return false;
+
+	// claim the crc hw (one async crc at a time)
+	if (!crc_hard_claim())
+		return false;
+
+	// mangle length so it is 4 byte aligned as hard requires this (same as crc_buf_hard)
+	crc_async.h = h;
+	crc_async.buf = buf;
+	crc_async.len = (len >> 2) + ((len & 0x03)? 1: 0);
+	crc_async.complete = complete;
+
+	// nothing to do so just report the reset value
+	if (crc_async.len == 0)
+	{
+		crc_async_dma_complete(req, NULL);
+		return true;
+	}
+
+	// mem to mem, the source buffer goes through the peripheral port and the
+	// crc data register is the fixed "memory" destination
+	req->complete = crc_async_dma_complete;
+	req->complete_param = NULL;
+	req->error = crc_async_dma_error;
+	req->dma = dma;
+	req->st_dma_init.DMA_Channel = dma->channel;
+	req->st_dma_init.DMA_Memory0BaseAddr = (uint32_t)&CRC->DR;
+	req->st_dma_init.DMA_DIR = DMA_DIR_MemoryToMemory;
+	req->st_dma_init.DMA_PeripheralInc = DMA_PeripheralInc_Enable;
+	req->st_dma_init.DMA_MemoryInc = DMA_MemoryInc_Disable;
+	req->st_dma_init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	req->st_dma_init.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+	req->st_dma_init.DMA_Mode = DMA_Mode_Normal;
+	req->st_dma_init.DMA_Priority = DMA_Priority_Low;
+	req->st_dma_init.DMA_FIFOMode = DMA_FIFOMode_Enable;
+	req->st_dma_init.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
+	req->st_dma_init.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	req->st_dma_init.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+
+	crc_async_chunk();
+	return true;
+}
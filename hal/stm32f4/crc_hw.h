@@ -0,0 +1,34 @@
+/**
+ * @file crc_hw.h
+ *
+ * @brief crc hw shared between crc.c and the dma fed crc in crc_async.c
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#ifndef __CRC_HW__
+#define __CRC_HW__
+
+#include <hal.h>
+
+/**
+ * @brief take the crc hw for a dma fed crc, it is reset ready for the first word
+ * @note crc_buf_hard and crc_update_hard are done in software until crc_hard_release
+ * @return false if it is already taken
+ */
+bool crc_hard_claim(void);
+
+/**
+ * @brief give the crc hw back once the result has been read
+ */
+void crc_hard_release(void);
+
+/**
+ * @brief do the output stage of the model (the hw register is never reflected or xor'd on the way out)
+ */
+uint32_t crc_hard_out(struct crc_h *h, uint32_t reg);
+
+#endif
@@ -9,6 +9,7 @@
  *
  */
 
+#include <string.h>
 #include <stm32f4xx_conf.h>
 #include "hal.h"
 #include "dma_hw.h"
@@ -78,407 +79,770 @@ static unsigned int dma_irq(dma_t *dma)
 	}
 }
 
-static void dma_clear_isr(dma_t *dma)
+// all the flags of a stream (before the shift to where it is in L/HISR)
+#define DMA_ISR_ALL (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS)
+
+// the streams are 0x18 apart from 0x10 into their dma, and the flags of streams
+// 0-3 are 0, 6, 16 and 22 bits up L/HISR (worked out rather than looked up as
+// a table would be in flash)
+ramfunc static void dma_clear_isr(dma_t *dma)
 {
-	switch ((uint32_t)dma->stream)
-	{
-		case (uint32_t)DMA1_Stream0:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF0);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF0);
-			break;
-		case (uint32_t)DMA1_Stream1:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF1);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF1);
-			break;
-		case (uint32_t)DMA1_Stream2:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF2);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF2);
-			break;
-		case (uint32_t)DMA1_Stream3:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF3);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF3);
-			break;
-		case (uint32_t)DMA1_Stream4:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF4);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF4);
-			break;
-		case (uint32_t)DMA1_Stream5:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF5);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF5);
-			break;
-		case (uint32_t)DMA1_Stream6:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF6);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF6);
-			break;
-		case (uint32_t)DMA1_Stream7:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF7);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF7);
-			break;
+	uint32_t stream = (uint32_t)dma->stream;
+	DMA_TypeDef *dmax = (DMA_TypeDef *)(stream & ~0x3ff);
+	uint32_t n = ((stream & 0x3ff) - 0x10) / 0x18;
+	uint32_t flags = DMA_ISR_ALL << ((n & 1) * 6 + (n & 2) * 8);
+
+	if (n < 4)
+		dmax->LIFCR = flags;
+	else
+		dmax->HIFCR = flags;
+}
 
-		case (uint32_t)DMA2_Stream0:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF0);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF0);
-			break;
-		case (uint32_t)DMA2_Stream1:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF1);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF1);
-			break;
-		case (uint32_t)DMA2_Stream2:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF2);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF2);
-			break;
-		case (uint32_t)DMA2_Stream3:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF3);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF3);
-			break;
-		case (uint32_t)DMA2_Stream4:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF4);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF4);
-			break;
-		case (uint32_t)DMA2_Stream5:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF5);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF5);
-			break;
-		case (uint32_t)DMA2_Stream6:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF6);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF6);
-			break;
-		case (uint32_t)DMA2_Stream7:
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF7);
-			DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF7);
-			break;
-		default:
-			///@todo error !
-			break;
+// start the request at the head of the queue. A normal transfer clears EN itself
+// when it completes, if a cancel is still stopping the stream this is left to
+// the tc isr once it has (see dma_stop)
+ramfunc static void dma_start(dma_t *dma)
+{
+	dma_request_t *req = dma->reqs;
+	DMA_InitTypeDef *init = &req->st_dma_init;
+	DMA_Stream_TypeDef *stream = dma->stream;
+	uint32_t cr;
+
+	if (dma->stopping)
+		return;
+	dma_clear_isr(dma);
+
+	// what DMA_Init and DMA_ITConfig do, straight into the registers (CT is left
+	// clear so a double buffered request starts on memory 0)
+	cr = init->DMA_Channel | init->DMA_DIR | init->DMA_PeripheralInc | init->DMA_MemoryInc |
+		init->DMA_PeripheralDataSize | init->DMA_MemoryDataSize | init->DMA_Mode |
+		init->DMA_Priority | init->DMA_MemoryBurst | init->DMA_PeripheralBurst |
+		DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE;
+	if (req->memory1 != NULL)
+	{
+		cr |= DMA_SxCR_DBM;
+		stream->M1AR = (uint32_t)req->memory1;
 	}
+	else if (dma->circ)
+		cr |= DMA_SxCR_HTIE;
+	stream->FCR = init->DMA_FIFOMode | init->DMA_FIFOThreshold | DMA_SxFCR_FEIE;
+	stream->NDTR = init->DMA_BufferSize;
+	stream->PAR = init->DMA_PeripheralBaseAddr;
+	stream->M0AR = init->DMA_Memory0BaseAddr;
+	stream->CR = cr;
+	stream->CR = cr | DMA_SxCR_EN;
+}
+
+// stop the running request without waiting for the stream to stop, if it is
+// still going it finishes the current beat and then sets TC, so TC is left on
+// and the next request is started from the isr
+ramfunc static void dma_stop(dma_t *dma)
+{
+	DMA_Stream_TypeDef *stream = dma->stream;
+
+	stream->FCR &= ~DMA_SxFCR_FEIE;
+	stream->CR &= ~(DMA_SxCR_HTIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE | DMA_SxCR_EN);
+	if (stream->CR & DMA_SxCR_EN)
+		dma->stopping = true;
+	else
+		stream->CR &= ~DMA_SxCR_TCIE;
+}
+
+// take the running request off the queue and start the next one
+ramfunc static void dma_next(dma_t *dma)
+{
+	dma_request_t *req = dma->reqs;
+
+	dma->reqs = req->next;
+	req->next = NULL;
+	if (dma->reqs != NULL)
+		dma_start(dma);
+	else
+		dma->reqs_tail = NULL;
+}
+
+// a buffer of a double buffered request is done, CT has already moved on to the
+// other one so this one is free to be swapped
+ramfunc static void dma_buffer_done(dma_t *dma, dma_request_t *req)
+{
+	volatile uint32_t *target;
+	void *buf, *next;
+
+	target = (dma->stream->CR & DMA_SxCR_CT)? &dma->stream->M0AR: &dma->stream->M1AR;
+	buf = (void *)*target;
+	if (req->buffer_complete == NULL)
+		return;
+	next = req->buffer_complete(req, buf, req->complete_param);
+	if (next != NULL && next != buf)
+		*target = (uint32_t)next;
+}
+
+// count a transfer of the running request, and how long it took from dma_request if it is
+// done (not circular)
+ramfunc static void dma_count(dma_t *dma, dma_request_t *req)
+{
+	uint32_t latency;
+
+	dma->stats.transfers++;
+	dma->stats.bytes += req->st_dma_init.DMA_BufferSize << (req->st_dma_init.DMA_PeripheralDataSize >> 11);
+	if (req->memory1 != NULL || dma->circ)
+		return;
+
+	latency = DWT->CYCCNT - req->queued;
+	dma->stats.latency_last = latency;
+	if (latency > dma->stats.latency_max)
+		dma->stats.latency_max = latency;
+	dma->stats.latency_total += latency;
+	dma->stats.latency_count++;
 }
 
-static void dma_irq_handler(dma_t *dma)
+// the running request has failed, take it off so the stream is not left stuck on it
+ramfunc static void dma_fail(dma_t *dma, dma_request_t *req)
+{
+	dma->stats.failed++;
+	dma_stop(dma);
+	dma_next(dma);
+
+	if (req->error != NULL)
+		req->error(req, req->complete_param);
+	else if (req->complete != NULL)
+		req->complete(req, req->complete_param);
+}
+
+ramfunc static void dma_irq_handler(dma_t *dma)
 {
 	dma_request_t *req;
+	uint32_t status;
 
-	if (dma == NULL || dma->reqs == NULL)
+	if (dma == NULL)
 		///@todo interrupt for dma that is not enabled !
 		return;
 
+	// a cancelled stream has stopped, start what was queued behind it
+	status = dma->isr_status;
+	if (dma->stopping)
+	{
+		if (!(status & DMA_ISR_TC))
+			return;
+		dma->stopping = false;
+		dma->stream->CR &= ~DMA_SxCR_TCIE;
+		if (dma->reqs != NULL)
+			dma_start(dma);
+		return;
+	}
+
+	if (dma->reqs == NULL)
+		///@todo interrupt for dma that is not enabled !
+		return;
 	req = dma->reqs;
+	if (status & DMA_ISR_ERRORS)
+	{
+		// a transfer error stops the stream, so can a fifo error (bad burst/fifo setup),
+		// else the stream carries on and the error is only counted
+		dma->stats.errors++;
+		if ((status & DMA_ISR_TE) || (!(status & DMA_ISR_TC) && !(dma->stream->CR & DMA_SxCR_EN)))
+		{
+			dma_fail(dma, req);
+			return;
+		}
+		if (!(status & (DMA_ISR_TC | DMA_ISR_HT)))
+			return;
+	}
+
+	if (status & DMA_ISR_TC)
+		dma_count(dma, req);
+
+	if (req->memory1 != NULL)
+	{
+		dma_buffer_done(dma, req);
+		return;
+	}
+
 	if (!dma->circ)
 	{
-		DMA_ITConfig(dma->stream, DMA_IT_TC, DISABLE);
-		DMA_ITConfig(dma->stream, DMA_IT_HT, DISABLE);
-		DMA_Cmd(dma->stream, DISABLE);
-		dma->reqs = NULL; // free the dma before complete so complete can sched another
+		// start the next one before complete so the stream is not left idle, and
+		// so complete can queue another
+		dma_stop(dma);
+		dma_next(dma);
 	}
 
 	if (req->complete != NULL)
 		req->complete(req, req->complete_param);
 }
 
-void DMA1_Stream0_IRQHandler(void)
+ramfunc void DMA1_Stream0_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[0];
 	dma->isr_status = (DMA1->LISR >> 0) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF0);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF0);
+		DMA1->LIFCR = DMA_ISR_ALL << 0;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream1_IRQHandler(void)
+ramfunc void DMA1_Stream1_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[1];
 	dma->isr_status = (DMA1->LISR >> 6) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF1);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF1);
+		DMA1->LIFCR = DMA_ISR_ALL << 6;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream2_IRQHandler(void)
+ramfunc void DMA1_Stream2_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[2];
 	dma->isr_status = (DMA1->LISR >> 16) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF2);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF2);
+		DMA1->LIFCR = DMA_ISR_ALL << 16;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream3_IRQHandler(void)
+ramfunc void DMA1_Stream3_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[3];
 	dma->isr_status = (DMA1->LISR >> 22) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF3);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF3);
+		DMA1->LIFCR = DMA_ISR_ALL << 22;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream4_IRQHandler(void)
+ramfunc void DMA1_Stream4_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[4];
 	dma->isr_status = (DMA1->HISR >> 0) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF4);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF4);
+		DMA1->HIFCR = DMA_ISR_ALL << 0;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream5_IRQHandler(void)
+ramfunc void DMA1_Stream5_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[5];
 	dma->isr_status = (DMA1->HISR >> 6) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF5);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF5);
+		DMA1->HIFCR = DMA_ISR_ALL << 6;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream6_IRQHandler(void)
+ramfunc void DMA1_Stream6_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[6];
 	dma->isr_status = (DMA1->HISR >> 16) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF6);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF6);
+		DMA1->HIFCR = DMA_ISR_ALL << 16;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA1_Stream7_IRQHandler(void)
+ramfunc void DMA1_Stream7_IRQHandler(void)
 {
 	dma_t *dma = dma1_irq_list[7];
 	dma->isr_status = (DMA1->HISR >> 22) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF7);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF7);
+		DMA1->HIFCR = DMA_ISR_ALL << 22;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream0_IRQHandler(void)
+ramfunc void DMA2_Stream0_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[0];
 	dma->isr_status = (DMA2->LISR >> 0) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF0);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF0);
+		DMA2->LIFCR = DMA_ISR_ALL << 0;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream1_IRQHandler(void)
+ramfunc void DMA2_Stream1_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[1];
 	dma->isr_status = (DMA2->LISR >> 6) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF1);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF1);
+		DMA2->LIFCR = DMA_ISR_ALL << 6;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream2_IRQHandler(void)
+ramfunc void DMA2_Stream2_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[2];
 	dma->isr_status = (DMA2->LISR >> 16) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF2);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF2);
+		DMA2->LIFCR = DMA_ISR_ALL << 16;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream3_IRQHandler(void)
+ramfunc void DMA2_Stream3_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[3];
 	dma->isr_status = (DMA2->LISR >> 22) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF3);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF3);
+		DMA2->LIFCR = DMA_ISR_ALL << 22;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream4_IRQHandler(void)
+ramfunc void DMA2_Stream4_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[4];
 	dma->isr_status = (DMA2->HISR >> 0) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF4);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF4);
+		DMA2->HIFCR = DMA_ISR_ALL << 0;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream5_IRQHandler(void)
+ramfunc void DMA2_Stream5_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[5];
 	dma->isr_status = (DMA2->HISR >> 6) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF5);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF5);
+		DMA2->HIFCR = DMA_ISR_ALL << 6;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream6_IRQHandler(void)
+ramfunc void DMA2_Stream6_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[6];
 	dma->isr_status = (DMA2->HISR >> 16) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF6);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF6);
+		DMA2->HIFCR = DMA_ISR_ALL << 16;
 		dma_irq_handler(dma);
 	}
 }
 
-void DMA2_Stream7_IRQHandler(void)
+ramfunc void DMA2_Stream7_IRQHandler(void)
 {
 	dma_t *dma = dma2_irq_list[7];
 	dma->isr_status = (DMA2->HISR >> 22) & 0x3f;
 
-	if (dma->isr_status & 0x30)
+	if (dma->isr_status & (DMA_ISR_TC | DMA_ISR_HT | DMA_ISR_ERRORS))
 	{
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_TCIF7);
-		DMA_ClearITPendingBit(dma->stream, DMA_IT_HTIF7);
+		DMA2->HIFCR = DMA_ISR_ALL << 22;
 		dma_irq_handler(dma);
 	}
 }
 
 
-static dma_request_t dma_memcpy_req;
+// the dma2 streams the memcpy/memset engine queues on and the bytes each has left to do
+#define DMA_MEM_STREAMS (2)
+static dma_t *dma_mem_streams[DMA_MEM_STREAMS];
+static uint32_t dma_mem_queued[DMA_MEM_STREAMS];
+static int dma_mem_count = 0;
 
-static dma_memcpy_complete_event_t dma_memcpy_complete = NULL;
+// bytes one side of a copy moves at a time, a whole 16 byte burst if its address
+// is 16 byte aligned (so a burst never crosses a 1K boundary) else the widest data
+// size the address allows
+static uint32_t dma_mem_unit(uint32_t addr, uint32_t len)
+{
+	if ((addr & 0x0f) == 0 && len >= 16)
+		return 16;
+	if ((addr & 0x03) == 0 && len >= 4)
+		return 4;
+	if ((addr & 0x01) == 0 && len >= 2)
+		return 2;
+	return 1;
+}
+
+// set up the next piece of op, the fifo packs between the two sides so each can
+// use its own data size and burst
+static void dma_mem_piece(dma_mem_t *op)
+{
+	DMA_InitTypeDef *init = &op->req.st_dma_init;
+	uint32_t dst = (uint32_t)op->dst + op->done;
+	uint32_t src = (op->src == NULL)? (uint32_t)&op->fill: (uint32_t)op->src + op->done;
+	uint32_t left = op->len - op->done;
+	uint32_t dst_unit, src_unit, size;
+
+	// a memset reads the fill word over and over, as wide as the writes
+	dst_unit = dma_mem_unit(dst, left);
+	if (op->src == NULL)
+		src_unit = (dst_unit > 4)? 4: dst_unit;
+	else
+		src_unit = dma_mem_unit(src, left);
+
+	// a whole number of bursts on both sides and at most 0xffff reads
+	size = (src_unit > 4)? 4: src_unit;
+	op->piece = (left > 0xffff * size)? 0xffff * size: left;
+	op->piece -= op->piece % ((dst_unit > src_unit)? dst_unit: src_unit);
+
+	init->DMA_Channel = op->req.dma->channel;
+	init->DMA_PeripheralBaseAddr = src;
+	init->DMA_Memory0BaseAddr = dst;
+	init->DMA_DIR = DMA_DIR_MemoryToMemory;
+	init->DMA_BufferSize = op->piece / size;
+	init->DMA_PeripheralInc = (op->src == NULL)? DMA_PeripheralInc_Disable: DMA_PeripheralInc_Enable;
+	init->DMA_MemoryInc = DMA_MemoryInc_Enable;
+	init->DMA_PeripheralDataSize = (src_unit >= 4)? DMA_PeripheralDataSize_Word:
+		(src_unit == 2)? DMA_PeripheralDataSize_HalfWord: DMA_PeripheralDataSize_Byte;
+	init->DMA_MemoryDataSize = (dst_unit >= 4)? DMA_MemoryDataSize_Word:
+		(dst_unit == 2)? DMA_MemoryDataSize_HalfWord: DMA_MemoryDataSize_Byte;
+	init->DMA_Mode = DMA_Mode_Normal;
+	init->DMA_Priority = DMA_Priority_Low;
+	init->DMA_FIFOMode = DMA_FIFOMode_Enable;
+	init->DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	init->DMA_MemoryBurst = (dst_unit == 16)? DMA_MemoryBurst_INC4: DMA_MemoryBurst_Single;
+	init->DMA_PeripheralBurst = (src_unit == 16)? DMA_PeripheralBurst_INC4: DMA_PeripheralBurst_Single;
+}
+
+// take len off the bytes queued on dma if it is an engine stream
+static void dma_mem_unqueue(dma_t *dma, uint32_t len)
+{
+	int n;
+
+	sys_enter_critical_section();
+	for (n = 0; n < dma_mem_count; n++)
+		if (dma_mem_streams[n] == dma)
+			dma_mem_queued[n] -= len;
+	sys_leave_critical_section();
+}
+
+static void dma_mem_done(dma_request_t *req, void *param)
+{
+	dma_mem_t *op = (dma_mem_t *)param;
+
+	// queue the next piece, if any, behind whatever else is on the stream
+	op->done += op->piece;
+	if (op->done < op->len)
+	{
+		dma_mem_piece(op);
+		dma_request(&op->req);
+		return;
+	}
+
+	dma_mem_unqueue(req->dma, op->len);
+	if (op->complete != NULL)
+		op->complete(op, op->param);
+}
+
+// a piece failed, op ends with done short of len
+static void dma_mem_error(dma_request_t *req, void *param)
+{
+	dma_mem_t *op = (dma_mem_t *)param;
+
+	dma_mem_unqueue(req->dma, op->len);
+	if (op->complete != NULL)
+		op->complete(op, op->param);
+}
+
+static void dma_mem_start(dma_mem_t *op, dma_t *dma)
+{
+	op->done = 0;
+	op->req.complete = dma_mem_done;
+	op->req.error = dma_mem_error;
+	op->req.complete_param = op;
+	op->req.dma = dma;
+	dma_mem_piece(op);
+	dma_request(&op->req);
+}
+
+// queue op on the engine stream with the least to do
+static void dma_mem_queue(dma_mem_t *op)
+{
+	int n, k = 0;
+
+	if (dma_mem_count == 0 || op->len == 0)
+	{
+		// no streams (or nothing to do) so the cpu does it now
+		if (op->src == NULL)
+			memset(op->dst, (uint8_t)op->fill, op->len);
+		else
+			memcpy(op->dst, op->src, op->len);
+		op->req.dma = NULL;
+		op->done = op->len;
+		if (op->complete != NULL)
+			op->complete(op, op->param);
+		return;
+	}
+
+	sys_enter_critical_section();
+	for (n = 1; n < dma_mem_count; n++)
+		if (dma_mem_queued[n] < dma_mem_queued[k])
+			k = n;
+	dma_mem_queued[k] += op->len;
+	dma_mem_start(op, dma_mem_streams[k]);
+	sys_leave_critical_section();
+}
+
+int dma_mem_init(uint8_t priority)
+{
+	dma_t *dma;
+
+	sys_enter_critical_section();
+	while (dma_mem_count < DMA_MEM_STREAMS &&
+		(dma = dma_acquire(NULL, DMA_DIR_MemoryToMemory, priority)) != NULL)
+	{
+		dma_mem_queued[dma_mem_count] = 0;
+		dma_mem_streams[dma_mem_count++] = dma;
+	}
+	sys_leave_critical_section();
+	return dma_mem_count;
+}
+
+void dma_mem_copy(dma_mem_t *op, void *dst, const void *src, uint32_t len, dma_mem_complete_event_t complete, void *param)
+{
+	op->dst = dst;
+	op->src = src;
+	op->len = len;
+	op->complete = complete;
+	op->param = param;
+	dma_mem_queue(op);
+}
 
-static void memcpy_complete(dma_request_t *req, void *param)
+void dma_mem_set(dma_mem_t *op, void *dst, uint8_t value, uint32_t len, dma_mem_complete_event_t complete, void *param)
 {
-	if (req == &dma_memcpy_req && dma_memcpy_complete != NULL)
+	op->dst = dst;
+	op->src = NULL;
+	op->fill = value * 0x01010101;
+	op->len = len;
+	op->complete = complete;
+	op->param = param;
+	dma_mem_queue(op);
+}
+
+void dma_mem_cancel(dma_mem_t *op)
+{
+	sys_enter_critical_section();
+	if (op->req.dma != NULL && op->done < op->len)
 	{
-		void *src = (void *)req->st_dma_init.DMA_PeripheralBaseAddr;
-		void *dst = (void *)req->st_dma_init.DMA_Memory0BaseAddr;
-		int len =  req->st_dma_init.DMA_BufferSize;
-		dma_memcpy_complete(req->dma, dst, src, len);
+		dma_cancel_request(&op->req);
+		dma_mem_unqueue(op->req.dma, op->len);
+		op->done = op->len;
 	}
+	sys_leave_critical_section();
+}
+
+
+// dma_memcpy is a single op on the stream given
+static dma_mem_t dma_memcpy_op;
+
+static dma_memcpy_complete_event_t dma_memcpy_complete = NULL;
+
+static void memcpy_complete(dma_mem_t *op, void *param)
+{
+	if (dma_memcpy_complete != NULL)
+		dma_memcpy_complete(op->req.dma, op->dst, (void *)op->src, op->len);
 }
 
 void dma_memcpy(dma_t *dma, void *dst, void *src, int len, dma_memcpy_complete_event_t complete)
 {
-	dma_request_t *req = &dma_memcpy_req;
+	dma_mem_t *op = &dma_memcpy_op;
 
 	dma_memcpy_complete = complete;
 
-	req->complete = memcpy_complete;
-	req->complete_param = NULL;
-	req->dma = dma;
-
-	req->st_dma_init.DMA_Channel = dma->channel;
-	req->st_dma_init.DMA_PeripheralBaseAddr = (uint32_t)src;
-	req->st_dma_init.DMA_Memory0BaseAddr = (uint32_t)dst;
-	req->st_dma_init.DMA_DIR = DMA_DIR_MemoryToMemory;
-	req->st_dma_init.DMA_BufferSize = len;
-	req->st_dma_init.DMA_PeripheralInc = DMA_PeripheralInc_Enable;
-	req->st_dma_init.DMA_MemoryInc = DMA_MemoryInc_Enable;
-	req->st_dma_init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
-	req->st_dma_init.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
-	req->st_dma_init.DMA_Mode = DMA_Mode_Normal;
-	req->st_dma_init.DMA_Priority = DMA_Priority_Low;
-	req->st_dma_init.DMA_FIFOMode = DMA_FIFOMode_Enable;
-	req->st_dma_init.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
-	req->st_dma_init.DMA_MemoryBurst = DMA_MemoryBurst_Single;
-	req->st_dma_init.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
-
-	dma_request(req);
+	op->dst = dst;
+	op->src = src;
+	op->len = len;
+	op->complete = memcpy_complete;
+	op->param = NULL;
+	op->req.dma = dma;
+	if (len <= 0)
+	{
+		memcpy_complete(op, NULL);
+		return;
+	}
+	dma_mem_start(op, dma);
+}
+
+static void dma_queue(dma_request_t *req, void *memory1)
+{
+	dma_t *dma = req->dma;
+	dma_request_t *r;
+
+	sys_enter_critical_section();
+
+	// already queued
+	for (r = dma->reqs; r != NULL; r = r->next)
+		if (r == req)
+			goto done;
+
+	req->memory1 = memory1;
+	req->next = NULL;
+	req->queued = DWT->CYCCNT;
+	if (dma->reqs == NULL)
+	{
+		dma->reqs = req;
+		dma->reqs_tail = req;
+		dma_start(dma);
+	}
+	else
+	{
+		dma->reqs_tail->next = req;
+		dma->reqs_tail = req;
+	}
+
+done:
+	sys_leave_critical_section();
 }
 
 void dma_request(dma_request_t *req)
+{
+	dma_queue(req, NULL);
+}
+
+void dma_request_double_buffer(dma_request_t *req, void *memory1, dma_buffer_event_t buffer_complete)
+{
+	if (memory1 == NULL || req->st_dma_init.DMA_DIR == DMA_DIR_MemoryToMemory)
+		///@todo error not supported
+		return;
+
+	req->st_dma_init.DMA_Mode = DMA_Mode_Circular;
+	req->buffer_complete = buffer_complete;
+	dma_queue(req, memory1);
+}
+
+void dma_cancel_request(dma_request_t *req)
 {
 	dma_t *dma = req->dma;
+	dma_request_t *r;
 
-	///@todo queue a list of requests (for now just 1 at a time please)
-	if (dma->reqs != NULL)
-		///@todo error dma busy !
+	if (dma == NULL)
 		return;
-	dma->reqs = req;
 
-	dma_clear_isr(dma);
-	DMA_Cmd(dma->stream, DISABLE);
-	while (DMA_GetCmdStatus(dma->stream))
-	{}
-	DMA_Init(dma->stream, &req->st_dma_init);
-	DMA_ITConfig(dma->stream, DMA_IT_TC, ENABLE);
-	if (dma->circ)
-		DMA_ITConfig(dma->stream, DMA_IT_HT, ENABLE);
-	DMA_Cmd(dma->stream, ENABLE);
+	sys_enter_critical_section();
+	if (dma->reqs == req)
+	{
+		dma_stop(dma);
+		dma_next(dma);
+	}
+	else
+	{
+		for (r = dma->reqs; r != NULL && r->next != req; r = r->next)
+		{}
+		if (r != NULL)
+		{
+			r->next = req->next;
+			if (dma->reqs_tail == req)
+				dma->reqs_tail = r;
+			req->next = NULL;
+		}
+	}
+	sys_leave_critical_section();
 }
 
 int dma_remaining(dma_request_t *req)
 {
 	dma_t *dma = req->dma;
-	return dma->stream->NDTR;
+	dma_request_t *r;
+	int n = 0;
+
+	sys_enter_critical_section();
+	if (dma->reqs == req && !dma->stopping)
+		n = dma->stream->NDTR;
+	else
+	{
+		for (r = dma->reqs; r != NULL; r = r->next)
+			if (r == req)
+				n = req->st_dma_init.DMA_BufferSize;
+	}
+	sys_leave_critical_section();
+	return n;
 }
 
 void dma_cancel(dma_t *dma)
 {
+	dma_request_t *req;
+
 	if (dma == NULL)
 		return;
 
-	dma_clear_isr(dma);
-	DMA_Cmd(dma->stream, DISABLE);
-	while (DMA_GetCmdStatus(dma->stream))
-	{}
-	dma->reqs = NULL;
+	// the stream is left stopping, the next dma_request is started from the tc isr once it has
+	sys_enter_critical_section();
+	dma_stop(dma);
+	while ((req = dma->reqs) != NULL)
+	{
+		dma->reqs = req->next;
+		req->next = NULL;
+	}
+	dma->reqs_tail = NULL;
+	sys_leave_critical_section();
+}
+
+void dma_get_stats(dma_t *dma, dma_stats_t *stats)
+{
+	sys_enter_critical_section();
+	*stats = dma->stats;
+	sys_leave_critical_section();
 }
 
-void dma_init(dma_t *dma)
+void dma_clear_stats(dma_t *dma)
+{
+	sys_enter_critical_section();
+	memset(&dma->stats, 0, sizeof(dma->stats));
+	sys_leave_critical_section();
+}
+
+static dma_t **dma_slot(DMA_Stream_TypeDef *stream, dma_t **pool);
+
+bool dma_init(dma_t *dma)
 {
 	NVIC_InitTypeDef NVIC_InitStructure;
+	dma_t **slot, *pool;
 
 	if (dma == NULL)
-		return;
+		return false;
+
+	// a fixed dma_t whose driver starts after dma_acquire handed its stream out
+	// must not take the irq from under it, so refuse until it is released
+	sys_enter_critical_section();
+	slot = dma_slot(dma->stream, &pool);
+	if (slot != NULL && *slot != NULL && *slot != dma && (*slot)->acquired)
+	{
+		sys_leave_critical_section();
+		return false;
+	}
+	if (slot != NULL)
+		*slot = dma;
+	sys_leave_critical_section();
 
 	dma->reqs = NULL;
+	dma->reqs_tail = NULL;
+	memset(&dma->stats, 0, sizeof(dma->stats));
 
 	// enable clocks
 	switch ((uint32_t)dma->stream)
 	{
 		case (uint32_t)DMA1_Stream0:
+		case (uint32_t)DMA1_Stream1:
 		case (uint32_t)DMA1_Stream2:
 		case (uint32_t)DMA1_Stream3:
 		case (uint32_t)DMA1_Stream4:
@@ -488,6 +852,7 @@ void dma_init(dma_t *dma)
 			RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
 			break;
 		case (uint32_t)DMA2_Stream0:
+		case (uint32_t)DMA2_Stream1:
 		case (uint32_t)DMA2_Stream2:
 		case (uint32_t)DMA2_Stream3:
 		case (uint32_t)DMA2_Stream4:
@@ -507,5 +872,237 @@ void dma_init(dma_t *dma)
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&NVIC_InitStructure);
+	return true;
 }
 
+
+// which stream and channel can serve each peripheral request (RM0090 dma1 and dma2
+// request mapping tables) for the peripherals the hal drives with dma
+struct dma_map_t
+{
+	void *periph;
+	uint32_t dir;
+	DMA_Stream_TypeDef *stream;
+	uint32_t channel;
+};
+
+#define RX DMA_DIR_PeripheralToMemory
+#define TX DMA_DIR_MemoryToPeripheral
+static const struct dma_map_t dma_map[] =
+{
+	{SPI1, RX, DMA2_Stream0, DMA_Channel_3},
+	{SPI1, RX, DMA2_Stream2, DMA_Channel_3},
+	{SPI1, TX, DMA2_Stream3, DMA_Channel_3},
+	{SPI1, TX, DMA2_Stream5, DMA_Channel_3},
+	{SPI2, RX, DMA1_Stream3, DMA_Channel_0},
+	{SPI2, TX, DMA1_Stream4, DMA_Channel_0},
+	{SPI3, RX, DMA1_Stream0, DMA_Channel_0},
+	{SPI3, RX, DMA1_Stream2, DMA_Channel_0},
+	{SPI3, TX, DMA1_Stream5, DMA_Channel_0},
+	{SPI3, TX, DMA1_Stream7, DMA_Channel_0},
+
+	{USART1, RX, DMA2_Stream2, DMA_Channel_4},
+	{USART1, RX, DMA2_Stream5, DMA_Channel_4},
+	{USART1, TX, DMA2_Stream7, DMA_Channel_4},
+	{USART2, RX, DMA1_Stream5, DMA_Channel_4},
+	{USART2, TX, DMA1_Stream6, DMA_Channel_4},
+	{USART3, RX, DMA1_Stream1, DMA_Channel_4},
+	{USART3, TX, DMA1_Stream3, DMA_Channel_4},
+	{USART3, TX, DMA1_Stream4, DMA_Channel_7},
+	{UART4, RX, DMA1_Stream2, DMA_Channel_4},
+	{UART4, TX, DMA1_Stream4, DMA_Channel_4},
+	{UART5, RX, DMA1_Stream0, DMA_Channel_4},
+	{UART5, TX, DMA1_Stream7, DMA_Channel_4},
+	{USART6, RX, DMA2_Stream1, DMA_Channel_5},
+	{USART6, RX, DMA2_Stream2, DMA_Channel_5},
+	{USART6, TX, DMA2_Stream6, DMA_Channel_5},
+	{USART6, TX, DMA2_Stream7, DMA_Channel_5},
+
+	{I2C1, RX, DMA1_Stream0, DMA_Channel_1},
+	{I2C1, RX, DMA1_Stream5, DMA_Channel_1},
+	{I2C1, TX, DMA1_Stream6, DMA_Channel_1},
+	{I2C1, TX, DMA1_Stream7, DMA_Channel_1},
+	{I2C2, RX, DMA1_Stream2, DMA_Channel_7},
+	{I2C2, RX, DMA1_Stream3, DMA_Channel_7},
+	{I2C2, TX, DMA1_Stream7, DMA_Channel_7},
+	{I2C3, RX, DMA1_Stream2, DMA_Channel_3},
+	{I2C3, TX, DMA1_Stream4, DMA_Channel_3},
+
+	{ADC1, RX, DMA2_Stream0, DMA_Channel_0},
+	{ADC1, RX, DMA2_Stream4, DMA_Channel_0},
+	{ADC2, RX, DMA2_Stream2, DMA_Channel_1},
+	{ADC2, RX, DMA2_Stream3, DMA_Channel_1},
+	{ADC3, RX, DMA2_Stream0, DMA_Channel_2},
+	{ADC3, RX, DMA2_Stream1, DMA_Channel_2},
+
+	{SDIO, RX, DMA2_Stream3, DMA_Channel_4},
+	{SDIO, RX, DMA2_Stream6, DMA_Channel_4},
+	{SDIO, TX, DMA2_Stream3, DMA_Channel_4},
+	{SDIO, TX, DMA2_Stream6, DMA_Channel_4},
+};
+#undef RX
+#undef TX
+
+// only dma2 can do memory to memory, any stream any channel
+static DMA_Stream_TypeDef * const dma2_streams[8] =
+{
+	DMA2_Stream0, DMA2_Stream1, DMA2_Stream2, DMA2_Stream3,
+	DMA2_Stream4, DMA2_Stream5, DMA2_Stream6, DMA2_Stream7,
+};
+
+// a dma_t for each stream to hand out, and the waiters in priority order
+static dma_t dma_pool[2][8];
+static dma_waiter_t *dma_waiters = NULL;
+
+
+// slot in the irq lists for a stream, so the pool entry for it (NULL if it is not a stream)
+static dma_t **dma_slot(DMA_Stream_TypeDef *stream, dma_t **pool)
+{
+	uint32_t base = (uint32_t)stream & ~0x3ff;
+	uint32_t n = (((uint32_t)stream & 0x3ff) - 0x10) / 0x18;
+
+	if ((base != (uint32_t)DMA1 && base != (uint32_t)DMA2) || n >= 8)
+		return NULL;
+	if (base == (uint32_t)DMA1)
+	{
+		*pool = &dma_pool[0][n];
+		return &dma1_irq_list[n];
+	}
+	*pool = &dma_pool[1][n];
+	return &dma2_irq_list[n];
+}
+
+
+// take stream if nothing has it, must be called in a critical section (this
+// is only the bookkeeping, the caller does the dma_init once out of it)
+static dma_t *dma_take(DMA_Stream_TypeDef *stream, uint32_t channel, uint8_t priority)
+{
+	dma_t **slot, *dma;
+
+	// fixed dma_t's from hw.c own their stream for good
+	slot = dma_slot(stream, &dma);
+	if (slot == NULL || (*slot != NULL && (*slot != dma || dma->acquired)))
+		return NULL;
+
+	dma->stream = stream;
+	dma->channel = channel;
+	dma->preemption_priority = priority;
+	dma->circ = 0;
+	dma->acquired = true;
+	*slot = dma;
+	return dma;
+}
+
+
+// first free stream that can serve periph, must be called in a critical section
+static dma_t *dma_find(void *periph, uint32_t dir, uint8_t priority, DMA_Stream_TypeDef *only)
+{
+	dma_t *dma;
+	int n;
+
+	if (dir == DMA_DIR_MemoryToMemory)
+	{
+		for (n = 0; n < 8; n++)
+			if ((only == NULL || only == dma2_streams[n]) &&
+				(dma = dma_take(dma2_streams[n], DMA_Channel_0, priority)) != NULL)
+				return dma;
+		return NULL;
+	}
+
+	for (n = 0; n < sizeof(dma_map) / sizeof(dma_map[0]); n++)
+		if (dma_map[n].periph == periph && dma_map[n].dir == dir &&
+			(only == NULL || only == dma_map[n].stream) &&
+			(dma = dma_take(dma_map[n].stream, dma_map[n].channel, priority)) != NULL)
+			return dma;
+	return NULL;
+}
+
+
+dma_t *dma_acquire(void *periph, uint32_t dir, uint8_t priority)
+{
+	dma_t *dma;
+
+	sys_enter_critical_section();
+	dma = dma_find(periph, dir, priority, NULL);
+	sys_leave_critical_section();
+
+	if (dma != NULL)
+		dma_init(dma);
+	return dma;
+}
+
+
+void dma_acquire_wait(dma_waiter_t *w)
+{
+	dma_waiter_t **p;
+	dma_t *dma;
+
+	sys_enter_critical_section();
+	dma = dma_find(w->periph, w->dir, w->priority, NULL);
+	if (dma == NULL)
+	{
+		// in line behind everyone of the same or higher priority
+		for (p = &dma_waiters; *p != NULL && (*p)->priority <= w->priority; p = &(*p)->next)
+		{}
+		w->next = *p;
+		*p = w;
+	}
+	sys_leave_critical_section();
+
+	if (dma == NULL)
+		return;
+	dma_init(dma);
+	if (w->acquired != NULL)
+		w->acquired(dma, w->param);
+}
+
+
+void dma_acquire_cancel(dma_waiter_t *w)
+{
+	dma_waiter_t **p;
+
+	sys_enter_critical_section();
+	for (p = &dma_waiters; *p != NULL; p = &(*p)->next)
+	{
+		if (*p == w)
+		{
+			*p = w->next;
+			break;
+		}
+	}
+	sys_leave_critical_section();
+}
+
+
+void dma_release(dma_t *dma)
+{
+	DMA_Stream_TypeDef *stream = dma->stream;
+	dma_waiter_t **p, *w = NULL;
+
+	sys_enter_critical_section();
+	if (!dma->acquired)
+	{
+		sys_leave_critical_section();
+		return;
+	}
+	dma_cancel(dma);
+	dma->acquired = false;
+
+	// hand it straight on to the first waiter that can use it
+	for (p = &dma_waiters; *p != NULL; p = &(*p)->next)
+	{
+		if ((dma = dma_find((*p)->periph, (*p)->dir, (*p)->priority, stream)) != NULL)
+		{
+			w = *p;
+			*p = w->next;
+			break;
+		}
+	}
+	sys_leave_critical_section();
+
+	if (w == NULL)
+		return;
+	dma_init(dma);
+	if (w->acquired != NULL)
+		w->acquired(dma, w->param);
+}
@@ -14,6 +14,19 @@
 
 typedef struct dma_t dma_t;
 
+/// counters kept for each stream
+typedef struct
+{
+	uint32_t transfers;		///< transfers completed (each time round for circular requests)
+	uint64_t bytes;			///< bytes they moved
+	uint32_t errors;		///< error interrupts (transfer, direct mode and fifo)
+	uint32_t failed;		///< requests ended by an error
+	uint32_t latency_last;	///< cpu cycles from dma_request to done of the last normal request (dwt counter, started in sys_init)
+	uint32_t latency_max;	///< longest of those
+	uint64_t latency_total;	///< sum of those
+	uint32_t latency_count;	///< how many there were (for the mean)
+} dma_stats_t;
+
 
 /**
  * @brief do a memcpy using the dma (ie in the background using hw)
@@ -22,21 +35,38 @@ typedef struct dma_t dma_t;
  * @param src source of memcpy
  * @param len number of bytes copied in the memcpy
  * @param complete call this when the memcpy is complete
+ * @note only one can be running at a time, dma_mem_copy (dma_hw.h) has no such limit
  */
 typedef void (*dma_memcpy_complete_event_t)(dma_t *dma, void *dst, void *src, int len);
 void dma_memcpy(dma_t *dma, void *dst, void *src, int len, dma_memcpy_complete_event_t complete);
 
 
 /**
- * @brief cancel a running/pending dma request
+ * @brief cancel the running and all the queued dma requests
+ * @note does not wait for the stream to stop, the next request started on it does
  */
 void dma_cancel(dma_t *dma);
 
 
+/**
+ * @brief get a copy of the counters for a stream
+ * @note the latency includes the time spent queued behind other requests
+ */
+void dma_get_stats(dma_t *dma, dma_stats_t *stats);
+
+
+/**
+ * @brief zero the counters for a stream
+ */
+void dma_clear_stats(dma_t *dma);
+
+
 /**
  * @brief initialise a dma channel
+ * @return false if the stream is in use from dma_acquire (the dma_t is left
+ * alone and must not be used until it has been initialised)
  */
-void dma_init(dma_t *dma);
+bool dma_init(dma_t *dma);
 
 #endif
 
@@ -18,27 +18,180 @@ typedef struct dma_request_t dma_request_t;
 
 typedef void (*dma_complete_event_t)(dma_request_t *req, void *param);
 
+/**
+ * @brief called from the tc isr of a double buffered request each time a buffer is done
+ * @param req the request
+ * @param buf the buffer just filled/emptied (the dma has moved on to the other one)
+ * @param param req->complete_param
+ * @return buffer to use in place of buf next time round (same size), NULL or buf to keep buf
+ */
+typedef void *(*dma_buffer_event_t)(dma_request_t *req, void *buf, void *param);
+
+// dma_t.isr_status bits (the stream's flags from LISR/HISR)
+#define DMA_ISR_FE (0x01)						///< fifo error
+#define DMA_ISR_DME (0x04)						///< direct mode error
+#define DMA_ISR_TE (0x08)						///< transfer error
+#define DMA_ISR_HT (0x10)						///< half transfer
+#define DMA_ISR_TC (0x20)						///< transfer complete
+#define DMA_ISR_ERRORS (DMA_ISR_FE | DMA_ISR_DME | DMA_ISR_TE)
+
 struct dma_request_t
 {
 	DMA_InitTypeDef  st_dma_init;
 	dma_complete_event_t complete;
 	void *complete_param;
 	struct dma_t *dma;
+	dma_request_t *next;						///< next in the dma queue (set by dma_request)
+	void *memory1;								///< second buffer in double buffer mode (set by dma_request_double_buffer)
+	dma_buffer_event_t buffer_complete;			///< called as each buffer is done in double buffer mode
+	dma_complete_event_t error;					///< called in place of complete if the request fails (NULL to call complete)
+	uint32_t queued;							///< cycle count when it was queued (for the latency stats)
 };
 
+/**
+ * @brief queue a request on req->dma, it is started straight away if the stream is free
+ * otherwise from the tc isr of the one before it
+ * @note a transfer error, or a fifo/direct mode error that stops the stream, fails the request,
+ * it is taken off the queue and error is called (complete if error is NULL) with the flags in
+ * dma->isr_status. The fifo/direct mode errors the stream carries on after are only counted
+ * @note requests run and complete in the order they are queued, the next one is started
+ * before complete is called for the one just done. A request queued behind a circular one
+ * waits until that is cancelled. req must not be changed until it completes or is cancelled
+ * (queueing it again while it is queued does nothing)
+ */
 void dma_request(dma_request_t *req);
 
+/**
+ * @brief queue a request in double buffer (ping pong) mode, the dma fills/empties
+ * st_dma_init.DMA_Memory0BaseAddr then memory1 then goes round again until cancelled
+ * @param req request setup like for dma_request (DMA_Mode is set to circular)
+ * @param memory1 second buffer, the same size as the first
+ * @param buffer_complete called from the tc isr with each buffer as it is done, it may
+ * hand back a new buffer to swap in while the dma is on the other one
+ * @note not for memory to memory, the hw does not support it. complete is not called.
+ * buffer_complete has until the other buffer is done to finish with buf (or swap it)
+ * or the dma will be back in it
+ */
+void dma_request_double_buffer(dma_request_t *req, void *memory1, dma_buffer_event_t buffer_complete);
+
+/**
+ * @brief remove a request from its dma queue, stopping it if it is running
+ * @note the requests queued after it are kept (the next one is started), nothing is done
+ * if req is not queued, complete is not called
+ */
+void dma_cancel_request(dma_request_t *req);
+
+/**
+ * @brief number of transfers left in a request (all of them while it is queued, 0 once done)
+ */
 int dma_remaining(dma_request_t *req);
 
 struct dma_t
 {
 	DMA_Stream_TypeDef *stream;
 	uint32_t channel;
-	struct dma_request_t *reqs;
+	struct dma_request_t *reqs;				///< queue of requests, the running one first
+	struct dma_request_t *reqs_tail;		///< last request in the queue
 	uint8_t preemption_priority;
 	uint32_t isr_status;
 	uint8_t circ;
+	bool stopping;							///< a cancel cleared EN while it was running, the next request waits for the tc isr
+	bool acquired;							///< in use by dma_acquire (streams from the pool only)
+	dma_stats_t stats;						///< see dma_get_stats
 };
 
-#endif
 
+typedef struct dma_waiter_t dma_waiter_t;
+
+typedef void (*dma_acquired_event_t)(dma_t *dma, void *param);
+
+/// waits in line for a stream (see dma_acquire_wait)
+struct dma_waiter_t
+{
+	void *periph;							///< peripheral the stream is for (see dma_acquire)
+	uint32_t dir;							///< DMA_DIR_PeripheralToMemory, DMA_DIR_MemoryToPeripheral or DMA_DIR_MemoryToMemory
+	uint8_t priority;						///< nvic preemption priority for the stream, lower goes first in line
+	dma_acquired_event_t acquired;			///< called with the stream once it is got
+	void *param;							///< passed to acquired
+	dma_waiter_t *next;
+};
+
+/**
+ * @brief get a free stream that can serve periph, instead of a dma_t fixed in hw.c
+ * @param periph peripheral the requests are for (eg SPI1, USART2, ADC1) using the f4 request
+ * mapping, any DMA2 stream for DMA_DIR_MemoryToMemory (periph is not used)
+ * @param dir DMA_DIR_PeripheralToMemory, DMA_DIR_MemoryToPeripheral or DMA_DIR_MemoryToMemory
+ * @param priority nvic preemption priority for the stream isr
+ * @note a stream set up with dma_init (the fixed ones in hw.c) is never handed out, dma->channel
+ * is set to the channel of the request mapping to be used in st_dma_init
+ * @return the stream, NULL if all the streams that can serve periph are in use
+ */
+dma_t *dma_acquire(void *periph, uint32_t dir, uint8_t priority);
+
+/**
+ * @brief like dma_acquire but if there is no stream free wait in line for one
+ * @param w waiter (must stay valid until acquired is called), acquired may be called
+ * before this returns or later from the dma_release that frees a stream
+ * @note waiters are served in priority order, then first come first served
+ */
+void dma_acquire_wait(dma_waiter_t *w);
+
+/**
+ * @brief stop waiting for a stream
+ */
+void dma_acquire_cancel(dma_waiter_t *w);
+
+/**
+ * @brief give back a stream from dma_acquire/dma_acquire_wait
+ * @note any requests still on it are cancelled, the stream goes straight to the first
+ * waiter that can use it (acquired is called from here)
+ */
+void dma_release(dma_t *dma);
+
+typedef struct dma_mem_t dma_mem_t;
+
+typedef void (*dma_mem_complete_event_t)(dma_mem_t *op, void *param);
+
+/// a memcpy or memset run by the dma2 engine, owned by the caller so any number can be in flight
+struct dma_mem_t
+{
+	dma_request_t req;
+	uint8_t *dst;
+	const uint8_t *src;						///< NULL for a memset
+	uint32_t len;
+	uint32_t done;							///< bytes moved so far
+	uint32_t piece;							///< bytes in the transfer running now
+	uint32_t fill;							///< memset value in each byte (the fixed source)
+	dma_mem_complete_event_t complete;
+	void *param;
+};
+
+/**
+ * @brief get up to two dma2 streams (with dma_acquire) for dma_mem_copy and dma_mem_set
+ * @param priority nvic preemption priority for their isr
+ * @return number of streams the engine has, with none the cpu does the work
+ */
+int dma_mem_init(uint8_t priority);
+
+/**
+ * @brief copy len bytes in the background, queued on the engine stream with the least left to do
+ * @param op the copy (must stay valid until complete is called)
+ * @param complete called from the isr when it is done (straight away if the cpu did it), if a
+ * transfer fails it is called early with op->done < op->len
+ * @note each side moves words when its address is word aligned and 16 byte (INC4) bursts when
+ * it is 16 byte aligned, the fifo packs between them. Longer copies and odd tails are split in
+ * to more than one transfer, each queued behind what else is on the stream
+ */
+void dma_mem_copy(dma_mem_t *op, void *dst, const void *src, uint32_t len, dma_mem_complete_event_t complete, void *param);
+
+/**
+ * @brief like dma_mem_copy but sets len bytes to value (the dma reads op->fill over and over)
+ */
+void dma_mem_set(dma_mem_t *op, void *dst, uint8_t value, uint32_t len, dma_mem_complete_event_t complete, void *param);
+
+/**
+ * @brief stop a copy/set, complete is not called and what it has done so far is left as is
+ */
+void dma_mem_cancel(dma_mem_t *op);
+
+#endif
@@ -19,7 +19,7 @@ static bool erase(uint32_t sector)
 	bool ret;
 	FLASH_Unlock();
 
-	switch (FLASH_EraseSector(sector << 3, VoltageRange_3))
+	switch (FLASH_EraseSector(sector << 3, NVM_VOLTAGE_RANGE))
 	{
 		case FLASH_COMPLETE:
 			ret = true;
@@ -42,6 +42,38 @@ static const uint32_t sector_size[] = {
 };
 
 
+// check a word aligned range is erased, a word at a time (a 128K sector takes
+// well under a ms to read, erasing it takes 1-2s). In ram as the async isr uses it
+ramfunc static bool blank(const void *addr, uint32_t len)
+{
+	const uint32_t *p = addr;
+
+	for (len /= sizeof(uint32_t); len; len--)
+		if (*p++ != 0xffffffff)
+			return false;
+	return true;
+}
+
+
+// async erase/write state (see nvm_erase_async and nvm_write_async), this and
+// the flash isr live in ram as the flash cannot be read while it is busy
+static struct
+{
+	uint8_t *addr;				// address passed in
+	uint8_t *dst;				// next byte to program (next sector when erasing)
+	const uint8_t *src;			// what to program it with
+	uint32_t len;				// bytes left to program
+	uint32_t step;				// bytes the running erase/program covers
+	uint32_t done;				// bytes erased or programmed so far
+	uint8_t sector;				// next sector to erase
+	uint8_t sector_end;			// one past the last sector to erase
+	bool write;					// programming rather than erasing
+	nvm_async_complete_cb complete;
+	void *param;
+	volatile bool busy;			// the flash belongs to the isr while this is set
+} nvm_async = {NULL,};
+
+
 uint32_t nvm_erase(void *addr, uint32_t len)
 {
 	int n;
@@ -59,21 +91,28 @@ uint32_t nvm_erase(void *addr, uint32_t len)
 	// could cause the unlock to fail, so lets do the lot in a critical
 	// section
 	sys_enter_critical_section();
+	if (nvm_async.busy)
+	{
+		sys_leave_critical_section();
+		return 0;
+	}
 
 	// erase any sectors within the start and end address space
 	for (n = 0; n < sizeof(sector_size) / sizeof(uint32_t); n++)
 	{
 		if (sector_addr >= addr_start && sector_addr < addr_end)
 		{
-			if (erase(n))
-			{
-			    bytes_erased += sector_size[n];
-			}
-			else
+			// already blank so save the erase, else anything validated from it has to be checked again
+			if (!blank((void *)sector_addr, sector_size[n]))
 			{
-			    // Erase failed
-			    break;
+				bootstrap_flash_changed((void *)sector_addr, sector_size[n]);
+				if (!erase(n))
+				{
+				    // Erase failed
+				    break;
+				}
 			}
+			bytes_erased += sector_size[n];
 		}
 		sector_addr += sector_size[n];
 	}
@@ -90,6 +129,27 @@ bool nvm_read(void *dst, const void *src, uint32_t len)
 	return true;
 }
 
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data)
+{
+	const uint8_t *flash = addr, *src = data;
+
+	// a word at a time while both are aligned, programming can only clear bits
+	if ((((uint32_t)flash | (uint32_t)src) & 0x03) == 0)
+	{
+		for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t))
+		{
+			if (*(const uint32_t *)src & ~*(const uint32_t *)flash)
+				return true;
+			flash += sizeof(uint32_t);
+			src += sizeof(uint32_t);
+		}
+	}
+	while (len--)
+		if (*src++ & ~*flash++)
+			return true;
+	return false;
+}
+
 
 #define FLASH_WRITE_TIMEOUT 0x2000
 static bool flash_wait(void)
@@ -107,55 +167,82 @@ static bool flash_wait(void)
 }
 
 
-static bool flash_write_word(uint16_t *dst, uint16_t *src)
+// widest program access allowed for the voltage range
+static const uint8_t program_size[] = {1, 2, 4, 8};
+
+
+// write as wide as the voltage range lets us, dropping down to fit the
+// alignment of dst and the bytes left (so an unaligned start or odd end
+// just costs a few narrow writes)
+static uint32_t program_width(const uint8_t *dst, uint32_t len)
+{
+	uint32_t n = program_size[NVM_VOLTAGE_RANGE & 0x03];
+
+	while (n > 1 && (((uint32_t)dst & (n - 1)) || len < n))
+		n >>= 1;
+	return n;
+}
+
+
+static bool flash_program(uint8_t *dst, const uint8_t *src, uint32_t n)
 {
+	uint64_t v = 0;
+	FLASH_Status status;
+
+	// the source may not be aligned
+	memcpy(&v, src, n);
+
 	// check if the bytes already match then don't change them (I think we might even get an error)
-	if (*dst == *src)
+	if (memcmp(dst, &v, n) == 0)
 		return true;
 
-	// write the word
-	switch (FLASH_ProgramHalfWord((uint32_t)dst, *src))
+	// program it with the access size that matches n
+	switch (n)
 	{
-		case FLASH_COMPLETE:
-			// job done lets verify
+		case 8:
+			status = FLASH_ProgramDoubleWord((uint32_t)dst, v);
 			break;
-		case FLASH_BUSY:
-			if (!flash_wait())
-				///@todo error
-				return false;
-			// job done lets verify
+		case 4:
+			status = FLASH_ProgramWord((uint32_t)dst, (uint32_t)v);
+			break;
+		case 2:
+			status = FLASH_ProgramHalfWord((uint32_t)dst, (uint16_t)v);
+			break;
+		default:
+			status = FLASH_ProgramByte((uint32_t)dst, (uint8_t)v);
 			break;
+	}
 
+	switch (status)
+	{
+		case FLASH_COMPLETE:
+			return true;
+		case FLASH_BUSY:
+			return flash_wait();
 		default:
 			///@todo error
 			return false;
 	}
-
-	// verify (now they should be the same)
-	if (*dst != *src)
-		///@todo verify error
-		return false;  // verification error
-
-	// success
-	return true;
 }
 
 
 bool nvm_write(void *dst, const void *src, uint32_t len)
 {
-	uint16_t *_src = (uint16_t *)src, *_dst = dst;
+	const uint8_t *_src = src;
+	uint8_t *_dst = dst;
+	uint32_t n, k = 0;
 	bool r = false;
 
-	// sanity checks
-	if ((uint32_t)_dst % 2)
-		///@todo page must be 2 byte aligned
-		return false;
+	// anything validated from flash here has to be checked again
+	bootstrap_flash_changed(dst, len);
 
 	// since we cannot read from the flash during a write/erase cycle
 	// letting interrupts run could cause a read and an error, or it 
 	// could cause the unlock to fail, so lets do the lot in a critical
 	// section
 	sys_enter_critical_section();
+	if (nvm_async.busy)
+		goto done;
 
 	// wait for the flash to be free, unlock it, and wait for it to be free again for the writing
 	if (!flash_wait())
@@ -164,25 +251,19 @@ bool nvm_write(void *dst, const void *src, uint32_t len)
 	if (!flash_wait())
 		goto done;
 
-	// write the bytes as 16bit words
-	while (len > 1)
+	// write as wide as we can
+	while (k < len)
 	{
-		// write the next word
-		if (!flash_write_word(_dst, _src))
+		n = program_width(_dst + k, len - k);
+		if (!flash_program(_dst + k, _src + k, n))
 			goto done;
-		len -= 2;
-		_dst++;
-		_src++;
+		k += n;
 	}
 
-	// if we have an odd number of bytes then do the last one
-	if (len == 1)
-	{
-		uint16_t last_word = *_src;
-		last_word |= 0xFF00; // little endian (0xFF is erased state)
-		if (!flash_write_word(_dst, &last_word))
-			goto done;
-	}
+	// verify the lot in one go now the flash is idle
+	if (memcmp(_dst, _src, len) != 0)
+		///@todo verify error
+		goto done;
 
 	// job done !
 	r = true;
@@ -191,3 +272,234 @@ done:
 	return r;
 }
 
+
+// start the next sector erase or program step of the async op. The state is
+// updated before the step is started (the isr can come in straight after) and
+// the start is the last thing, so the isr this is called from is back in ram
+// code while the flash is busy (sector_size etc can only be read before it)
+ramfunc static bool nvm_async_next(void)
+{
+	volatile uint8_t *dst;
+	uint64_t v;
+	uint32_t n, k, sector;
+
+	FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB | FLASH_CR_PSIZE);
+
+	if (!nvm_async.write)
+	{
+		// skip the sectors that are already blank (dst is the next sector)
+		while (nvm_async.sector < nvm_async.sector_end && blank(nvm_async.dst, sector_size[nvm_async.sector]))
+		{
+			nvm_async.done += sector_size[nvm_async.sector];
+			nvm_async.dst += sector_size[nvm_async.sector++];
+		}
+		if (nvm_async.sector >= nvm_async.sector_end)
+			return false;
+		sector = nvm_async.sector++;
+		nvm_async.step = sector_size[sector];
+		nvm_async.dst += nvm_async.step;
+		FLASH->CR |= ((NVM_VOLTAGE_RANGE & 0x03) << 8) | FLASH_CR_SER | (sector << 3);
+		FLASH->CR |= FLASH_CR_STRT;
+		return true;
+	}
+
+	while (nvm_async.len)
+	{
+		dst = nvm_async.dst;
+		n = program_width(nvm_async.dst, nvm_async.len);
+		for (k = 0, v = 0; k < n; k++)
+			v |= (uint64_t)nvm_async.src[k] << (k * 8);
+		nvm_async.dst += n;
+		nvm_async.src += n;
+		nvm_async.len -= n;
+
+		// already matches so skip it (this gets the blank tail of a buffer for free)
+		for (k = 0; k < n && dst[k] == (uint8_t)(v >> (k * 8)); k++)
+			;
+		if (k == n)
+		{
+			nvm_async.done += n;
+			continue;
+		}
+
+		// psize is log2 of the access size, the write starts the step
+		for (k = 0; (1u << k) < n; k++)
+			;
+		nvm_async.step = n;
+		FLASH->CR |= (k << 8) | FLASH_CR_PG;
+		switch (n)
+		{
+			case 8:
+				*(volatile uint32_t *)dst = (uint32_t)v;
+				__ISB();
+				*(volatile uint32_t *)(dst + 4) = (uint32_t)(v >> 32);
+				break;
+			case 4:
+				*(volatile uint32_t *)dst = (uint32_t)v;
+				break;
+			case 2:
+				*(volatile uint16_t *)dst = (uint16_t)v;
+				break;
+			default:
+				*dst = (uint8_t)v;
+				break;
+		}
+		return true;
+	}
+	return false;
+}
+
+
+// done (or failed), hand the flash back and tell the user
+static void nvm_async_finish(bool ok)
+{
+	nvm_async_complete_cb complete = nvm_async.complete;
+	void *param = nvm_async.param;
+	void *addr = nvm_async.addr;
+	uint32_t done = nvm_async.done;
+
+	FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB | FLASH_IT_EOP | FLASH_IT_ERR);
+	FLASH_Lock();
+
+	// verify the lot in one go now the flash is idle
+	if (ok && nvm_async.write && memcmp(addr, nvm_async.src - done, done) != 0)
+		ok = false;
+
+	nvm_async.busy = false;
+	if (complete != NULL)
+		complete(addr, ok? done: 0, param);
+}
+
+
+ramfunc void FLASH_IRQHandler(void)
+{
+	uint32_t sr = FLASH->SR;
+	bool ok = !(sr & (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR));
+
+	FLASH->SR = sr & (FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+		FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+	if (!nvm_async.busy)
+		return;
+
+	// kick off the next step straight away, the flash is idle until we do
+	if (ok)
+	{
+		nvm_async.done += nvm_async.step;
+		nvm_async.step = 0;
+		if (nvm_async_next())
+			return;
+	}
+	nvm_async_finish(ok);
+}
+
+
+// claim the flash for an async erase/write
+static bool nvm_async_claim(void)
+{
+	bool r = false;
+
+	sys_enter_critical_section();
+	if (!nvm_async.busy && FLASH_GetFlagStatus(FLASH_FLAG_BSY) != SET)
+	{
+		nvm_async.busy = true;
+		r = true;
+	}
+	sys_leave_critical_section();
+	return r;
+}
+
+
+// common start of nvm_erase_async/nvm_write_async once the flash is claimed
+static void nvm_async_start(void *addr, bool write, nvm_async_complete_cb complete, void *param)
+{
+	NVIC_InitTypeDef nvic_init;
+
+	nvm_async.addr = addr;
+	nvm_async.write = write;
+	nvm_async.step = 0;
+	nvm_async.done = 0;
+	nvm_async.complete = complete;
+	nvm_async.param = param;
+
+	nvic_init.NVIC_IRQChannel = FLASH_IRQn;
+	nvic_init.NVIC_IRQChannelPreemptionPriority = NVM_ASYNC_PREEMPTION_PRIORITY;
+	nvic_init.NVIC_IRQChannelSubPriority = 0;
+	nvic_init.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&nvic_init);
+
+	FLASH_Unlock();
+	FLASH->SR = FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+		FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR;
+	FLASH->CR |= FLASH_IT_EOP | FLASH_IT_ERR;
+
+	// first step, the isr does the rest (nothing to do is done straight away)
+	if (!nvm_async_next())
+		nvm_async_finish(true);
+}
+
+
+bool nvm_erase_async(void *addr, uint32_t len, nvm_async_complete_cb complete, void *param)
+{
+	uint32_t addr_start = (uint32_t)addr;
+	uint32_t addr_end = (uint32_t)addr + len;
+	uint32_t sector_addr = NVM_START_ADDRESS, first_addr = 0, end_addr = 0;
+	uint8_t n, first = 0xff, end = 0;
+
+	// sanity check address range
+	if (addr_start < NVM_START_ADDRESS || addr_end > NVM_END_ADDRESS)
+		return false;
+
+	// same sectors nvm_erase would do
+	for (n = 0; n < sizeof(sector_size) / sizeof(uint32_t); n++)
+	{
+		if (sector_addr >= addr_start && sector_addr < addr_end)
+		{
+			if (first == 0xff)
+			{
+				first = n;
+				first_addr = sector_addr;
+			}
+			end = n + 1;
+			end_addr = sector_addr + sector_size[n];
+		}
+		sector_addr += sector_size[n];
+	}
+	if (first == 0xff)
+		first = end;
+
+	if (!nvm_async_claim())
+		return false;
+
+	// anything validated from the sectors has to be checked again
+	bootstrap_flash_changed((void *)first_addr, end_addr - first_addr);
+	nvm_async.sector = first;
+	nvm_async.sector_end = end;
+	nvm_async.dst = (uint8_t *)first_addr;
+	nvm_async_start(addr, false, complete, param);
+	return true;
+}
+
+
+bool nvm_write_async(void *dst, const void *src, uint32_t len, nvm_async_complete_cb complete, void *param)
+{
+	// sanity check address range
+	if ((uint32_t)dst < NVM_START_ADDRESS || (uint32_t)dst + len > NVM_END_ADDRESS)
+		return false;
+
+	if (!nvm_async_claim())
+		return false;
+
+	// anything validated from flash here has to be checked again
+	bootstrap_flash_changed(dst, len);
+	nvm_async.dst = dst;
+	nvm_async.src = src;
+	nvm_async.len = len;
+	nvm_async_start(dst, true, complete, param);
+	return true;
+}
+
+
+bool nvm_async_busy(void)
+{
+	return nvm_async.busy;
+}
@@ -17,6 +17,17 @@
 #define NVM_START_ADDRESS (0x08000000)
 #define NVM_END_ADDRESS   (0x08100000)
 
+// supply voltage range of the board, this sets how wide nvm_write can program
+// (VoltageRange_1 bytes, _2 halfwords, _3 words, _4 double words with vpp)
+#ifndef NVM_VOLTAGE_RANGE
+#define NVM_VOLTAGE_RANGE VoltageRange_3
+#endif
+
+// nvic preemption priority of the flash isr that drives nvm_erase_async/nvm_write_async
+#ifndef NVM_ASYNC_PREEMPTION_PRIORITY
+#define NVM_ASYNC_PREEMPTION_PRIORITY 1
+#endif
+
 
 /**
  * @brief erase pages from addr to len
@@ -41,9 +52,74 @@ bool nvm_read(void *dst, const void *src, uint32_t len);
  * @param dst destination address
  * @param src source address
  * @param len number of bytes to write
+ * @note each step programs as wide as dst alignment, len and NVM_VOLTAGE_RANGE
+ * allow, then the lot is verified at the end
  */
 bool nvm_write(void *dst, const void *src, uint32_t len);
 
+/**
+ * @brief check if data can be written over what is in the flash without an erase
+ * @param addr flash address that would be written
+ * @param len number of bytes
+ * @param data what would be written
+ * @note programming can only clear bits (1 to 0), so this is true if data has a
+ * 1 anywhere the flash has a 0
+ * @return true if the range has to be erased before data can be written
+ */
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data);
+
+
+/**
+ * @brief called from the flash isr when nvm_erase_async or nvm_write_async is done
+ * @param addr address passed to nvm_erase_async/nvm_write_async
+ * @param len number of bytes erased (may be more than asked for) or written, 0 on error
+ * @param param user parameter passed to nvm_erase_async/nvm_write_async
+ */
+typedef void (*nvm_async_complete_cb)(void *addr, uint32_t len, void *param);
+
+
+/**
+ * @brief erase like nvm_erase but in the background, one sector per flash isr
+ * @param addr points to anywhere in the first page to erase
+ * @param len number of bytes to erase, if we cross into a new page erase that also
+ * @param complete called from the flash isr when done (may be NULL)
+ * @param param passed to complete
+ * @note interrupts stay on while the flash is busy, but reading the flash (code,
+ * const data or an isr vector table in flash) stalls the cpu until the current
+ * sector is done (1-2s for a 128K sector). So only code that runs wholly from ram
+ * keeps going, that is FLASH_IRQHandler and ramfunc code that only calls other
+ * ramfunc code (the isr vector must be the ram copy boot sets up). The dma, uart
+ * and spi irq handlers only use the registers, but the completion callbacks they
+ * call are in flash and stall at that point like everything else. The caller
+ * is back in flash code so it stalls until the first sector is done. Nothing may
+ * touch the sectors being erased until complete is called (it is called once the
+ * flash is idle so it can be in flash)
+ * @return false if the range is bad or another erase/write is running
+ */
+bool nvm_erase_async(void *addr, uint32_t len, nvm_async_complete_cb complete, void *param);
+
+
+/**
+ * @brief write like nvm_write but in the background, one program step per flash isr
+ * @param dst destination address
+ * @param src source address (must stay valid until complete is called)
+ * @param len number of bytes to write
+ * @param complete called from the flash isr when done, after the lot is verified (may be NULL)
+ * @param param passed to complete
+ * @note see nvm_erase_async for what keeps running, each program step only stalls
+ * flash reads for a few tens of us so flash code gets to run in between steps
+ * @return false if the range is bad or another erase/write is running
+ */
+bool nvm_write_async(void *dst, const void *src, uint32_t len, nvm_async_complete_cb complete, void *param);
+
+
+/**
+ * @brief check if an async erase/write is running
+ * @note nvm_erase and nvm_write fail while this is true
+ * @return true until the complete callback of the running async erase/write is called
+ */
+bool nvm_async_busy(void);
+
 
 #endif
 
@@ -139,7 +139,7 @@ weak void spim_irq_handler(int n)
 
 
 // handle the spi1 isr
-void SPI1_IRQHandler(void)
+ramfunc void SPI1_IRQHandler(void)
 {
 	spis_irq_handler(0);
 	spim_irq_handler(0);
@@ -147,7 +147,7 @@ void SPI1_IRQHandler(void)
 
 
 // handle the spi1 isr
-void SPI2_IRQHandler(void)
+ramfunc void SPI2_IRQHandler(void)
 {
 	spis_irq_handler(1);
 	spim_irq_handler(1);
@@ -155,7 +155,7 @@ void SPI2_IRQHandler(void)
 
 
 // handle the spi1 isr
-void SPI3_IRQHandler(void)
+ramfunc void SPI3_IRQHandler(void)
 {
 	spis_irq_handler(2);
 	spim_irq_handler(2);
@@ -61,9 +61,9 @@ static uint8_t spim_irq(spim_t *spim)
 }
 
 
-void spim_read_phase(spim_t *spim)
+ramfunc void spim_read_phase(spim_t *spim)
 {
-	uint8_t b = SPI_ReceiveData(spim->channel);
+	uint8_t b = spim->channel->DR;
 
 	// put the new byte into the read buffer
 	if (spim->read_count < spim->len)
@@ -75,7 +75,7 @@ void spim_read_phase(spim_t *spim)
 }
 
 
-bool spim_write_phase(spim_t *spim)
+ramfunc bool spim_write_phase(spim_t *spim)
 {
 	uint8_t b;
 
@@ -85,7 +85,7 @@ bool spim_write_phase(spim_t *spim)
 			b = 0x00;	// if null buffer transmit a dummy byte so the reads still occur
 		else
 			b = spim->write_buf[spim->write_count];
-		SPI_SendData(spim->channel, b);
+		spim->channel->DR = b;
 		spim->write_count++;
 		return true;
 	}
@@ -93,6 +93,20 @@ bool spim_write_phase(spim_t *spim)
 }
 
 
+// give back the streams spim_xfer acquired for the transfer
+static void spim_dma_release(spim_t *spim)
+{
+	if (!spim->acquire_dma || spim->rx_dma == NULL)
+		return;
+
+	SPI_I2S_DMACmd(spim->channel, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE);
+	dma_release(spim->rx_dma);
+	dma_release(spim->tx_dma);
+	spim->rx_dma = NULL;
+	spim->tx_dma = NULL;
+}
+
+
 void spim_clear_io(spim_t *spim)
 {
 	spim->xfer_complete = NULL;
@@ -104,27 +118,34 @@ void spim_clear_io(spim_t *spim)
 	spim->len = 0;
 }
 
-void spim_irq_handler(int n)
+ramfunc void spim_irq_handler(int n)
 {
 	spim_t *spim = spim_irq_list[n];
+	SPI_TypeDef *channel;
+	uint16_t sr, cr2;
 
 	// sanity check that spim should run
 	if (spim == NULL)
 		return;
 
+	// the registers are used directly in here as the std periph lib is in flash
+	channel = spim->channel;
+	sr = channel->SR;
+	cr2 = channel->CR2;
+
 	//@todo check for errors (what errors can the master have really ?)
 	
 	// read phase (read the Rx register)
-	if (SPI_I2S_GetITStatus(spim->channel, SPI_I2S_IT_RXNE) == SET)
+	if ((sr & SPI_SR_RXNE) && (cr2 & SPI_CR2_RXNEIE))
 		spim_read_phase(spim);
 	
 	// write phase (reload the Tx register if it is empty and the isr is enabled)
-	if (SPI_I2S_GetITStatus(spim->channel, SPI_I2S_IT_TXE) == SET)
+	if ((sr & SPI_SR_TXE) && (cr2 & SPI_CR2_TXEIE))
 	{
 		if (!spim_write_phase(spim))
 		{
 			// All data sent, disable the TXE interrupt
-			SPI_I2S_ITConfig(spim->channel, SPI_I2S_IT_TXE, DISABLE);
+			channel->CR2 &= ~SPI_CR2_TXEIE;
 		}
 	}
 
@@ -136,10 +157,9 @@ void spim_irq_handler(int n)
 		void *read_buf = spim->read_buf;
 		void *write_buf = spim->write_buf;
 		int16_t len = spim->len;
-		SPI_Cmd(spim->channel, DISABLE);
+		channel->CR1 &= ~SPI_CR1_SPE;
 		set_addr(spim, spim->idle_address); // go to idle bus state
-		SPI_I2S_ITConfig(spim->channel, SPI_I2S_IT_RXNE, DISABLE);
-		SPI_I2S_ITConfig(spim->channel, SPI_I2S_IT_TXE, DISABLE);
+		channel->CR2 &= ~(SPI_CR2_RXNEIE | SPI_CR2_TXEIE);
 		spim_clear_io(spim);
 		if (complete != NULL)
 			complete(spim, spim->addr, read_buf, write_buf, len, param);
@@ -157,6 +177,7 @@ void spim_dma_complete(spim_t *spim)
 	set_addr(spim, spim->idle_address); // go to idle bus state
 	SPI_I2S_ITConfig(spim->channel, SPI_I2S_IT_RXNE, DISABLE);
 	SPI_I2S_ITConfig(spim->channel, SPI_I2S_IT_TXE, DISABLE);
+	spim_dma_release(spim);
 	spim_clear_io(spim);
 	if (complete != NULL)
 		complete(spim, spim->addr, read_buf, write_buf, len, spim_xfer_param);
@@ -197,6 +218,7 @@ static const struct prescalers_t {
 int spim_xfer(spim_t *spim, spim_xfer_opts *opts, uint16_t addr, void *read_buf, void *write_buf, int len, spim_xfer_complete complete, void *param)
 {
 	float fclk = spi_get_clk_speed(spim->channel);
+	dma_t *rx_dma = NULL, *tx_dma = NULL;
 	int k;
 	int result = len;
 
@@ -214,6 +236,22 @@ success:
 		opts->speed = 0; // done, we don't need to wast time calculating this again
 	}
 
+	// get a pair of streams for just this transfer (before the lock as it sets
+	// them up), the isr does it if there is not a pair free
+	if (spim->acquire_dma && len > 1)
+	{
+		rx_dma = dma_acquire(spim->channel, DMA_DIR_PeripheralToMemory, spim->preemption_priority);
+		tx_dma = dma_acquire(spim->channel, DMA_DIR_MemoryToPeripheral, spim->preemption_priority);
+		if (rx_dma == NULL || tx_dma == NULL)
+		{
+			if (rx_dma != NULL)
+				dma_release(rx_dma);
+			if (tx_dma != NULL)
+				dma_release(tx_dma);
+			rx_dma = tx_dma = NULL;
+		}
+	}
+
 	sys_enter_critical_section();
 
 	if (spim_busy(spim))
@@ -222,6 +260,12 @@ success:
 		result = SPIM_ERROR_BUSY;
 		goto done;
 	}
+	if (rx_dma != NULL)
+	{
+		spim->rx_dma = rx_dma;
+		spim->tx_dma = tx_dma;
+		rx_dma = tx_dma = NULL;	// the transfer has them now
+	}
 
 	// load xfer details
 	spim->addr = addr;
@@ -275,6 +319,13 @@ success:
 
 done:
 	sys_leave_critical_section();
+
+	// the transfer was refused so give its streams back
+	if (rx_dma != NULL)
+	{
+		dma_release(rx_dma);
+		dma_release(tx_dma);
+	}
 	return result;
 }
 
@@ -306,11 +357,11 @@ void spim_init(spim_t *spim)
 	nvic_init.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&nvic_init);
 	
-	// init dma if present
-	if (spim->rx_dma)
-		dma_init(spim->rx_dma);
-	if (spim->tx_dma)
-		dma_init(spim->tx_dma);
+	// init dma if present (do without a stream that dma_acquire has handed out)
+	if (spim->rx_dma && !dma_init(spim->rx_dma))
+		spim->rx_dma = NULL;
+	if (spim->tx_dma && !dma_init(spim->tx_dma))
+		spim->tx_dma = NULL;
 }
 
 
@@ -48,6 +48,7 @@ struct spim_t
 	dma_t *tx_dma;									///< optional dma used for tx (ie dont use isr, do it in hw)
 	dma_request_t tx_dma_req;						///< used by tx_dma
 	bool tx_completed;								///< true if the tx dma complete interrupt has been called
+	bool acquire_dma;								///< leave rx_dma/tx_dma NULL and set this to dma_acquire a pair of streams for each transfer (uses the isr if both are not free)
 };
 
 
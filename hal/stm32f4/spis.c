@@ -21,7 +21,7 @@
 static void spis_clear_read(spis_t *spis)
 {
 	// reset read buffers, next time the isr runs it will have no where to read from and give up
-	SPI_I2S_ITConfig(spis->channel, SPI_I2S_IT_RXNE, DISABLE);
+	spis->channel->CR2 &= ~SPI_CR2_RXNEIE;
 	spis->read_buf = NULL;
 	spis->read_buf_len = 0;
 	spis->read_count = 0;
@@ -29,7 +29,7 @@ static void spis_clear_read(spis_t *spis)
 	spis->read_complete_param = NULL;
 	spi_flush_rx_fifo(spis->channel);
 	if (spis->rx_dma)
-		dma_cancel(spis->rx_dma);
+		dma_cancel_request(&spis->rx_dma_req);
 }
 
 
@@ -43,14 +43,14 @@ void spis_flush_read(spis_t *spis)
 static void spis_clear_write(spis_t *spis, bool flush)
 {
 	// disable the Tx isr, and clear the buffers and fifos
-	SPI_I2S_ITConfig(spis->channel, SPI_I2S_IT_TXE, DISABLE);
+	spis->channel->CR2 &= ~SPI_CR2_TXEIE;
 	spis->write_buf = NULL;
 	spis->write_buf_len = 0;
 	spis->write_count = 0;
 	spis->write_complete_cb = NULL;
 	spis->write_complete_param = NULL;
 	if (spis->tx_dma)
-		dma_cancel(spis->tx_dma);
+		dma_cancel_request(&spis->tx_dma_req);
 	if (flush)
 	{
 		spi_flush_tx_fifo(spis->channel, &spis->st_spi_init);
@@ -154,11 +154,11 @@ void spis_init(spis_t *spis)
 	nvic_init.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&nvic_init);
 
-	// init dma if present
-	if (spis->rx_dma)
-		dma_init(spis->rx_dma);
-	if (spis->tx_dma)
-		dma_init(spis->tx_dma);
+	// init dma if present (do without a stream that dma_acquire has handed out)
+	if (spis->rx_dma && !dma_init(spis->rx_dma))
+		spis->rx_dma = NULL;
+	if (spis->tx_dma && !dma_init(spis->tx_dma))
+		spis->tx_dma = NULL;
 
 	// set up all the spi settings, isr's, etc and start the spi
 	spi_init_regs(spis->channel, &spis->st_spi_init);
@@ -167,10 +167,10 @@ void spis_init(spis_t *spis)
 
 
 // read the bytes from the rx buf move the buffers on and possibly call the completion event
-static spis_read_complete spis_read_phase(spis_t *spis, void **buf, uint16_t *len, void **param)
+ramfunc static spis_read_complete spis_read_phase(spis_t *spis, void **buf, uint16_t *len, void **param)
 {
 	// pull the next byte out of the fifo
-	uint8_t b = SPI_ReceiveData(spis->channel);
+	uint8_t b = spis->channel->DR;
 
 	// put the new byte into the read buffer (always inc read_count incase we are doing a 
 	// dummy read, ie read_buf == NULL but we want the cb to run)
@@ -194,7 +194,7 @@ static spis_read_complete spis_read_phase(spis_t *spis, void **buf, uint16_t *le
 }
 
 // write the bytes to the tx buf move the buffers on and possibly call the completion event
-static spis_write_complete spis_write_phase(spis_t *spis, void **buf, uint16_t *len, void **param)
+ramfunc static spis_write_complete spis_write_phase(spis_t *spis, void **buf, uint16_t *len, void **param)
 {
 	uint8_t b = 0xaa; // send this dummy byte if we have nothing else available
 
@@ -204,7 +204,7 @@ static spis_write_complete spis_write_phase(spis_t *spis, void **buf, uint16_t *
 		b = spis->write_buf[spis->write_count];
 	spis->write_count++;
 
-	SPI_SendData(spis->channel, b);
+	spis->channel->DR = b;
 
 	if (spis->write_count == spis->write_buf_len && spis->write_buf_len > 0)
 	{
@@ -220,7 +220,7 @@ static spis_write_complete spis_write_phase(spis_t *spis, void **buf, uint16_t *
 }
 
 
-void spis_irq_handler(int n)
+ramfunc void spis_irq_handler(int n)
 {
 	spis_read_complete read_cb = NULL;
 	spis_write_complete write_cb = NULL;
@@ -228,19 +228,26 @@ void spis_irq_handler(int n)
 	uint16_t read_cb_len, write_cb_len;
 	void *read_cb_param, *write_cb_param;
 	spis_t *spis = spis_irq_list[n];
+	SPI_TypeDef *channel;
+	uint16_t sr, cr2;
 
 	// sanity check that spis should run
 	if (spis == NULL)
 		return;
 
-	// check for errors and report them (UDR error must come first as SPI_I2S_GetITStatus
-	// will read the SR reg and clear the UDR run error on the first check)
-	if (SPI_I2S_GetITStatus(spis->channel, I2S_IT_UDR) == SET)
+	// the registers are used directly in here as the std periph lib is in flash
+	channel = spis->channel;
+	cr2 = channel->CR2;
+
+	// check for errors and report them (UDR error must come first as reading
+	// the SR reg clears the UDR run error)
+	sr = channel->SR;
+	if ((sr & SPI_SR_UDR) && (cr2 & SPI_CR2_ERRIE))
 	{
 		if (spis->error_cb != NULL)
 			spis->error_cb(spis, SPIS_ERR_UNDRUN, spis->error_cb_param);
 	}
-	if (SPI_I2S_GetITStatus(spis->channel, SPI_I2S_IT_OVR) == SET)
+	if ((sr & SPI_SR_OVR) && (cr2 & SPI_CR2_ERRIE))
 	{
 		if (spis->error_cb != NULL)
 			spis->error_cb(spis, SPIS_ERR_OVRRUN, spis->error_cb_param);
@@ -250,19 +257,20 @@ void spis_irq_handler(int n)
 		// just do a read to clear the error, followed by a read on the SR reg 
 		// (the data stream is already poked, there is no point trying to get the last
 		// valid byte out really)
-		while (SPI_I2S_GetITStatus(spis->channel, SPI_I2S_IT_OVR) == SET)
+		while (channel->SR & SPI_SR_OVR)
 		{
-			SPI_ReceiveData(spis->channel);
-			SPI_I2S_GetFlagStatus(spis->channel, SPI_I2S_FLAG_OVR);
+			(void)channel->DR;
+			(void)channel->SR;
 		}
+		sr = channel->SR;
 	}
 
 	// read phase (read the Rx register)
-	if (SPI_I2S_GetITStatus(spis->channel, SPI_I2S_IT_RXNE) == SET)
+	if ((sr & SPI_SR_RXNE) && (cr2 & SPI_CR2_RXNEIE))
 		read_cb = spis_read_phase(spis, &read_cb_buf, &read_cb_len, &read_cb_param);
 
 	// write phase (reload the Tx register if it is empty and the isr is enabled)
-	if (SPI_I2S_GetITStatus(spis->channel, SPI_I2S_IT_TXE) == SET)
+	if ((sr & SPI_SR_TXE) && (channel->CR2 & SPI_CR2_TXEIE))
 		write_cb = spis_write_phase(spis, &write_cb_buf, &write_cb_len, &write_cb_param);
 
 	// run deferred completion events, defer these so that we read new data out
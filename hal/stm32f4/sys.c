@@ -34,10 +34,12 @@ static void sys_clk_init(void)
 
 	// set clocks registers back to defaults (for debugging, st_demo)
 	RCC_DeInit();
+	bootstrap_prof_mark("rcc_deinit");
 
 	// enable the high speed external osc (HSE) and spin for it to stabilise
 	RCC_HSEConfig(RCC_HSE_ON);
 	HSEStartUpStatus = RCC_WaitForHSEStartUp();
+	bootstrap_prof_mark("hse");
 	if (HSEStartUpStatus != SUCCESS)
 	{
 		///@todo handle error better
@@ -70,6 +72,7 @@ static void sys_clk_init(void)
 	RCC_PLLCmd(ENABLE);
 	while(RCC_GetFlagStatus(RCC_FLAG_PLLRDY) == RESET)
 	{}
+	bootstrap_prof_mark("pll");
 
 	// Switch the system clock over to the PLL output and spin until it is ready
 	RCC_SYSCLKConfig(RCC_SYSCLKSource_PLLCLK);
@@ -132,6 +135,15 @@ float sys_get_temperature(void)
 
 
 // init a log via uart or trace
+// start the dwt cycle counter once here for everything that times with it (dma
+// stats etc), it is left running if the bootstrap profile already started it
+static void sys_cycle_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
 static void sys_log_init(void)
 {
 	///@todo uart log
@@ -334,10 +346,13 @@ void sys_spin(uint32_t time)
 void sys_init(void)
 {
 	sys_clk_init();
+	bootstrap_prof_mark("sys_clk");
 	sys_interrupt_init();
+	sys_cycle_init();
 	sys_tick_init();
 	sys_temp_init();
 	sys_log_init();
+	bootstrap_prof_mark("sys_init");
 }
 
 
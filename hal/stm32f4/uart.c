@@ -51,10 +51,10 @@ static void uart_clear_read(uart_t *uart)
 	// disable the read isr's
 	if (uart->rx_dma)
 	{
-		dma_cancel(uart->rx_dma);
+		dma_cancel_request(&uart->rx_dma_req);
 		USART_DMACmd(uart->channel, USART_DMAReq_Rx, DISABLE);
 	}
-	USART_ITConfig(uart->channel, USART_IT_RXNE, DISABLE);
+	uart->channel->CR1 &= ~USART_CR1_RXNEIE;
 
 	// clear the buffers for next read
 	uart->read_buf = NULL;
@@ -70,10 +70,17 @@ static void uart_clear_write(uart_t *uart)
 	// disable the write isr
 	if (uart->tx_dma)
 	{
-		dma_cancel(uart->tx_dma);
+		dma_cancel_request(&uart->tx_dma_req);
 		USART_DMACmd(uart->channel, USART_DMAReq_Tx, DISABLE);
 	}
-	USART_ITConfig(uart->channel, USART_IT_TXE, DISABLE);
+	uart->channel->CR1 &= ~USART_CR1_TXEIE;
+
+	// give back the stream the write acquired
+	if (uart->acquire_tx_dma && uart->tx_dma != NULL)
+	{
+		dma_release(uart->tx_dma);
+		uart->tx_dma = NULL;
+	}
 
 	// clear the buffers for next read
 	uart->write_buf = NULL;
@@ -112,7 +119,7 @@ static void uart_tx_dma_complete(dma_request_t *req, void *param)
 }
 
 
-static void uart_irq_handler(uart_t *uart)
+ramfunc static void uart_irq_handler(uart_t *uart)
 {
 	// buffer the current transaction so we can clear the uart ready for a new
 	// read/write before calling the completion routines (that was a complete
@@ -126,16 +133,22 @@ static void uart_irq_handler(uart_t *uart)
 	int16_t write_count;
 	uart_write_complete_cb write_complete_cb = NULL;
 	void *write_complete_param = uart->write_complete_param;
+	USART_TypeDef *channel;
+	uint16_t sr;
 
 	// sanity check that we setup this interrupt
 	if (uart == NULL)
 		return;
 
+	// the registers are used directly in here as the std periph lib is in flash
+	channel = uart->channel;
+	sr = channel->SR;
+
 	// if the receive buffer is full copy it to read_buf
-	if (USART_GetITStatus(uart->channel, USART_IT_RXNE) &&
+	if ((sr & USART_SR_RXNE) && (channel->CR1 & USART_CR1_RXNEIE) &&
 		uart->read_buf != NULL && uart->read_count < uart->read_buf_len)
 	{
-		uint16_t rx = USART_ReceiveData(uart->channel);
+		uint16_t rx = channel->DR & 0x1ff;
 		uint32_t word_len = uart->cfg.USART_WordLength;
 
 		// copy received word into read_buf (if were using 8bits
@@ -156,7 +169,7 @@ static void uart_irq_handler(uart_t *uart)
 
 	// if the transmit buffer empty & do we have
 	// more to send then populate it
-	if (USART_GetITStatus(uart->channel, USART_IT_TXE) &&
+	if ((sr & USART_SR_TXE) && (channel->CR1 & USART_CR1_TXEIE) &&
 		uart->write_buf != NULL && uart->write_count < uart->write_buf_len)
 	{
 		uint16_t tx;
@@ -170,15 +183,15 @@ static void uart_irq_handler(uart_t *uart)
 		else
 			tx = ((uint8_t *)uart->write_buf)[uart->write_count++];
 		if (uart->write_count == uart->write_buf_len)
-			USART_ITConfig(uart->channel, USART_IT_TC, ENABLE);
-		USART_SendData(uart->channel, tx);
+			channel->CR1 |= USART_CR1_TCIE;
+		channel->DR = tx & 0x1ff;
 	}
 
 	// if the transmitter completed the last byte then the write is done
-	if (USART_GetITStatus(uart->channel, USART_IT_TC) &&
+	if ((channel->SR & USART_SR_TC) && (channel->CR1 & USART_CR1_TCIE) &&
 		uart->write_buf != NULL && uart->write_count == uart->write_buf_len)
 	{
-		USART_ITConfig(uart->channel, USART_IT_TC, DISABLE);
+		channel->CR1 &= ~USART_CR1_TCIE;
 		write_count = uart->write_count;
 		write_complete_cb = uart->write_complete_cb;
 		uart_clear_write(uart);
@@ -192,28 +205,28 @@ static void uart_irq_handler(uart_t *uart)
 }
 
 
-void USART1_IRQHandler(void)
+ramfunc void USART1_IRQHandler(void)
 {
 	uart_irq_handler(uart_irq_list[0]);
 }
 
 
-void USART2_IRQHandler(void)
+ramfunc void USART2_IRQHandler(void)
 {
 	uart_irq_handler(uart_irq_list[1]);
 }
 
 
-void USART3_IRQHandler(void)
+ramfunc void USART3_IRQHandler(void)
 {
 	uart_irq_handler(uart_irq_list[2]);
 }
 
-void UART4_IRQHandler(void)
+ramfunc void UART4_IRQHandler(void)
 {
 	uart_irq_handler(uart_irq_list[3]);
 }
-void UART5_IRQHandler(void)
+ramfunc void UART5_IRQHandler(void)
 {
 	uart_irq_handler(uart_irq_list[4]);
 }
@@ -315,16 +328,27 @@ void uart_cancel_read(uart_t *uart)
 
 void uart_write(uart_t *uart, void *buf, uint16_t len, uart_write_complete_cb cb, void *param)
 {
+	dma_t *tx_dma = NULL;
+
 	// sanity checks
 	if (len < 1)
 		///@todo invalid input parameters
 		return;
 
+	// get a stream for just this write (before the lock as it sets the stream up)
+	if (uart->acquire_tx_dma)
+		tx_dma = dma_acquire(uart->channel, DMA_DIR_MemoryToPeripheral, uart->preemption_priority);
+
 	sys_enter_critical_section();   // lock while changing things so an isr does not find a half setup write
 
 	if (uart->write_buf != NULL || uart->write_count != 0)
 		///@todo write in progress already
 		goto done;
+	if (uart->acquire_tx_dma)
+	{
+		uart->tx_dma = tx_dma;
+		tx_dma = NULL;	// the write has it now
+	}
 
 	// load the write info
 	uart->write_buf = buf;
@@ -348,7 +372,10 @@ void uart_write(uart_t *uart, void *buf, uint16_t len, uart_write_complete_cb cb
 
 done:
 	sys_leave_critical_section();
-	return;
+
+	// the write was refused so give its stream back
+	if (tx_dma != NULL)
+		dma_release(tx_dma);
 }
 
 
@@ -445,11 +472,11 @@ void uart_init(uart_t *uart)
 	nvic_init.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&nvic_init);
 
-	// init dma
-	if (uart->rx_dma)
-		dma_init(uart->rx_dma);
-	if (uart->tx_dma)
-		dma_init(uart->tx_dma);
+	// init dma (do without a stream that dma_acquire has handed out)
+	if (uart->rx_dma && !dma_init(uart->rx_dma))
+		uart->rx_dma = NULL;
+	if (uart->tx_dma && !dma_init(uart->tx_dma))
+		uart->tx_dma = NULL;
 
 	// set uart and enable
 	USART_Init(uart->channel, &uart->cfg);
@@ -42,6 +42,7 @@ struct uart_t
 	void *write_complete_param;					///< user callback param passed to write_complete_cb
 	dma_t *tx_dma;								///< optional dma used for tx (ie dont use isr, do it in hw)
 	dma_request_t tx_dma_req;					///< used by tx_dma
+	bool acquire_tx_dma;						///< leave tx_dma NULL and set this to dma_acquire a stream for each write (uses the isr if none is free)
 };
 
 #endif
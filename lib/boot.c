@@ -0,0 +1,358 @@
+/**
+ * @file boot.c
+ *
+ * @brief program validation, unpacking and the boot profile for the bootstrap (see boot.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Program headers hold the addresses the programs see (dst, src, cache
+ * entries), these are only turned into pointers here so a host test can map
+ * the flash anywhere.
+ */
+
+
+#include <stddef.h>
+#include "boot.h"
+#include "lz4.h"
+#include "delta.h"
+
+
+// backup words of cache entry k
+#define BKP_CACHE_ADDR(k)	(3*(k))			// header address (0 for an empty entry)
+#define BKP_CACHE_CRC(k)	(1 + 3*(k))		// header crc when it was checked
+#define BKP_CACHE_BOOTS(k)	(2 + 3*(k))		// boots since the last full check
+
+#define BOOT_PROF_MAGIC 0x50524F46 // "PROF"
+
+
+static bool boot_in_flash(struct boot_h *h, const void *p)
+{
+	return (const uint8_t *)p >= h->flash && (const uint8_t *)p < h->flash + h->flash_size;
+}
+
+
+// pointer to a program address
+static uint8_t *boot_ptr(struct boot_h *h, uint32_t addr)
+{
+	if (addr - h->flash_addr < h->flash_size)
+		return h->flash + (addr - h->flash_addr);
+	return (uint8_t *)(uintptr_t)addr;
+}
+
+
+// program address of a pointer
+static uint32_t boot_addr(struct boot_h *h, const void *p)
+{
+	if (boot_in_flash(h, p))
+		return h->flash_addr + ((const uint8_t *)p - h->flash);
+	return (uint32_t)(uintptr_t)p;
+}
+
+
+// find the cache entry for the program at addr (-1 if not there)
+static int validate_cache_find(struct boot_h *h, uint32_t addr)
+{
+	int k;
+
+	for (k = 0; k < h->cache; k++)
+		if (h->bkp_read(BKP_CACHE_ADDR(k)) == addr)
+			return k;
+	return -1;
+}
+
+
+// true if this program passed on an earlier boot and has not been written over since
+static bool validate_cache_hit(struct boot_h *h, const struct boot_header *header)
+{
+	int k = validate_cache_find(h, boot_addr(h, header));
+	uint32_t boots;
+
+	if (k < 0 || h->bkp_read(BKP_CACHE_CRC(k)) != header->crc)
+		return false;
+
+	// do a full check every so often anyway
+	boots = h->bkp_read(BKP_CACHE_BOOTS(k));
+	if (boots >= h->reverify)
+		return false;
+	h->bkp_write(BKP_CACHE_BOOTS(k), boots + 1);
+
+	return true;
+}
+
+
+// remember this program passed a full check
+static void validate_cache_add(struct boot_h *h, const struct boot_header *header)
+{
+	int k;
+
+	if (h->cache == 0)
+		return;
+
+	// use this programs old entry, else an empty one, else just take the first
+	k = validate_cache_find(h, boot_addr(h, header));
+	if (k < 0)
+		k = validate_cache_find(h, 0);
+	if (k < 0)
+		k = 0;
+
+	h->bkp_write(BKP_CACHE_ADDR(k), boot_addr(h, header));
+	h->bkp_write(BKP_CACHE_CRC(k), header->crc);
+	h->bkp_write(BKP_CACHE_BOOTS(k), 0);
+}
+
+
+bool boot_validate(struct boot_h *h, const void *prog)
+{
+	const struct boot_header *header = prog;
+
+	// null header is invalid
+	if (header == NULL || header == (void *)0xffffffff)
+		return false;
+
+	// check len (a program in flash must also end in it)
+	if (header->len == 0)
+		return false;
+	if (boot_in_flash(h, header) && header->len > h->flash + h->flash_size - (const uint8_t *)header)
+		return false;
+
+	// check type
+	if (header->type != BOOTSTRAP_PROG_HEADER && header->type != BOOTSTRAP_PROG_HEADER_LZ4 &&
+		header->type != BOOTSTRAP_PROG_HEADER_DELTA)
+		return false;
+
+	// skip the crc if it passed before and has not been written over since
+	if (validate_cache_hit(h, header))
+		return true;
+
+	// check the crc
+	if (header->crc != crc_buf(h->crc, &header->len, header->len - sizeof(header->crc), true))
+		return false;
+
+	validate_cache_add(h, header);
+	return true;
+}
+
+
+void boot_flash_changed(struct boot_h *h, const void *addr, uint32_t len)
+{
+	const struct boot_header *header;
+	uint32_t start = boot_addr(h, addr), prog;
+	int k;
+
+	// forget the programs the range overlaps (the header is read before it is
+	// changed, a bad len just means the program is forgotten)
+	for (k = 0; k < h->cache; k++)
+	{
+		prog = h->bkp_read(BKP_CACHE_ADDR(k));
+		if (prog == 0)
+			continue;
+		header = (const struct boot_header *)boot_ptr(h, prog);
+		if ((start >= prog)? start - prog < header->len: prog - start < len)
+			h->bkp_write(BKP_CACHE_ADDR(k), 0);
+	}
+}
+
+
+static bool overlap(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len)
+{
+	return a < b + b_len && b < a + a_len;
+}
+
+
+// true if len bytes from p are erased
+static bool blank(const uint8_t *p, uint32_t len)
+{
+	for (; len; len--)
+		if (*p++ != 0xff)
+			return false;
+	return true;
+}
+
+
+// checks common to all packed programs then make room in the slot at dst
+static bool unpack_start(struct boot_h *h, const struct boot_header *header, uint32_t dst, uint32_t len)
+{
+	uint8_t *slot = boot_ptr(h, dst);
+
+	// it must hold more than a header and not unpack over the packed copy
+	if (len <= BOOT_HEADER_LEN || overlap(dst, len, boot_addr(h, header), header->len))
+		return false;
+
+	if (!boot_in_flash(h, slot))
+		return true;
+
+	// the slot must start on a page/sector so the erase does not take anything
+	// else with it, and be blank after it (the f4 sectors are bigger than a
+	// page_size, a slot part way into one is left as it was by the erase)
+	if ((dst - h->flash_addr) % h->page_size != 0 || h->erase(slot, len) < len)
+		return false;
+	return blank(slot, len);
+}
+
+
+// write a chunk of the program being unpacked to slot
+static bool unpack_write(struct boot_h *h, uint8_t *slot, uint8_t *dst, const uint8_t *buf, uint32_t len)
+{
+	uint32_t k;
+
+	// pad a partial last word like erased flash so the crc sees what boot_validate will
+	for (k = len; k & 0x03; k++)
+		h->buf[k] = 0xff;
+
+	// crc as we go (skipping the programs own crc word at the start)
+	if (dst == slot)
+		h->unpack_crc = crc_buf(h->crc, buf + sizeof(uint32_t), len - sizeof(uint32_t), true);
+	else
+		h->unpack_crc = crc_buf(h->crc, buf, len, false);
+
+	if (boot_in_flash(h, dst))
+		return h->write(dst, buf, len);
+
+	// ram (do not use memcpy so we dont need clib)
+	for (k = 0; k < len; k++)
+		dst[k] = buf[k];
+	return true;
+}
+
+
+static bool unpack_lz4_flush(struct lz4_h *lz4, uint8_t *dst, const uint8_t *buf, uint32_t len)
+{
+	return unpack_write(lz4->param, lz4->dst, dst, buf, len);
+}
+
+
+static bool unpack_delta_flush(struct delta_h *delta, uint8_t *dst, const uint8_t *buf, uint32_t len)
+{
+	return unpack_write(delta->param, delta->dst, dst, buf, len);
+}
+
+
+// true if the slot at dst already holds the program (unpacked on an earlier boot)
+static bool unpacked(struct boot_h *h, uint32_t dst, uint32_t raw_crc)
+{
+	const struct boot_header *prog = (const struct boot_header *)boot_ptr(h, dst);
+
+	return prog->crc == raw_crc && boot_validate(h, prog);
+}
+
+
+// check the program that was unpacked to dst, n is what the unpack returned
+static const void *unpack_done(struct boot_h *h, int32_t n, uint32_t dst, uint32_t len, uint32_t raw_crc)
+{
+	const struct boot_header *prog = (const struct boot_header *)boot_ptr(h, dst);
+
+	// it was crc'd on the way in, now check what landed in the slot (this
+	// also caches it so the next boot skips the crc)
+	if (n != len || h->unpack_crc != raw_crc || prog->crc != raw_crc ||
+		prog->type != BOOTSTRAP_PROG_HEADER || !boot_validate(h, prog))
+		return NULL;
+
+	if (h->mark != NULL)
+		h->mark("unpack");
+	return prog;
+}
+
+
+const void *boot_unpack(struct boot_h *h, const void *prog)
+{
+	const struct boot_header *header = prog, *base;
+	const struct bootstrap_lz4_header *lz4_header;
+	const struct bootstrap_delta_header *delta_header;
+	struct lz4_h lz4;
+	struct delta_h delta;
+	int32_t n;
+
+	if (header == NULL)
+		return NULL;
+
+	switch (header->type)
+	{
+		case BOOTSTRAP_PROG_HEADER_LZ4:
+			lz4_header = (const struct bootstrap_lz4_header *)((const uint8_t *)header + BOOT_HEADER_LEN);
+			if (header->len <= BOOT_HEADER_LEN + sizeof(*lz4_header))
+				return NULL;
+			if (unpacked(h, lz4_header->dst, lz4_header->raw_crc))
+				return boot_ptr(h, lz4_header->dst);
+			if (!unpack_start(h, header, lz4_header->dst, lz4_header->raw_len))
+				return NULL;
+
+			lz4.dst = boot_ptr(h, lz4_header->dst);
+			lz4.max_len = lz4_header->raw_len;
+			lz4.buf = h->buf;
+			lz4.buf_size = h->buf_size;
+			lz4.flush = unpack_lz4_flush;
+			lz4.param = h;
+			n = lz4_unpack(&lz4, lz4_header + 1, header->len - BOOT_HEADER_LEN - sizeof(*lz4_header));
+			return unpack_done(h, n, lz4_header->dst, lz4_header->raw_len, lz4_header->raw_crc);
+
+		case BOOTSTRAP_PROG_HEADER_DELTA:
+			delta_header = (const struct bootstrap_delta_header *)((const uint8_t *)header + BOOT_HEADER_LEN);
+			if (header->len <= BOOT_HEADER_LEN + sizeof(*delta_header))
+				return NULL;
+			if (unpacked(h, delta_header->dst, delta_header->raw_crc))
+				return boot_ptr(h, delta_header->dst);
+
+			// the delta only applies to the exact program it was made against, and that has to survive
+			base = (const struct boot_header *)boot_ptr(h, delta_header->src);
+			if (base->crc != delta_header->src_crc || base->type != BOOTSTRAP_PROG_HEADER ||
+				!boot_validate(h, base) || overlap(delta_header->dst, delta_header->raw_len, delta_header->src, base->len))
+				return NULL;
+			if (!unpack_start(h, header, delta_header->dst, delta_header->raw_len))
+				return NULL;
+
+			delta.base = (const uint8_t *)base;
+			delta.base_len = base->len;
+			delta.dst = boot_ptr(h, delta_header->dst);
+			delta.max_len = delta_header->raw_len;
+			delta.buf = h->buf;
+			delta.buf_size = h->buf_size;
+			delta.flush = unpack_delta_flush;
+			delta.param = h;
+			n = delta_apply(&delta, delta_header + 1, header->len - BOOT_HEADER_LEN - sizeof(*delta_header));
+			return unpack_done(h, n, delta_header->dst, delta_header->raw_len, delta_header->raw_crc);
+
+		default:
+			// plain programs run where they are
+			return header;
+	}
+}
+
+
+void boot_prof_start(struct boot_prof *p, uint32_t cycles)
+{
+	p->magic = BOOT_PROF_MAGIC;
+	p->count = 0;
+	boot_prof_mark(p, "start", cycles);
+}
+
+
+void boot_prof_mark(struct boot_prof *p, const char *stage, uint32_t cycles)
+{
+	if (p->magic != BOOT_PROF_MAGIC || p->count >= BOOT_PROF_SAMPLES)
+		return;
+
+	p->samples[p->count].stage = stage;
+	p->samples[p->count].cycles = cycles;
+	p->count++;
+}
+
+
+int boot_prof_count(const struct boot_prof *p)
+{
+	if (p->magic != BOOT_PROF_MAGIC || p->count > BOOT_PROF_SAMPLES)
+		return 0;
+	return p->count;
+}
+
+
+bool boot_prof_get(const struct boot_prof *p, int n, const char **stage, uint32_t *cycles)
+{
+	if (n < 0 || n >= boot_prof_count(p))
+		return false;
+
+	*stage = p->samples[n].stage;
+	*cycles = p->samples[n].cycles - ((n > 0)? p->samples[n - 1].cycles: 0);
+	return true;
+}
@@ -0,0 +1,184 @@
+/**
+ * @file boot.h
+ *
+ * @brief program validation, unpacking and the boot profile for the bootstrap
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * This is the part of the bootstrap that is the same on every port, the hal
+ * bootstrap.c wraps it (bootstrap_validate_prog, bootstrap_unpack_prog,
+ * bootstrap_prof_* etc) with its backup registers, crc, nvm and cycle counter.
+ *
+ * Validations are cached in backup words (3 per program) so a program that
+ * passed its crc on an earlier boot is not crc'd again until it is written over
+ * (see boot_flash_changed) or it has been booted reverify times.
+ *
+ * A packed (lz4) or delta program is unpacked to its slot a buffer at a time
+ * and crc'd on the way in, then validated where it landed. This is skipped if
+ * the slot already holds it.
+ */
+
+
+#ifndef __BOOT__
+#define __BOOT__
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+
+
+// program header types (see bootstrap_prog_header in hal/<arch>/bootstrap.h)
+#define BOOTSTRAP_PROG_HEADER 0x01
+#define BOOTSTRAP_PROG_HEADER_LZ4 0x02 // program stored lz4 packed, see bootstrap_lz4_header
+#define BOOTSTRAP_PROG_HEADER_DELTA 0x03 // program stored as a delta against another, see bootstrap_delta_header
+
+
+// the start of every program header, the rest of bootstrap_prog_header is
+// port specific (isr_vector is a pointer) so only this much is read here
+struct boot_header
+{
+	uint32_t crc;			// crc32 over header and program minus the crc word
+	uint32_t len;			// size of the header and program
+	uint8_t type;			// BOOTSTRAP_PROG_HEADER*
+};
+
+// sizeof(bootstrap_prog_header), the packed/delta header follows it
+#define BOOT_HEADER_LEN (24)
+
+
+// a BOOTSTRAP_PROG_HEADER_LZ4 program header is followed by this and then the
+// lz4 block (see scripts/add_header.py --compress), boot_unpack unpacks it to
+// dst which is where the program was linked to run (all words so no packing)
+struct bootstrap_lz4_header
+{
+	uint32_t dst;         /**< where the program runs from (start of a flash page/sector, or ram) */
+	uint32_t raw_len;     /**< size of the unpacked program (its header len) */
+	uint32_t raw_crc;     /**< crc of the unpacked program (its header crc) */
+};
+
+
+// a BOOTSTRAP_PROG_HEADER_DELTA program header is followed by this and then
+// the delta ops (see lib/delta.h and scripts/add_header.py --delta),
+// boot_unpack rebuilds the program at dst from the one at src
+struct bootstrap_delta_header
+{
+	uint32_t dst;         /**< where the program runs from (start of a flash page/sector, or ram) */
+	uint32_t raw_len;     /**< size of the rebuilt program (its header len) */
+	uint32_t raw_crc;     /**< crc of the rebuilt program (its header crc) */
+	uint32_t src;         /**< header of the program the delta was made against (not overlapping dst) */
+	uint32_t src_crc;     /**< its header crc, the delta is only applied to exactly that program */
+};
+
+
+struct boot_h
+{
+	// setup
+	struct crc_h *crc;		// crc like the stm32 hw (crc_init must have been called)
+	uint32_t (*bkp_read)(int n); // read backup word n (it must survive a reset)
+	void (*bkp_write)(int n, uint32_t v); // write backup word n
+	uint8_t cache;			// number of validations to remember, each takes 3 backup words (0 to always crc)
+	uint16_t reverify;		// even with the cache do a full crc every this many boots
+	uint8_t *flash;			// start of the flash
+	uint32_t flash_size;	// bytes in the flash
+	uint32_t flash_addr;	// address the programs see the flash at (flash on target, host tests map it elsewhere)
+	uint32_t page_size;		// smallest erase (page or sector), a slot in flash must start on a multiple of it
+	uint32_t (*erase)(void *addr, uint32_t len); // eg nvm_erase
+	bool (*write)(void *dst, const void *src, uint32_t len); // eg nvm_write
+	uint8_t *buf;			// unpack staging buffer, each time it fills it is crc'd and written out
+	uint32_t buf_size;		// size of buf (whole words and more than a program header)
+	void (*mark)(const char *stage); // eg bootstrap_prof_mark, called with "unpack" once a program is unpacked (may be NULL)
+
+	// working
+	uint32_t unpack_crc;	// crc of what has been unpacked so far
+};
+
+
+// boot profile, each stage with the cycle counter at its end, it is kept
+// somewhere the startup does not clear so an app can see the bootstrap stages
+#define BOOT_PROF_SAMPLES 24 // fixed as the bootstrap and apps must agree on the layout
+struct boot_prof
+{
+	uint32_t magic;			// only trust the rest if this is BOOT_PROF_MAGIC
+	uint32_t count;
+	struct
+	{
+		const char *stage;
+		uint32_t cycles;	// cycle counter at the end of the stage
+	} samples[BOOT_PROF_SAMPLES];
+};
+
+
+/**
+ * @brief checks the header to see if it describes a valid program
+ * @param h boot handle
+ * @param header points to a program header for the program to check
+ * @note the crc is skipped if this program passed on an earlier boot and has
+ * not been written over since
+ * @return true if len > 0, type is a BOOTSTRAP_PROG_HEADER*, crc match; otherwise false
+ */
+bool boot_validate(struct boot_h *h, const void *header);
+
+
+/**
+ * @brief drop the cached validations of the programs a range overlaps because it is about to change
+ * @param h boot handle
+ * @param addr start of the range
+ * @param len number of bytes in the range
+ */
+void boot_flash_changed(struct boot_h *h, const void *addr, uint32_t len);
+
+
+/**
+ * @brief get the program described by header ready to boot
+ * @param h boot handle
+ * @param header points to a valid program header (see boot_validate)
+ * @note a packed program (or delta) is unpacked to its slot (erasing it if it
+ * is in flash), crc'd as it is written then checked with boot_validate, this
+ * is skipped if the slot already holds it from an earlier boot. Plain programs
+ * are just passed through
+ * @return header of the program to boot, NULL if it could not be unpacked
+ */
+const void *boot_unpack(struct boot_h *h, const void *header);
+
+
+/**
+ * @brief start a new boot profile
+ * @param p profile
+ * @param cycles cycle counter now (this is the "start" stage)
+ */
+void boot_prof_start(struct boot_prof *p, uint32_t cycles);
+
+
+/**
+ * @brief time stamp the end of a boot stage
+ * @param p profile
+ * @param stage name of the stage (this is kept by pointer so pass a string literal)
+ * @param cycles cycle counter now
+ * @note does nothing if boot_prof_start has not been called or the samples are full
+ */
+void boot_prof_mark(struct boot_prof *p, const char *stage, uint32_t cycles);
+
+
+/**
+ * @brief get the number of boot stages recorded so far
+ * @param p profile
+ * @return number of stages (0 if there is no profile)
+ */
+int boot_prof_count(const struct boot_prof *p);
+
+
+/**
+ * @brief get a boot stage from the profile
+ * @param p profile
+ * @param n stage number (0 is the call to boot_prof_start)
+ * @param stage set to the name of the stage
+ * @param cycles set to the number of cycles since the stage before
+ * @return false if there is no stage n
+ */
+bool boot_prof_get(const struct boot_prof *p, int n, const char **stage, uint32_t *cycles);
+
+
+#endif
@@ -30,6 +30,11 @@
 ulong reflect(ulong v,int b); // grab the reflect method from the crcmodel lib (a bit naughty but it works for now)
 
 
+// the table the table methods read, the const one if crc_init found one
+#define crc_table(h) (((h)->ctable != NULL)? (h)->ctable: (const void *)(h)->table)
+#define crc_table_size(h) (((h)->ctable != NULL)? (h)->ctable_size: (h)->table_size)
+
+
 // crc a 32bit word buffer via the table method
 static uint32_t crc_32w_buf_table(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 {
@@ -53,7 +58,7 @@ static uint32_t crc_32w_buf_table(struct crc_h *h, const void *buf, uint32_t len
 			//b = (uint8_t)(w & 0x000000FF);
 			//w >>= 8;
 			b = (h->cm.cm_refin)? reflect(b, 8): b;
-			h->cm.cm_reg = ((uint32_t *)h->table)[((h->cm.cm_reg>>24) ^ b) & 0xFFL] ^ (h->cm.cm_reg << 8);
+			h->cm.cm_reg = ((const uint32_t *)crc_table(h))[((h->cm.cm_reg>>24) ^ b) & 0xFFL] ^ (h->cm.cm_reg << 8);
 			if (--len == 0)
 				goto done;
 		} 
@@ -64,6 +69,112 @@ done:
 }
 
 
+// crc 4 bytes at once using the slice by 4 tables (w holds the bytes in the order they are crc'd, first byte in the msb)
+static uint16_t crc16_slice4(const uint16_t *tbl, uint16_t crc, uint32_t w)
+{
+	w ^= (uint32_t)crc << 16;
+	return tbl[3*256 + (w >> 24)] ^ tbl[2*256 + ((w >> 16) & 0xFF)] ^ 
+			tbl[1*256 + ((w >> 8) & 0xFF)] ^ tbl[w & 0xFF];
+}
+
+
+// as above but for the reflected tables, crc is the reflected register
+static uint16_t crc16_slice4_ref(const uint16_t *tbl, uint16_t crc, uint32_t w)
+{
+	// swap the bytes so the first one crc'd is in the lsb like the reflected register
+	w = ((w >> 24) | ((w >> 8) & 0xFF00) | ((w << 8) & 0xFF0000) | (w << 24)) ^ crc;
+	return tbl[3*256 + (w & 0xFF)] ^ tbl[2*256 + ((w >> 8) & 0xFF)] ^ 
+			tbl[1*256 + ((w >> 16) & 0xFF)] ^ tbl[w >> 24];
+}
+
+
+// crc a 16bit word buffer via the table method (non reflected input)
+static uint32_t crc_16w_buf_table(struct crc_h *h, const void *buf, uint32_t len, bool reset)
+{
+	const uint16_t *tbl = crc_table(h);
+	uint32_t *_buf = (uint32_t *)buf;
+	uint32_t w;
+	uint16_t _crc;
+	uint8_t b;
+	TRACE;
+
+	if (reset)
+		cm_ini(&h->cm);
+	_crc = (uint16_t)h->cm.cm_reg;
+
+	// slice by 4 (crc a whole word in one go) if the caller gave us room for the extra tables
+	if (crc_table_size(h) >= 4*256*sizeof(uint16_t))
+	{
+		while (len >= 4)
+		{
+			_crc = crc16_slice4(tbl, _crc, *_buf++);
+			len -= 4;
+		}
+	}
+
+	// bytes left over (or everything for the small table)
+	while (len)
+	{
+		uint8_t k = 4;
+		w = *_buf++;
+		while (k-- && len)
+		{
+			b = (uint8_t)((w & 0xFF000000) >> 24);
+			w <<= 8;
+			_crc = tbl[(uint8_t)(_crc >> 8) ^ b] ^ (uint16_t)(_crc << 8);
+			len--;
+		}
+	}
+
+	h->cm.cm_reg = _crc;
+	return cm_crc(&h->cm);
+}
+
+
+// crc a 16bit word buffer via the table method (reflected input, ie modbus etc)
+static uint32_t crc_16w_buf_table_ref(struct crc_h *h, const void *buf, uint32_t len, bool reset)
+{
+	const uint16_t *tbl = crc_table(h);
+	uint32_t *_buf = (uint32_t *)buf;
+	uint32_t w;
+	uint16_t _crc;
+	uint8_t b;
+	TRACE;
+
+	// the reflected table works on a reflected register so flip it while we work
+	if (reset)
+		cm_ini(&h->cm);
+	_crc = (uint16_t)reflect(h->cm.cm_reg, 16);
+
+	// slice by 4 (crc a whole word in one go) if the caller gave us room for the extra tables
+	if (crc_table_size(h) >= 4*256*sizeof(uint16_t))
+	{
+		while (len >= 4)
+		{
+			_crc = crc16_slice4_ref(tbl, _crc, *_buf++);
+			len -= 4;
+		}
+	}
+
+	// bytes left over (or everything for the small table)
+	while (len)
+	{
+		uint8_t k = 4;
+		w = *_buf++;
+		while (k-- && len)
+		{
+			b = (uint8_t)((w & 0xFF000000) >> 24);
+			w <<= 8;
+			_crc = tbl[(uint8_t)_crc ^ b] ^ (_crc >> 8);
+			len--;
+		}
+	}
+
+	h->cm.cm_reg = reflect(_crc, 16);
+	return cm_crc(&h->cm);
+}
+
+
 // crc a 8bit word buffer via the table method
 static uint8_t crc_8w_buf_table(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 {
@@ -87,7 +198,7 @@ static uint8_t crc_8w_buf_table(struct crc_h *h, const void *buf, uint32_t len,
 			//b = (uint8_t)(w & 0x000000FF);
 			//w >>= 8;
 			b = (h->cm.cm_refin)? reflect(b, 8): b;
-			_crc = ((uint8_t *)h->table)[_crc ^ b];
+			_crc = ((const uint8_t *)crc_table(h))[_crc ^ b];
 			if (--len == 0)
 				goto done;
 		} 
@@ -140,6 +251,21 @@ weak uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool
 }
 
 
+// default handler (this should be overridden if possible)
+weak bool crc_update_hard(struct crc_h *h, const uint32_t *buf, uint32_t len)
+{
+	TRACE;
+	return false;
+}
+
+
+// default handler (override this if crc_buf_hard does not crc exactly len bytes)
+weak uint32_t crc_buf_hard_len(struct crc_h *h, uint32_t len)
+{
+	return len;
+}
+
+
 // default handler (this should be overridden if possible)
 weak bool crc_init_hard(struct crc_h *h)
 {
@@ -160,6 +286,34 @@ static void gen_table32(struct crc_h *h)
 }
 
 
+// generate a 16 bit crc table (2bytes*256 = 1/2KB of ram needed, or 2KB for slice by 4)
+static void gen_table16(struct crc_h *h)
+{
+	unsigned int i, k;
+	uint16_t *tbl = h->table;
+	uint16_t t;
+	TRACE;
+
+	for (i=0; i < 256; i++)
+		tbl[i] = (uint16_t)cm_tab(&h->cm, i);
+
+	// extra tables for slice by 4 (tbl[k] is the crc of a byte followed by k zero bytes)
+	if (h->table_size < 4*256*sizeof(uint16_t))
+		return;
+	for (k=1; k < 4; k++)
+	{
+		for (i=0; i < 256; i++)
+		{
+			t = tbl[(k-1)*256 + i];
+			if (h->cm.cm_refin)
+				tbl[k*256 + i] = tbl[t & 0xFF] ^ (t >> 8);
+			else
+				tbl[k*256 + i] = tbl[t >> 8] ^ (uint16_t)(t << 8);
+		}
+	}
+}
+
+
 // generate a 8 bit crc table (1byte*256 = 1/4KB of ram needed)
 static void gen_table8(struct crc_h *h)
 {
@@ -172,10 +326,69 @@ static void gen_table8(struct crc_h *h)
 }
 
 
+#define cm_t_elem_compare(a, b, elem) (a->elem == b->elem)
+bool cm_t_compare(const cm_t *a, const cm_t *b)
+{
+	if (!cm_t_elem_compare(a, b, cm_width))
+		return false;
+	if (!cm_t_elem_compare(a, b, cm_poly))
+		return false;
+	if (!cm_t_elem_compare(a, b, cm_init))
+		return false;
+	if (!cm_t_elem_compare(a, b, cm_refin))
+		return false;
+	if (!cm_t_elem_compare(a, b, cm_refot))
+		return false;
+	if (!cm_t_elem_compare(a, b, cm_xorot))
+		return false;
+	// note do not compare cm_reg (not setup just working reg)
+
+	return true;
+}
+
+
+// look for a table built at compile time for this model (no ram or init time needed)
+static bool crc_init_const_table(struct crc_h *h)
+{
+	const struct crc_const_table *t;
+	TRACE;
+
+	for (t = crc_const_tables; t->cm.cm_width != 0; t++)
+	{
+		if (!cm_t_compare(&h->cm, &t->cm))
+			continue;
+
+		// the table methods only ever read the table so it is safe to use it from flash,
+		// the caller's h->table is left alone for the next crc_init
+		h->ctable = t->table;
+		h->ctable_size = t->table_size;
+		switch (h->cm.cm_width)
+		{
+			case 8:
+				h->method = CRC_METHOD_TABLE_8W;
+				break;
+			case 16:
+				h->method = CRC_METHOD_TABLE_16W;
+				break;
+			default:
+				h->method = CRC_METHOD_TABLE_32W;
+				break;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+
 static bool crc_init_table(struct crc_h *h)
 {
 	TRACE;
 
+	// use a const table if one was built for this model
+	if (crc_init_const_table(h))
+		return true;
+
 	// if the caller has not given space for a table then give up
 	if (h->table == NULL)
 		return false;
@@ -190,6 +403,14 @@ static bool crc_init_table(struct crc_h *h)
 		h->cm.cm_refin = refin;
 		return true;
 	}
+	if (h->cm.cm_width == 16 && h->table_size >= 256*sizeof(uint16_t))
+	{
+		// unlike the other tables keep refin here so we build a reflected table for
+		// reflected models and can skip reflecting every byte
+		h->method = CRC_METHOD_TABLE_16W;
+		gen_table16(h);
+		return true;
+	}
 	if (h->cm.cm_width == 8 && h->table_size >= 256*sizeof(uint8_t))
 	{
 		uint32_t refin = h->cm.cm_refin;
@@ -220,15 +441,23 @@ bool crc_init(struct crc_h *h)
 
 	// reset the cm (only needed for table and soft but it doesnt hurt for hard)
 	cm_ini(&h->cm);
+	h->ctable = NULL;
+	h->ctable_size = 0;
 
-	// try hardware method first as it is fastest
+	// try hardware method first as it is fastest, it can use a table for short
+	// buffers and tails if there is one (crc_init_table leaves it be if not)
 	if (h->method == CRC_METHOD_HARD || 
 		h->method == CRC_METHOD_BEST)
 		if (crc_init_hard(h))
+		{
+			crc_init_table(h);
+			h->method = CRC_METHOD_HARD;
 			return true;
+		}
 
 	// try table method next as it is still quite fast
 	if (h->method == CRC_METHOD_TABLE_8W || 
+		h->method == CRC_METHOD_TABLE_16W || 
 		h->method == CRC_METHOD_TABLE_32W || 
 		h->method == CRC_METHOD_BEST)
 		if(crc_init_table(h))
@@ -249,6 +478,10 @@ uint32_t crc_buf(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 			return crc_buf_hard(h, buf, len, reset);
 		case CRC_METHOD_TABLE_8W:
 			return crc_8w_buf_table(h, buf, len, reset);
+		case CRC_METHOD_TABLE_16W:
+			if (h->cm.cm_refin)
+				return crc_16w_buf_table_ref(h, buf, len, reset);
+			return crc_16w_buf_table(h, buf, len, reset);
 		case CRC_METHOD_TABLE_32W:
 			return crc_32w_buf_table(h, buf, len, reset);
 		default:
@@ -258,3 +491,217 @@ uint32_t crc_buf(struct crc_h *h, const void *buf, uint32_t len, bool reset)
 }
 
 
+uint32_t crc_buf_len(struct crc_h *h, uint32_t len)
+{
+	if (h->method == CRC_METHOD_HARD)
+		return crc_buf_hard_len(h, len);
+	return len;
+}
+
+
+// crc bytes one at a time in memory order into the working register
+static void crc_update_bytes(struct crc_h *h, const uint8_t *buf, uint32_t len)
+{
+	uint32_t reg = h->cm.cm_reg;
+	uint8_t b;
+
+	switch (h->method)
+	{
+		case CRC_METHOD_TABLE_8W:
+			while (len--)
+			{
+				b = (h->cm.cm_refin)? reflect(*buf++, 8): *buf++;
+				reg = ((const uint8_t *)crc_table(h))[(uint8_t)reg ^ b];
+			}
+			break;
+
+		case CRC_METHOD_TABLE_16W:
+			if (h->cm.cm_refin)
+			{
+				reg = reflect(reg, 16);
+				while (len--)
+					reg = ((const uint16_t *)crc_table(h))[(uint8_t)reg ^ *buf++] ^ (reg >> 8);
+				reg = reflect(reg, 16);
+			}
+			else
+			{
+				while (len--)
+					reg = ((const uint16_t *)crc_table(h))[(uint8_t)(reg >> 8) ^ *buf++] ^ (uint16_t)(reg << 8);
+			}
+			break;
+
+		case CRC_METHOD_TABLE_32W:
+			while (len--)
+			{
+				b = (h->cm.cm_refin)? reflect(*buf++, 8): *buf++;
+				reg = ((const uint32_t *)crc_table(h))[((reg >> 24) ^ b) & 0xFFL] ^ (reg << 8);
+			}
+			break;
+
+		default:
+			// soft and the odd bytes the hardware cannot eat
+			h->cm.cm_reg = reg;
+			cm_blk(&h->cm, (p_ubyte_)buf, len);
+			return;
+	}
+
+	h->cm.cm_reg = reg;
+}
+
+
+// crc whole aligned words (still crc'd in memory order)
+static void crc_update_words(struct crc_h *h, const uint32_t *buf, uint32_t len)
+{
+	const uint8_t *_buf = (const uint8_t *)buf;
+	const uint16_t *tbl = crc_table(h);
+	uint16_t _crc;
+	uint32_t w;
+
+	switch (h->method)
+	{
+		case CRC_METHOD_HARD:
+			if (crc_update_hard(h, buf, len))
+				return;
+			break;
+
+		case CRC_METHOD_TABLE_16W:
+			if (crc_table_size(h) < 4*256*sizeof(uint16_t))
+				break;
+			_crc = (h->cm.cm_refin)? reflect(h->cm.cm_reg, 16): h->cm.cm_reg;
+			while (len--)
+			{
+				// assemble the word so the first byte in memory is in the msb (whatever the cpu endianness)
+				w = ((uint32_t)_buf[0] << 24) | ((uint32_t)_buf[1] << 16) | ((uint32_t)_buf[2] << 8) | _buf[3];
+				_buf += 4;
+				if (h->cm.cm_refin)
+					_crc = crc16_slice4_ref(tbl, _crc, w);
+				else
+					_crc = crc16_slice4(tbl, _crc, w);
+			}
+			h->cm.cm_reg = (h->cm.cm_refin)? reflect(_crc, 16): _crc;
+			return;
+
+		default:
+			break;
+	}
+
+	// no word at a time method available
+	crc_update_bytes(h, _buf, len * sizeof(uint32_t));
+}
+
+
+void crc_update(struct crc_h *h, const void *buf, uint32_t len)
+{
+	const uint8_t *_buf = buf;
+	uint32_t head;
+
+	// bytes before the first word boundary
+	head = (sizeof(uint32_t) - ((uintptr_t)_buf & (sizeof(uint32_t) - 1))) & (sizeof(uint32_t) - 1);
+	if (head > len)
+		head = len;
+	crc_update_bytes(h, _buf, head);
+	_buf += head;
+	len -= head;
+
+	// bulk of the buffer as aligned words
+	crc_update_words(h, (const uint32_t *)_buf, len / sizeof(uint32_t));
+	_buf += len & ~(sizeof(uint32_t) - 1);
+	len &= sizeof(uint32_t) - 1;
+
+	// bytes after the last word boundary
+	crc_update_bytes(h, _buf, len);
+}
+
+
+uint32_t crc_final(struct crc_h *h)
+{
+	uint32_t crc = cm_crc(&h->cm);
+
+	// ready for the next message
+	cm_ini(&h->cm);
+	return crc;
+}
+
+
+// multiply a gf(2) matrix (one word per column) by a vector
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat, int width)
+{
+	int n;
+
+	for (n = 0; n < width; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+
+uint32_t crc_combine(struct crc_h *h, uint32_t crc_a, uint32_t crc_b, uint32_t len_b)
+{
+	const cm_t *cm = &h->cm;
+	uint32_t mask = (((uint32_t)1 << (cm->cm_width - 1)) << 1) - 1; // no << 32 for 32bit models
+	uint32_t even[32];	// even power of 2 zero bits operator
+	uint32_t odd[32];	// odd power of 2 zero bits operator
+	uint32_t reg_a, reg_b;
+	cm_t out;
+	int n;
+
+	if (len_b == 0)
+		return crc_a;
+
+	// undo the output stage to get back to the working registers, these are not
+	// reflected even for reflected models as refin only changes how bytes are fed in
+	reg_a = crc_a ^ cm->cm_xorot;
+	reg_b = crc_b ^ cm->cm_xorot;
+	if (cm->cm_refot)
+	{
+		reg_a = reflect(reg_a, cm->cm_width);
+		reg_b = reflect(reg_b, cm->cm_width);
+	}
+
+	// reg_b already holds init run through len_b bytes, so run (reg_a ^ init)
+	// through len_b zero bytes and the two add up to the crc of a then b
+	reg_a = (reg_a ^ cm->cm_init) & mask;
+
+	// operator for one zero bit (shift up and feed the top bit back through the poly)
+	for (n = 0; n < cm->cm_width - 1; n++)
+		odd[n] = (uint32_t)1 << (n + 1);
+	odd[cm->cm_width - 1] = cm->cm_poly & mask;
+
+	// 2 then 4 zero bits
+	gf2_matrix_square(even, odd, cm->cm_width);
+	gf2_matrix_square(odd, even, cm->cm_width);
+
+	// apply len_b zero bytes (first pass of the loop makes the 1 byte operator)
+	do
+	{
+		gf2_matrix_square(even, odd, cm->cm_width);
+		if (len_b & 1)
+			reg_a = gf2_matrix_times(even, reg_a);
+		len_b >>= 1;
+		if (len_b == 0)
+			break;
+
+		gf2_matrix_square(odd, even, cm->cm_width);
+		if (len_b & 1)
+			reg_a = gf2_matrix_times(odd, reg_a);
+		len_b >>= 1;
+	} while (len_b);
+
+	// back out through the output stage
+	out = *cm;
+	out.cm_reg = reg_a ^ reg_b;
+	return cm_crc(&out);
+}
@@ -27,7 +27,7 @@ struct crc_h
 
 	// table stuff
 	void *table;			// pointer the table method can use
-	uint16_t table_size;	// size in bytes of above table
+	uint16_t table_size;	// size in bytes of above table (16bit table uses slice by 4 if this is >= 4*256*2)
 
 	// which method
 	enum
@@ -35,17 +35,100 @@ struct crc_h
 		CRC_METHOD_BEST=0,
 		CRC_METHOD_HARD,
 		CRC_METHOD_TABLE_8W,
+		CRC_METHOD_TABLE_16W,
 		CRC_METHOD_TABLE_32W,
 		CRC_METHOD_SOFT,
 	} method;
+
+	// set by crc_init if a const table was built for the model (it is used in place of table)
+	const void *ctable;		// the const table in flash, NULL if table is used
+	uint16_t ctable_size;	// size in bytes of above table
+
+#if defined(__x86_64__) || defined(__aarch64__)
+	// set by crc_init_hard on the host (see crc_clmul.c)
+	uint64_t hard_k[4];		// clmul fold constants for the model
+#endif
+};
+
+
+// a crc table built at compile time so it lives in flash (see CRC_TABLES in lib/Makefile)
+struct crc_const_table
+{
+	cm_t cm;				// model this table is for
+	const void *table;		// table laid out as crc_init would build it in h->table
+	uint16_t table_size;	// size in bytes of above table
 };
+extern const struct crc_const_table crc_const_tables[]; // terminated by cm_width == 0
+
+
+/**
+ * @brief compare the setup of 2 crc models
+ * @return true if both models will give the same crc (the working reg is ignored)
+ */
+bool cm_t_compare(const cm_t *a, const cm_t *b);
 
 
+/**
+ * @brief setup a crc handle
+ * @param h crc handle, the model and preferred method must be set
+ * @note if a const table was built for the model (see crc_tables.py) it is
+ * used directly from flash through h->ctable, otherwise the table methods build
+ * the table in the caller supplied h->table (which is never changed so the
+ * handle can be set up again for another model). The hard method is given the
+ * same table (if there is one) for what it does a byte at a time
+ * @return true if a method was found (this is always true as the soft method works for anything)
+ */
 bool crc_init(struct crc_h *h);
 
 
 uint32_t crc_buf(struct crc_h *h, const void *buf, uint32_t len, bool reset);
 
 
+/**
+ * @brief get the number of bytes crc_buf really crc's for a len byte buffer
+ * @param h crc handle
+ * @param len number of bytes passed to crc_buf
+ * @note the stm32 hw only takes whole words so the hard method crc's the
+ * bytes up to the next word too, pass this to crc_combine for such a block
+ * @return len, rounded up to whole words for the hard method on the stm32
+ */
+uint32_t crc_buf_len(struct crc_h *h, uint32_t len);
+
+
+/**
+ * @brief crc len bytes of buf in to the running crc held in h
+ * @param h crc handle (crc_init or crc_final start a new crc)
+ * @param buf data to crc, any alignment
+ * @param len number of bytes to crc, any length
+ * @note unlike crc_buf (which crc's 32bit words msb first like the stm32 hw)
+ * this crc's the bytes in the order they sit in memory, which is what link
+ * protocols expect, and it never reads past buf + len
+ */
+void crc_update(struct crc_h *h, const void *buf, uint32_t len);
+
+
+/**
+ * @brief get the crc of everything passed to crc_update and reset h for the next message
+ * @param h crc handle
+ * @return crc of all the bytes since the last crc_init or crc_final
+ */
+uint32_t crc_final(struct crc_h *h);
+
+
+/**
+ * @brief work out the crc of a then b from the crc of a and the crc of b
+ * @param h crc handle (only the model is used, the running crc is not touched)
+ * @param crc_a crc of the first block
+ * @param crc_b crc of the second block
+ * @param len_b number of bytes in the second block
+ * @note this lets blocks be crc'd separately (in any order, by different
+ * methods or as they arrive) and merged in O(log len_b). It works for
+ * crc_update crc's, and for crc_buf crc's as long as the first block is
+ * whole words
+ * @return crc of a followed by b
+ */
+uint32_t crc_combine(struct crc_h *h, uint32_t crc_a, uint32_t crc_b, uint32_t len_b);
+
+
 #endif
 
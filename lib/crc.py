@@ -44,7 +44,10 @@ class crc_h(ctypes.Structure):
 	_fields_ = [('cm', cm_t),
 				('table', ctypes.c_void_p),
 				('table_size', ctypes.c_uint16),
-				('method', ctypes.c_int)]
+				('method', ctypes.c_int),
+				('ctable', ctypes.c_void_p),
+				('ctable_size', ctypes.c_uint16),
+				('hard_k', ctypes.c_uint64 * 4)] # only there on x86-64/aarch64 hosts, harmless room otherwise
 
 # models the stm32f10x hardware crc module
 stm32f10x_crc_h = crc_h(
@@ -59,6 +62,18 @@ def crc_init(h):
 def crc_buf(h, buf, len, reset=True):
 	return libcrc.crc_buf(ctypes.byref(h), buf, len, reset)
 
+# void crc_update(struct crc_h *h, const void *buf, uint32_t len)
+def crc_update(h, buf, len):
+	libcrc.crc_update(ctypes.byref(h), buf, len)
+
+# uint32_t crc_final(struct crc_h *h)
+def crc_final(h):
+	return libcrc.crc_final(ctypes.byref(h)) & 0xffffffff
+
+# uint32_t crc_combine(struct crc_h *h, uint32_t crc_a, uint32_t crc_b, uint32_t len_b)
+def crc_combine(h, crc_a, crc_b, len_b):
+	return libcrc.crc_combine(ctypes.byref(h), uint32_t(crc_a), uint32_t(crc_b), uint32_t(len_b)) & 0xffffffff
+
 # unit test
 if __name__ == "__main__":
 	h = stm32f10x_crc_h
@@ -0,0 +1,342 @@
+/**
+ * @file crc_clmul.c
+ *
+ * @brief host only "hard" crc method using carry-less multiply instructions
+ * (pclmulqdq on x86-64, pmull on aarch64) to fold the buffer 64 bytes at a time
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * This is only built in to libcrc.so, it overrides the weak crc_*_hard methods
+ * in crc.c the same way the hal does on target. crc_init_hard checks the cpu at
+ * run time so if the instructions are not there crc_init falls back to the
+ * table method as normal. Any 32 bit model can use it (reflected or not).
+ *
+ * The folding works on the message as a polynomial, each 128 bit chunk A of
+ * the message followed by D more bits is worth A*x^D, and since we only care
+ * about the result mod P that can be swapped for (A_hi*(x^(D+64) mod P)) ^
+ * (A_lo*(x^D mod P)) which is 2 multiplies and still fits in 128 bits. Once
+ * the whole buffer is folded down to the last 128 bits they are run through
+ * the normal byte method to get the register.
+ *
+ * The constants only depend on the model so crc_init_hard works them out once
+ * and keeps them in the handle. Buffers too short to fold, and the bytes left
+ * over after the folding, go through the table if crc_init gave the handle one.
+ */
+
+
+#include "crc.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <wmmintrin.h>
+#define CLMUL_TARGET __attribute__((target("pclmul,sse2")))
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CLMUL_TARGET __attribute__((target("+crypto")))
+#endif
+
+
+#ifdef CLMUL_TARGET
+
+// buffers smaller than this are not worth the setup, use the table (or soft) method
+#define CLMUL_MIN_LEN (4*16)
+
+
+ulong reflect(ulong v,int b); // grab the reflect method from the crcmodel lib (a bit naughty but it works for now)
+
+
+// 128 bit chunk of the message, hi always holds the first (highest order) half
+struct clmul_128
+{
+	uint64_t hi;
+	uint64_t lo;
+};
+
+
+// fold constants for one model
+struct clmul_k
+{
+	uint64_t k576, k512;	// fold a lane forward 512 bits (to the next 64 bytes)
+	uint64_t k192, k128;	// fold a lane forward 128 bits (in to the next lane)
+	bool ref;				// reflected model (bits of each 64 bit half are reversed)
+	bool words;				// crc_buf word order (msb of each 32 bit word first)
+};
+
+
+// 64x64 -> 128 bit carry-less multiply
+CLMUL_TARGET static inline void clmul(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if defined(__x86_64__)
+	__m128i r = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0x00);
+	*lo = (uint64_t)_mm_cvtsi128_si64(r);
+	*hi = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(r, r));
+#else
+	uint64x2_t r = vreinterpretq_u64_p128(vmull_p64((poly64_t)a, (poly64_t)b));
+	*lo = vgetq_lane_u64(r, 0);
+	*hi = vgetq_lane_u64(r, 1);
+#endif
+}
+
+
+static bool clmul_supported(void)
+{
+#if defined(__x86_64__)
+	return __builtin_cpu_supports("pclmul");
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+#endif
+}
+
+
+// x^n mod poly
+static uint32_t clmul_xpow(uint32_t poly, unsigned int n)
+{
+	uint32_t r = 1;
+
+	while (n--)
+		r = (r & 0x80000000)? (r << 1) ^ poly: r << 1;
+	return r;
+}
+
+
+// fold constant for pushing a 64 bit half forward d bits, in the reflected
+// domain the multiply of 2 reversed values comes out 1 bit short so use x^(d-1)
+static uint64_t clmul_fold_k(uint32_t poly, unsigned int d, bool ref)
+{
+	if (ref)
+		return (uint64_t)reflect(clmul_xpow(poly, d - 1), 32) << 32;
+	return clmul_xpow(poly, d);
+}
+
+
+// constants crc_init_hard worked out for the model
+static void clmul_setup(struct clmul_k *k, const struct crc_h *h, bool words)
+{
+	k->ref = h->cm.cm_refin;
+	k->words = words;
+	k->k576 = h->hard_k[0];
+	k->k512 = h->hard_k[1];
+	k->k192 = h->hard_k[2];
+	k->k128 = h->hard_k[3];
+}
+
+
+// table crc_init left for the bytes that are not folded (laid out like the
+// table_32w one), NULL if there is none
+static const uint32_t *clmul_table(const struct crc_h *h)
+{
+	if (h->ctable != NULL)
+		return h->ctable;
+	if (h->table != NULL && h->table_size >= 256*sizeof(uint32_t))
+		return h->table;
+	return NULL;
+}
+
+
+// each nibble bit reversed (reflect() a bit at a time is most of the cost of a table lookup)
+static const uint8_t clmul_rev4[16] =
+{
+	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+
+
+// crc len bytes in the order given, through the table if there is one
+static void clmul_bytes(struct crc_h *h, const uint8_t *buf, uint32_t len)
+{
+	const uint32_t *tbl = clmul_table(h);
+	uint32_t reg;
+	uint8_t b;
+
+	if (tbl == NULL)
+	{
+		cm_blk(&h->cm, (p_ubyte_)buf, len);
+		return;
+	}
+
+	reg = h->cm.cm_reg;
+	while (len--)
+	{
+		b = *buf++;
+		if (h->cm.cm_refin)
+			b = (clmul_rev4[b & 0x0f] << 4) | clmul_rev4[b >> 4];
+		reg = tbl[(reg >> 24) ^ b] ^ (reg << 8);
+	}
+	h->cm.cm_reg = reg;
+}
+
+
+// load 64 bits of the message so the first bit in the stream is the msb (or
+// the lsb for reflected models), this assumes a little endian host
+static inline uint64_t clmul_load(const struct clmul_k *k, const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	if (k->ref == k->words)
+		v = __builtin_bswap64(v);
+	if (k->words)
+		v = (v << 32) | (v >> 32);
+	return v;
+}
+
+
+// save 64 bits of the message back in stream order (so the byte method can finish it off)
+static inline void clmul_store(const struct clmul_k *k, uint8_t *p, uint64_t v)
+{
+	if (!k->ref)
+		v = __builtin_bswap64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+
+// push a lane forward by the distance given by the constants
+CLMUL_TARGET static inline struct clmul_128 clmul_fold(const struct clmul_k *k, struct clmul_128 a, uint64_t k_hi, uint64_t k_lo)
+{
+	struct clmul_128 r;
+	uint64_t h1, l1, h2, l2;
+
+	clmul(a.hi, k_hi, &h1, &l1);
+	clmul(a.lo, k_lo, &h2, &l2);
+
+	// reflected values come out of the multiply backwards
+	if (k->ref)
+	{
+		r.hi = l1 ^ l2;
+		r.lo = h1 ^ h2;
+	}
+	else
+	{
+		r.hi = h1 ^ h2;
+		r.lo = l1 ^ l2;
+	}
+	return r;
+}
+
+
+// run len bytes (a multiple of 64) through the folding, returns the new register
+CLMUL_TARGET static uint32_t clmul_blocks(const struct clmul_k *k, struct crc_h *h, const uint8_t *buf, uint32_t len, uint32_t reg)
+{
+	struct clmul_128 a[4];
+	uint8_t tail[16];
+	int n;
+
+	for (n = 0; n < 4; n++)
+	{
+		a[n].hi = clmul_load(k, &buf[n*16]);
+		a[n].lo = clmul_load(k, &buf[n*16 + 8]);
+	}
+	buf += 64;
+	len -= 64;
+
+	// starting with reg is the same as starting from 0 with reg xor'd in to the first 32 bits
+	a[0].hi ^= (k->ref)? (uint64_t)reflect(reg, 32): (uint64_t)reg << 32;
+
+	// 4 lanes to keep the multiplier busy
+	while (len)
+	{
+		for (n = 0; n < 4; n++)
+		{
+			a[n] = clmul_fold(k, a[n], k->k576, k->k512);
+			a[n].hi ^= clmul_load(k, &buf[n*16]);
+			a[n].lo ^= clmul_load(k, &buf[n*16 + 8]);
+		}
+		buf += 64;
+		len -= 64;
+	}
+
+	// fold the lanes down to one
+	for (n = 1; n < 4; n++)
+	{
+		struct clmul_128 f = clmul_fold(k, a[n-1], k->k192, k->k128);
+		a[n].hi ^= f.hi;
+		a[n].lo ^= f.lo;
+	}
+
+	// last 128 bits go through the byte method from a zero register
+	clmul_store(k, &tail[0], a[3].hi);
+	clmul_store(k, &tail[8], a[3].lo);
+	h->cm.cm_reg = 0;
+	clmul_bytes(h, tail, sizeof(tail));
+	return h->cm.cm_reg;
+}
+
+
+bool crc_init_hard(struct crc_h *h)
+{
+	uint32_t poly = h->cm.cm_poly;
+	bool ref = h->cm.cm_refin;
+
+	// only 32 bit models and only if the cpu can do it
+	if (h->cm.cm_width != 32 || !clmul_supported())
+		return false;
+
+	h->hard_k[0] = clmul_fold_k(poly, 512 + 64, ref);
+	h->hard_k[1] = clmul_fold_k(poly, 512, ref);
+	h->hard_k[2] = clmul_fold_k(poly, 128 + 64, ref);
+	h->hard_k[3] = clmul_fold_k(poly, 128, ref);
+	h->method = CRC_METHOD_HARD;
+	return true;
+}
+
+
+uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset)
+{
+	const uint8_t *_buf = buf;
+	struct clmul_k k;
+	uint8_t tail[CLMUL_MIN_LEN];
+	uint32_t n, w;
+
+	if (reset)
+		cm_ini(&h->cm);
+
+	n = len & ~(CLMUL_MIN_LEN - 1);
+	if (n)
+	{
+		clmul_setup(&k, h, true);
+		h->cm.cm_reg = clmul_blocks(&k, h, _buf, n, h->cm.cm_reg);
+		_buf += n;
+		len -= n;
+	}
+
+	// rest of the buffer msb of each word first (same as the soft method), put
+	// in that order then crc'd in one go
+	for (n = 0; n < len; n += sizeof(w))
+	{
+		memcpy(&w, &_buf[n], sizeof(w));
+		tail[n] = (uint8_t)(w >> 24);
+		tail[n + 1] = (uint8_t)(w >> 16);
+		tail[n + 2] = (uint8_t)(w >> 8);
+		tail[n + 3] = (uint8_t)w;
+	}
+	clmul_bytes(h, tail, len);
+
+	return cm_crc(&h->cm);
+}
+
+
+bool crc_update_hard(struct crc_h *h, const uint32_t *buf, uint32_t len)
+{
+	const uint8_t *_buf = (const uint8_t *)buf;
+	struct clmul_k k;
+	uint32_t n;
+
+	len *= sizeof(uint32_t);
+	n = len & ~(CLMUL_MIN_LEN - 1);
+	if (n)
+	{
+		clmul_setup(&k, h, false);
+		h->cm.cm_reg = clmul_blocks(&k, h, _buf, n, h->cm.cm_reg);
+		_buf += n;
+		len -= n;
+	}
+
+	// odd words in memory order
+	clmul_bytes(h, _buf, len);
+	return true;
+}
+
+#endif
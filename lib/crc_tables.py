@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+
+# generate const (ie flash resident) crc tables for the models named on the
+# command line, the models are looked up in crc_models.def
+#
+# usage: crc_tables.py [model ...] > crc_tables.c
+
+import sys
+import os
+import re
+
+
+def load_models(filename):
+	''' read the CRC_MODEL(...) lines from the x-macro catalogue '''
+	models = {}
+	for line in open(filename, "r"):
+		m = re.match(r'^CRC_MODEL\((.*)\)', line.strip())
+		if m is None:
+			continue
+		f = [x.strip() for x in m.group(1).split(',')]
+		models[f[0]] = {
+			'width': int(f[1], 0),
+			'poly': int(f[2], 0),
+			'init': f[3],
+			'refin': f[4] == 'TRUE',
+			'refot': f[5],
+			'xorot': f[6],
+		}
+	return models
+
+
+def reflect(v, b):
+	r = 0
+	for i in range(b):
+		if v & (1 << i):
+			r |= 1 << (b - 1 - i)
+	return r
+
+
+def cm_tab(cm, index, refin):
+	''' same as cm_tab in crcmodel.c '''
+	width = cm['width']
+	topbit = 1 << (width - 1)
+	mask = (1 << width) - 1
+	inbyte = reflect(index, 8) if refin else index
+	r = inbyte << (width - 8)
+	for i in range(8):
+		if r & topbit:
+			r = (r << 1) ^ cm['poly']
+		else:
+			r <<= 1
+	if refin:
+		r = reflect(r, width)
+	return r & mask
+
+
+def gen_table(cm):
+	''' build the table the same way crc_init_table in crc.c would '''
+	if cm['width'] != 16:
+		# 8 and 32 bit tables are always non reflected (input is reflected a byte at a time)
+		return [cm_tab(cm, i, False) for i in range(256)]
+
+	# 16 bit tables follow refin and get the extra slice by 4 tables
+	tbl = [cm_tab(cm, i, cm['refin']) for i in range(256)]
+	for k in range(1, 4):
+		for i in range(256):
+			t = tbl[(k - 1) * 256 + i]
+			if cm['refin']:
+				tbl.append(tbl[t & 0xFF] ^ (t >> 8))
+			else:
+				tbl.append(tbl[t >> 8] ^ ((t << 8) & 0xFFFF))
+	return tbl
+
+
+thisdir = os.path.dirname(os.path.abspath(__file__))
+models = load_models(os.path.join(thisdir, 'crc_models.def'))
+
+out = sys.stdout
+out.write("/* generated by crc_tables.py, do not edit (see CRC_TABLES in lib/Makefile) */\n\n")
+out.write("#include \"crc.h\"\n#include <stdlib.h> // for NULL\n\n")
+
+names = sys.argv[1:]
+for name in names:
+	if name not in models:
+		sys.exit("crc_tables.py: unknown crc model %s (see crc_models.def)" % name)
+	cm = models[name]
+	tbl = gen_table(cm)
+	ctype = {8: 'uint8_t', 16: 'uint16_t', 32: 'uint32_t'}[cm['width']]
+	digits = cm['width'] // 4
+	out.write("static const %s %s_table[%d] =\n{" % (ctype, name, len(tbl)))
+	for i, v in enumerate(tbl):
+		if i % 8 == 0:
+			out.write("\n\t")
+		out.write("0x%0*X, " % (digits, v))
+	out.write("\n};\n\n")
+
+out.write("const struct crc_const_table crc_const_tables[] =\n{\n")
+for name in names:
+	cm = models[name]
+	out.write("\t{{%d, 0x%0*X, %s, %s, %s, %s, 0}, %s_table, sizeof(%s_table)},\n" % (
+		cm['width'], cm['width'] // 4, cm['poly'], cm['init'], 'TRUE' if cm['refin'] else 'FALSE',
+		cm['refot'], cm['xorot'], name, name))
+out.write("\t{{0,}, NULL, 0}, // end of list\n};\n")
@@ -0,0 +1,90 @@
+/**
+ * @file delta.c
+ *
+ * @brief apply a binary delta (see delta.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+
+#include "delta.h"
+
+
+// 32 bit little endian word from anywhere in the delta
+static uint32_t delta_word(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+// copy n bytes to the output a buf at a time
+static bool delta_out(struct delta_h *h, const uint8_t *src, uint32_t n)
+{
+	uint32_t k;
+
+	while (n)
+	{
+		k = h->buf_size - h->pos;
+		if (k > n)
+			k = n;
+		n -= k;
+		h->len += k;
+		while (k--)
+			h->buf[h->pos++] = *src++;
+
+		if (h->pos == h->buf_size)
+		{
+			h->pos = 0;
+			if (!h->flush(h, h->dst + h->len - h->buf_size, h->buf, h->buf_size))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+int32_t delta_apply(struct delta_h *h, const void *delta, uint32_t len)
+{
+	const uint8_t *_delta = delta;
+	const uint8_t *end = _delta + len;
+	uint32_t op, n, offset;
+
+	h->len = 0;
+	h->pos = 0;
+
+	while (_delta < end)
+	{
+		if (end - _delta < 4)
+			return -1;
+		op = delta_word(_delta);
+		_delta += 4;
+		n = op & ~DELTA_INSERT;
+		if (n > h->max_len - h->len)
+			return -1;
+
+		if (op & DELTA_INSERT)
+		{
+			if (n > (uint32_t)(end - _delta) || !delta_out(h, _delta, n))
+				return -1;
+			_delta += n;
+		}
+		else
+		{
+			if (end - _delta < 4)
+				return -1;
+			offset = delta_word(_delta);
+			_delta += 4;
+			if (offset > h->base_len || n > h->base_len - offset || !delta_out(h, h->base + offset, n))
+				return -1;
+		}
+	}
+
+	// whatever is left
+	if (h->pos && !h->flush(h, h->dst + h->len - h->pos, h->buf, h->pos))
+		return -1;
+	h->pos = 0;
+	return h->len;
+}
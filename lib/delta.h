@@ -0,0 +1,60 @@
+/**
+ * @file delta.h
+ *
+ * @brief apply a binary delta (copy/insert list) to rebuild a program from an older one
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * A delta is a list of ops made by lib/delta.py, each starts with a 32 bit
+ * little endian word, bit 31 set is an insert of the next len (bits 0..30)
+ * bytes of the delta, clear is a copy of len bytes from the base starting at
+ * the offset in the next 32 bit word. The output is staged and flushed the
+ * same way as lz4.h so it can go straight in to flash, the base is only read.
+ */
+
+
+#ifndef __DELTA__
+#define __DELTA__
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define DELTA_INSERT (0x80000000)
+
+
+struct delta_h
+{
+	// setup
+	const uint8_t *base;	// what the delta was made against (must not overlap dst)
+	uint32_t base_len;		// size of base in bytes
+	uint8_t *dst;			// where the output ends up
+	uint32_t max_len;		// most bytes the output can take
+	uint8_t *buf;			// output is staged here until it is flushed
+	uint32_t buf_size;		// size of buf in bytes (a multiple of 4 keeps every flush but the last whole words)
+	bool (*flush)(struct delta_h *h, uint8_t *dst, const uint8_t *buf, uint32_t len); // put len bytes of output at dst, false to stop
+	void *param;			// anything the flush callback needs
+
+	// working
+	uint32_t len;			// bytes output so far
+	uint32_t pos;			// bytes waiting in buf
+};
+
+
+/**
+ * @brief rebuild the output from the base and a delta
+ * @param h delta handle, the setup part must be filled in
+ * @param delta list of ops to apply
+ * @param len size of the delta in bytes
+ * @note flush is called each time buf fills and once more at the end with
+ * whatever is left, dst goes up by buf_size each time
+ * @return number of bytes output, or -1 if the delta is corrupt, reaches
+ * outside the base, is bigger than max_len or flush failed
+ */
+int32_t delta_apply(struct delta_h *h, const void *delta, uint32_t len);
+
+
+#endif
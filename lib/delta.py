@@ -0,0 +1,102 @@
+#!/usr/bin/env python
+
+# binary delta between two program images, this is the host side of
+# lib/delta.c (see delta.h for the op format). Matches are found greedily
+# from an index of the base, trying the same shift as the last copy first
+# since most of a rebuilt program just moves a little.
+#
+# usage: delta.py <base> <new> <delta>
+
+import sys
+import struct
+
+INSERT = 0x80000000
+KEY = 8			# bytes indexed in the base
+MIN_COPY = 16	# shorter matches cost more as a copy than an insert
+MAX_CANDIDATES = 8
+
+
+def _match_len(base, b, new, n):
+	''' how many bytes match from base[b] and new[n] '''
+	k = 0
+	step = 64
+	while step:
+		while b + k + step <= len(base) and n + k + step <= len(new) and base[b + k:b + k + step] == new[n + k:n + k + step]:
+			k += step
+		step //= 2
+	return k
+
+
+def diff(base, new):
+	''' make a delta that turns base in to new, returns a bytearray '''
+	base = bytes(base)
+	new = bytes(new)
+	out = bytearray()
+	index = {}
+	for k in range(len(base) - KEY + 1):
+		l = index.setdefault(base[k:k + KEY], [])
+		if len(l) < MAX_CANDIDATES:
+			l.append(k)
+
+	lit = bytearray()
+	shift = 0
+	n = 0
+	while n < len(new):
+		best, best_len = None, 0
+		candidates = [n + shift] + index.get(new[n:n + KEY], [])
+		for b in candidates:
+			if b < 0 or b >= len(base):
+				continue
+			l = _match_len(base, b, new, n)
+			if l > best_len:
+				best, best_len = b, l
+		if best_len < MIN_COPY:
+			lit.append(new[n])
+			n += 1
+			continue
+
+		if lit:
+			out += struct.pack('<L', INSERT | len(lit)) + lit
+			lit = bytearray()
+		out += struct.pack('<LL', best_len, best)
+		shift = best - n
+		n += best_len
+
+	if lit:
+		out += struct.pack('<L', INSERT | len(lit)) + lit
+	return out
+
+
+def patch(base, delta):
+	''' apply a delta to base (same checks as delta_apply), returns a bytearray '''
+	delta = bytes(delta)
+	out = bytearray()
+	i = 0
+	while i < len(delta):
+		op, = struct.unpack_from('<L', delta, i)
+		i += 4
+		n = op & ~INSERT
+		if op & INSERT:
+			if i + n > len(delta):
+				raise ValueError('delta insert runs past the end')
+			out += delta[i:i + n]
+			i += n
+		else:
+			offset, = struct.unpack_from('<L', delta, i)
+			i += 4
+			if offset + n > len(base):
+				raise ValueError('delta copy reaches outside the base')
+			out += base[offset:offset + n]
+	return out
+
+
+if __name__ == '__main__':
+	if len(sys.argv) != 4:
+		sys.exit('usage: %s <base> <new> <delta>' % sys.argv[0])
+	base = open(sys.argv[1], 'rb').read()
+	new = open(sys.argv[2], 'rb').read()
+	d = diff(base, new)
+	if patch(base, d) != bytearray(new):
+		sys.exit('delta round trip failed')
+	open(sys.argv[3], 'wb').write(d)
+	sys.stderr.write('delta %d bytes (new is %d)\n' % (len(d), len(new)))
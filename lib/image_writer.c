@@ -0,0 +1,250 @@
+/**
+ * @file image_writer.c
+ *
+ * @brief stream a program image in to a flash slot as it arrives (see image_writer.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+
+#include <string.h>
+#include "image_writer.h"
+
+
+// where the program header crc word sits (held back until the end)
+#define CRC_WORD (sizeof(((struct image_writer_header *)0)->crc))
+
+
+static bool image_writer_fail(struct image_writer *w)
+{
+	w->error = true;
+	return false;
+}
+
+
+// called when erase_async is done (from the flash isr)
+static void erase_complete(void *addr, uint32_t len, void *param)
+{
+	struct image_writer *w = param;
+
+	w->erase_len = len;
+	w->erasing = false;
+}
+
+
+// count an erase that is done
+static bool erase_done(struct image_writer *w, uint32_t n)
+{
+	if (n == 0)
+		return image_writer_fail(w);
+	w->erased += n;
+	return true;
+}
+
+
+// erase the next page/sector of the slot (or start to with erase_async)
+static bool erase_next(struct image_writer *w)
+{
+	if (w->erase_async == NULL)
+		return erase_done(w, w->erase(w->dst + w->erased, 1));
+
+	w->erasing = true;
+	w->erase_pending = true;
+	if (!w->erase_async(w->dst + w->erased, 1, erase_complete, w))
+	{
+		w->erasing = false;
+		w->erase_pending = false;
+		return image_writer_fail(w);
+	}
+	return true;
+}
+
+
+// first look at a buffer before it is programmed, check the header and crc it
+static bool prog_start(struct image_writer *w)
+{
+	const struct image_writer_header *header = (const struct image_writer_header *)w->buf[w->prog];
+	uint8_t *buf = w->buf[w->prog];
+	uint32_t n = w->ready_len[w->prog];
+	uint32_t k, crc;
+
+	// pad a partial last word like erased flash (so the crc sees what bootstrap_validate_prog will)
+	for (k = n; k & 0x03; k++)
+		buf[k] = 0xff;
+
+	if (w->written == 0)
+	{
+		// the image has to be something the bootstrap can run and fit the slot
+		if (n <= IMAGE_WRITER_HEADER_LEN || header->len <= IMAGE_WRITER_HEADER_LEN || header->len > w->max_len ||
+			(header->type != IMAGE_WRITER_TYPE_PLAIN && header->type != IMAGE_WRITER_TYPE_LZ4 &&
+			header->type != IMAGE_WRITER_TYPE_DELTA))
+			return image_writer_fail(w);
+		w->image_len = header->len;
+		w->header_crc = header->crc;
+
+		// skip the crc word, it is programmed last
+		w->image_crc = crc_buf(w->crc, buf + CRC_WORD, n - CRC_WORD, true);
+		w->prog_pos = CRC_WORD;
+		w->written = CRC_WORD;
+		return true;
+	}
+
+	// crc each buffer on its own and combine so nothing else using the crc hw can
+	// upset it (the hw crc's the padding of a partial last buffer too, so does the bootstrap)
+	crc = crc_buf(w->crc, buf, n, true);
+	w->image_crc = crc_combine(w->crc, w->image_crc, crc, crc_buf_len(w->crc, n));
+	return true;
+}
+
+
+bool image_writer_start(struct image_writer *w)
+{
+	if (w->buf[0] == NULL || w->buf[1] == NULL || w->buf_size <= IMAGE_WRITER_HEADER_LEN ||
+		(w->buf_size & 0x03) || w->crc == NULL || w->page_size == 0 || w->dst < w->flash ||
+		(w->dst - w->flash) % w->page_size != 0 || (w->erase == NULL && w->erase_async == NULL) ||
+		w->write == NULL)
+		return false;
+
+	w->ready[0] = w->ready[1] = false;
+	w->fill = 0;
+	w->fill_pos = 0;
+	w->prog = 0;
+	w->prog_pos = 0;
+	w->len = 0;
+	w->image_len = 0;
+	w->written = 0;
+	w->erased = 0;
+	w->erasing = false;
+	w->erase_pending = false;
+	w->error = false;
+
+	return erase_next(w);
+}
+
+
+uint32_t image_writer_put(struct image_writer *w, const void *data, uint32_t len)
+{
+	const uint8_t *_data = data;
+	uint32_t taken = 0, n;
+
+	if (w->error)
+		return 0;
+	if (len > w->max_len - w->len)
+	{
+		w->error = true;
+		return 0;
+	}
+
+	while (len)
+	{
+		// wait for image_writer_poll to finish with it
+		if (w->ready[w->fill])
+			break;
+
+		n = w->buf_size - w->fill_pos;
+		if (n > len)
+			n = len;
+		memcpy(w->buf[w->fill] + w->fill_pos, _data, n);
+		w->fill_pos += n;
+		_data += n;
+		len -= n;
+		taken += n;
+
+		// hand it over and start on the other one
+		if (w->fill_pos == w->buf_size)
+		{
+			w->ready_len[w->fill] = w->buf_size;
+			w->ready[w->fill] = true;
+			w->fill ^= 1;
+			w->fill_pos = 0;
+		}
+	}
+
+	w->len += taken;
+	return taken;
+}
+
+
+bool image_writer_poll(struct image_writer *w)
+{
+	uint32_t end, n;
+
+	if (w->error)
+		return false;
+
+	// the flash is busy until erase_async is done, then count what it erased
+	if (w->erase_pending)
+	{
+		if (w->erasing)
+			return true;
+		w->erase_pending = false;
+		if (!erase_done(w, w->erase_len))
+			return false;
+	}
+
+	// nothing to program so get ahead on the erasing (only as far as the image goes once it is known)
+	if (!w->ready[w->prog])
+	{
+		end = (w->image_len)? w->image_len: w->max_len;
+		if (w->erased < end && w->erased < w->written + IMAGE_WRITER_ERASE_AHEAD)
+			return erase_next(w);
+		return true;
+	}
+
+	if (w->prog_pos == 0 && !prog_start(w))
+		return false;
+
+	// next slice, making sure it is erased first
+	n = w->ready_len[w->prog] - w->prog_pos;
+	if (n > IMAGE_WRITER_SLICE)
+		n = IMAGE_WRITER_SLICE;
+	if (w->written + n > w->erased)
+		return erase_next(w);
+	if (!w->write(w->dst + w->written, w->buf[w->prog] + w->prog_pos, n))
+		return image_writer_fail(w);
+	w->written += n;
+	w->prog_pos += n;
+
+	// done with this buffer, image_writer_put can have it back
+	if (w->prog_pos == w->ready_len[w->prog])
+	{
+		w->prog_pos = 0;
+		w->ready[w->prog] = false;
+		w->prog ^= 1;
+	}
+	return true;
+}
+
+
+const void *image_writer_finish(struct image_writer *w)
+{
+	// hand over the last partial buffer
+	if (w->fill_pos && !w->error)
+	{
+		while (w->ready[w->fill])
+			if (!image_writer_poll(w))
+				return NULL;
+		w->ready_len[w->fill] = w->fill_pos;
+		w->ready[w->fill] = true;
+		w->fill_pos = 0;
+	}
+
+	// program the lot (and let an erase ahead finish, the flash is busy until it does)
+	while (w->ready[0] || w->ready[1] || w->erase_pending)
+		if (!image_writer_poll(w))
+			return NULL;
+
+	// the whole image must be there and match the header crc before it is made valid
+	if (w->error || w->len != w->image_len || w->written != w->image_len || w->image_crc != w->header_crc)
+		return NULL;
+	if (!w->write(w->dst, &w->header_crc, CRC_WORD))
+	{
+		w->error = true;
+		return NULL;
+	}
+
+	return w->dst;
+}
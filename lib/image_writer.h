@@ -0,0 +1,148 @@
+/**
+ * @file image_writer.h
+ *
+ * @brief stream a program image in to a flash slot as it arrives
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * The transport (uart, usb, spis callbacks etc) hands chunks of the image to
+ * image_writer_put which copies them in to one of 2 buffers. While one buffer
+ * fills the main loop calls image_writer_poll to program the other a slice at
+ * a time (so the transport interrupts still get in between slices) and to
+ * erase the slot ahead of the write pointer. The crc is worked out a buffer at
+ * a time and the crc word of the program header is held back until
+ * image_writer_finish has checked it, so a part written image never passes
+ * bootstrap_validate_prog.
+ *
+ * The flash is reached through the erase/write callbacks (nvm_erase and
+ * nvm_write on all the ports) so each erase is one page/sector and each write
+ * one slice, this works with the page erase of the f107x/f373 and the whole
+ * sector erase of the f4. The f4 sectors take 250ms to 2s to erase with the
+ * interrupts off in nvm_erase, so give it erase_async (nvm_erase_async) and
+ * image_writer_poll only starts each erase and carries on once the flash isr
+ * says it is done, the transport isrs keep running meanwhile as long as they
+ * are in ram (see nvm_erase_async).
+ *
+ * The image must be a whole program as made by scripts/add_header.py (plain,
+ * packed or delta), image_writer_finish does not fill in the header for you.
+ */
+
+#ifndef __IMAGE_WRITER__
+#define __IMAGE_WRITER__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+
+
+// the start of a program header as made by scripts/add_header.py, this is all
+// image_writer looks at (see bootstrap_prog_header in hal/<arch>/bootstrap.h)
+struct image_writer_header
+{
+	uint32_t crc;				// crc over header and program minus the crc word
+	uint32_t len;				// size of the header and program
+	uint8_t type;				// one of the program header types below
+};
+
+// same as BOOTSTRAP_PROG_HEADER, _LZ4 and _DELTA
+#define IMAGE_WRITER_TYPE_PLAIN 0x01
+#define IMAGE_WRITER_TYPE_LZ4 0x02
+#define IMAGE_WRITER_TYPE_DELTA 0x03
+
+// sizeof(bootstrap_prog_header), the first buffer must hold more than this
+#define IMAGE_WRITER_HEADER_LEN (24)
+
+
+// bytes programmed per write by image_writer_poll (interrupts are held off for this long)
+#ifndef IMAGE_WRITER_SLICE
+#define IMAGE_WRITER_SLICE (64)
+#endif
+
+// keep at least this much of the slot erased ahead of the write pointer
+#ifndef IMAGE_WRITER_ERASE_AHEAD
+#define IMAGE_WRITER_ERASE_AHEAD (4096)
+#endif
+
+
+struct image_writer
+{
+	// setup
+	uint8_t *dst;				// slot to write the image to (start of a flash page/sector)
+	uint32_t max_len;			// size of the slot
+	uint8_t *flash;				// start of the flash
+	uint32_t page_size;			// smallest erase (page or sector), dst must be a multiple of it from flash
+	uint8_t *buf[2];			// one fills while the other is programmed
+	uint32_t buf_size;			// size of each buffer in bytes (a multiple of 4)
+	struct crc_h *crc;			// crc setup the same as the bootstrap one (eg &stm32f4_crc_h)
+	uint32_t (*erase)(void *addr, uint32_t len); // eg nvm_erase (not used with erase_async)
+	bool (*erase_async)(void *addr, uint32_t len,	// eg nvm_erase_async, used instead of erase (may be NULL)
+		void (*complete)(void *addr, uint32_t len, void *param), void *param);
+	bool (*write)(void *dst, const void *src, uint32_t len); // eg nvm_write
+
+	// working
+	volatile bool ready[2];		// buffer is full and waiting to be programmed
+	uint32_t ready_len[2];		// bytes in a ready buffer
+	uint8_t fill;				// buffer image_writer_put is filling
+	uint32_t fill_pos;			// bytes in it
+	uint8_t prog;				// buffer image_writer_poll is programming
+	uint32_t prog_pos;			// bytes of it programmed
+	uint32_t len;				// bytes taken by image_writer_put
+	uint32_t image_len;			// len from the image header (0 until the first buffer is programmed)
+	uint32_t written;			// bytes of the slot programmed (counting the held back crc word)
+	uint32_t erased;			// bytes of the slot erased
+	volatile bool erasing;		// erase_async is running
+	volatile uint32_t erase_len; // bytes it erased (0 if it failed)
+	bool erase_pending;			// erase_async has been started and not yet counted in erased
+	uint32_t image_crc;			// crc of what has been programmed so far
+	uint32_t header_crc;		// crc word from the image header, programmed last
+	bool error;					// something went wrong, start again
+};
+
+
+/**
+ * @brief start writing a new image
+ * @param w image writer, the setup part must be filled in
+ * @note this erases the start of the slot (in the background with erase_async)
+ * so the first buffer can be programmed as soon as it is full. A dst that is not
+ * on a page_size boundary is refused, on the f4 one part way into a bigger
+ * sector fails its first erase as nvm_erase only takes whole sectors
+ * @return false if the setup is bad or the erase failed
+ */
+bool image_writer_start(struct image_writer *w);
+
+
+/**
+ * @brief take the next chunk of the image
+ * @param w image writer
+ * @param data next bytes of the image
+ * @param len number of bytes
+ * @note this only copies so it is fine to call from the transport isr
+ * @return number of bytes taken, less than len if both buffers are full (call
+ * image_writer_poll and try the rest again)
+ */
+uint32_t image_writer_put(struct image_writer *w, const void *data, uint32_t len);
+
+
+/**
+ * @brief do the next bit of flash work, program a slice of a full buffer or erase ahead
+ * @param w image writer
+ * @note call this from the main loop while the image comes in, with erase_async
+ * it does nothing until the running erase is done
+ * @return false if the image is bad or the flash failed (see w->error)
+ */
+bool image_writer_poll(struct image_writer *w);
+
+
+/**
+ * @brief program what is left, check the crc and write the crc word to finish the image
+ * @param w image writer
+ * @note call once all of the image has been passed to image_writer_put
+ * @return the new program (its bootstrap_prog_header), NULL if the image is
+ * incomplete, the crc does not match or the flash failed
+ */
+const void *image_writer_finish(struct image_writer *w);
+
+
+#endif
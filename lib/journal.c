@@ -0,0 +1,390 @@
+/**
+ * @file journal.c
+ *
+ * @brief append only journal in flash for high rate event and telemetry logs (see journal.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Each sector starts with a magic word, a sequence number and the sequence
+ * number inverted, all written in one go just after the erase, so a sector
+ * that was not properly started fails the check and is skipped. Blocks follow
+ * back to back, the header and records in one write then the commit word, so
+ * the commit is only there if everything before it made it. A block that does
+ * not check out (or anything but erased flash after the last good one) ends
+ * the sector and the next flush starts a new one rather than writing over it.
+ * A new sector is only started on the spare once it is erased, a power cut
+ * part way through the erase leaves it not blank and it is erased again.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include "journal.h"
+
+
+#define JOURNAL_MAGIC (0x314c4e4a)	// "JNL1"
+#define JOURNAL_COMMIT (0x54494d43)	// "CMIT"
+
+
+struct journal_sector
+{
+	uint32_t magic;			// JOURNAL_MAGIC
+	uint32_t seq;			// higher is newer (never 0)
+	uint32_t check;			// ~seq
+};
+
+
+static uint8_t *journal_sector_addr(struct journal_h *h, uint8_t n)
+{
+	return h->base + n * h->sector_size;
+}
+
+
+// bytes a record takes in a block
+static uint32_t journal_record_size(uint16_t len)
+{
+	return sizeof(struct journal_record) + ((len + 3) & ~0x03);
+}
+
+
+// bytes a block with len bytes of records takes in flash
+static uint32_t journal_block_size(uint32_t len)
+{
+	return sizeof(struct journal_block) + len + sizeof(uint32_t);
+}
+
+
+static bool journal_sector_valid(const struct journal_sector *sector)
+{
+	return sector->magic == JOURNAL_MAGIC && sector->seq != 0 && sector->check == ~sector->seq;
+}
+
+
+// length of the records in the block at pos if it is complete, 0 at the end of the sector
+static uint32_t journal_block_check(struct journal_h *h, const uint8_t *sector, uint32_t pos)
+{
+	const struct journal_block *block = (const struct journal_block *)(sector + pos);
+	uint32_t commit;
+
+	if (h->sector_size - pos < journal_block_size(0) || block->len == 0 || (block->len & 0x03) ||
+		block->len > h->sector_size - pos - journal_block_size(0))
+		return 0;
+	memcpy(&commit, sector + pos + sizeof(*block) + block->len, sizeof(commit));
+	if (commit != JOURNAL_COMMIT || block->crc != crc_buf(h->crc, block + 1, block->len, true))
+		return 0;
+	return block->len;
+}
+
+
+static bool journal_blank(const uint8_t *p, uint32_t len)
+{
+	while (len--)
+		if (*p++ != 0xff)
+			return false;
+	return true;
+}
+
+
+// find the end of the good blocks in the head sector
+static void journal_scan(struct journal_h *h)
+{
+	uint8_t *sector = journal_sector_addr(h, h->head);
+	uint32_t len;
+
+	h->pos = sizeof(struct journal_sector);
+	while ((len = journal_block_check(h, sector, h->pos)) != 0)
+		h->pos += journal_block_size(len);
+
+	// a block cut short, do not write over it
+	if (!journal_blank(sector + h->pos, h->sector_size - h->pos))
+		h->pos = h->sector_size;
+}
+
+
+static uint8_t journal_spare(struct journal_h *h)
+{
+	return (h->head + 1) % h->sectors;
+}
+
+
+// called when erase_async is done (from the flash isr)
+static void journal_erase_complete(void *addr, uint32_t len, void *param)
+{
+	struct journal_h *h = param;
+
+	h->erase_len = len;
+	h->erasing = false;
+}
+
+
+// erase the spare now (or wait for erase_async to finish it)
+static bool journal_spare_wait(struct journal_h *h)
+{
+	while (!h->spare_erased)
+		if (!journal_poll(h))
+			return false;
+	return true;
+}
+
+
+// make the spare sector the head
+static bool journal_next_sector(struct journal_h *h)
+{
+	uint8_t next = journal_spare(h);
+	uint32_t seq = (h->seq + 1)? h->seq + 1: 1;
+	struct journal_sector header = {JOURNAL_MAGIC, seq, ~seq};
+	uint8_t *sector = journal_sector_addr(h, next);
+
+	// journal_poll has not kept up so this flush has to do the erase
+	if (!h->spare_erased)
+	{
+		h->stalls++;
+		if (!journal_spare_wait(h))
+			return false;
+	}
+
+	if (!h->write(sector, &header, sizeof(header)))
+		return false;
+	h->head = next;
+	h->seq = seq;
+	h->pos = sizeof(header);
+	h->spare_erased = false;
+	return true;
+}
+
+
+bool journal_init(struct journal_h *h)
+{
+	const struct journal_sector *sector;
+	int16_t best = -1;
+	uint8_t n;
+
+	if (h->base == NULL || h->sectors < 2 || (h->sector_size & 0x03) || h->crc == NULL ||
+		h->buf == NULL || ((uintptr_t)h->buf & 0x03) || h->buf_size < sizeof(struct journal_block) + journal_record_size(0) ||
+		h->buf_size + sizeof(uint32_t) > h->sector_size - sizeof(struct journal_sector) ||
+		(h->erase == NULL && h->erase_async == NULL) || h->write == NULL)
+		return false;
+
+	// newest good sector (the compare copes with seq wrapping)
+	for (n = 0; n < h->sectors; n++)
+	{
+		sector = (const struct journal_sector *)journal_sector_addr(h, n);
+		if (!journal_sector_valid(sector))
+			continue;
+		if (best < 0 || (int32_t)(sector->seq - h->seq) > 0)
+		{
+			best = n;
+			h->seq = sector->seq;
+		}
+	}
+
+	h->fill = sizeof(struct journal_block);
+	h->lost = 0;
+	h->erasing = false;
+	h->erase_pending = false;
+	h->stalls = 0;
+	if (best < 0)
+	{
+		// nothing there yet so start at the first sector
+		h->head = h->sectors - 1;
+		h->seq = 0;
+		h->spare_erased = false;
+		return journal_spare_wait(h) && journal_next_sector(h);
+	}
+
+	h->head = best;
+	journal_scan(h);
+	h->spare_erased = journal_blank(journal_sector_addr(h, journal_spare(h)), h->sector_size);
+	return true;
+}
+
+
+bool journal_poll(struct journal_h *h)
+{
+	uint8_t *spare = journal_sector_addr(h, journal_spare(h));
+
+	if (h->spare_erased)
+		return true;
+
+	// check a background erase once it is done
+	if (h->erase_pending)
+	{
+		if (h->erasing)
+			return true;
+		h->erase_pending = false;
+		h->spare_erased = h->erase_len >= h->sector_size;
+		return h->spare_erased;
+	}
+
+	if (h->erase_async == NULL)
+	{
+		h->spare_erased = h->erase(spare, h->sector_size) >= h->sector_size;
+		return h->spare_erased;
+	}
+
+	h->erasing = true;
+	h->erase_pending = true;
+	if (!h->erase_async(spare, h->sector_size, journal_erase_complete, h))
+	{
+		h->erasing = false;
+		h->erase_pending = false;
+		return false;
+	}
+	return true;
+}
+
+
+bool journal_append(struct journal_h *h, uint16_t tag, const void *data, uint16_t len)
+{
+	struct journal_record *rec;
+	uint32_t size = journal_record_size(len);
+
+	if (sizeof(struct journal_block) + size > h->buf_size)
+		return false;
+	if (h->fill + size > h->buf_size && !journal_flush(h))
+		return false;
+
+	rec = (struct journal_record *)(h->buf + h->fill);
+	rec->len = len;
+	rec->tag = tag;
+	memcpy(rec + 1, data, len);
+
+	// pad like erased flash so the crc sees whole words
+	memset((uint8_t *)(rec + 1) + len, 0xff, size - sizeof(*rec) - len);
+	h->fill += size;
+	return true;
+}
+
+
+bool journal_flush(struct journal_h *h)
+{
+	struct journal_block *block = (struct journal_block *)h->buf;
+	uint32_t len = h->fill - sizeof(*block), commit = JOURNAL_COMMIT, n;
+	const struct journal_record *rec;
+	uint8_t *dst;
+
+	if (len == 0)
+		return true;
+
+	block->len = len;
+	block->crc = crc_buf(h->crc, block + 1, len, true);
+	if (journal_block_size(len) > h->sector_size - h->pos && !journal_next_sector(h))
+		goto fail;
+
+	// the flash can not be programmed while journal_poll's erase_async runs
+	while (h->erasing)
+	{}
+
+	// the records then the commit, so the commit is only there if they all are
+	dst = journal_sector_addr(h, h->head) + h->pos;
+	if (!h->write(dst, block, sizeof(*block) + len) ||
+		!h->write(dst + sizeof(*block) + len, &commit, sizeof(commit)))
+	{
+		// what is there now is unknown, move on next time
+		h->pos = h->sector_size;
+		goto fail;
+	}
+	h->pos += journal_block_size(len);
+	h->fill = sizeof(*block);
+	return true;
+
+fail:
+	n = sizeof(*block);
+	while (n < h->fill)
+	{
+		rec = (const struct journal_record *)(h->buf + n);
+		n += journal_record_size(rec->len);
+		h->lost++;
+	}
+	h->fill = sizeof(*block);
+	return false;
+}
+
+
+void journal_iter_start(struct journal_h *h, struct journal_iter *it)
+{
+	const struct journal_sector *sector;
+	int16_t oldest = -1;
+	uint8_t n;
+
+	// the oldest good sector, the ones after it are read in ring order up to the
+	// head (not the spare, it may be being erased)
+	for (n = 0; n < h->sectors; n++)
+	{
+		sector = (const struct journal_sector *)journal_sector_addr(h, n);
+		if (n == journal_spare(h) || !journal_sector_valid(sector) || (int32_t)(sector->seq - h->seq) > 0)
+			continue;
+		if (oldest < 0 || (int32_t)(sector->seq - it->seq) < 0)
+		{
+			oldest = n;
+			it->seq = sector->seq;
+		}
+	}
+
+	it->done = oldest < 0;
+	it->sector = oldest;
+	it->pos = sizeof(struct journal_sector);
+	it->block_end = it->pos;
+}
+
+
+const void *journal_next(struct journal_h *h, struct journal_iter *it, uint16_t *tag, uint16_t *len)
+{
+	const struct journal_sector *header;
+	const struct journal_record *rec;
+	uint8_t *sector;
+	uint32_t block_len;
+	bool bad;
+
+	while (!it->done)
+	{
+		sector = journal_sector_addr(h, it->sector);
+
+		// next record in this block
+		if (it->pos < it->block_end)
+		{
+			rec = (const struct journal_record *)(sector + it->pos);
+			it->pos += journal_record_size(rec->len);
+			if (it->pos >= it->block_end)
+			{
+				// past the commit word to the next block
+				bad = it->pos > it->block_end;
+				it->pos = it->block_end + sizeof(uint32_t);
+				it->block_end = it->pos;
+				if (bad)
+					continue;
+			}
+			if (tag != NULL)
+				*tag = rec->tag;
+			*len = rec->len;
+			return rec + 1;
+		}
+
+		// next block in this sector
+		block_len = journal_block_check(h, sector, it->pos);
+		if (block_len)
+		{
+			it->pos += sizeof(struct journal_block);
+			it->block_end = it->pos + block_len;
+			continue;
+		}
+
+		// next sector, skipping any that were not started properly
+		do
+		{
+			if (it->sector == h->head)
+			{
+				it->done = true;
+				return NULL;
+			}
+			it->sector = (it->sector + 1) % h->sectors;
+			header = (const struct journal_sector *)journal_sector_addr(h, it->sector);
+		} while (!journal_sector_valid(header) || (int32_t)(header->seq - it->seq) <= 0);
+		it->seq = header->seq;
+		it->pos = sizeof(struct journal_sector);
+		it->block_end = it->pos;
+	}
+	return NULL;
+}
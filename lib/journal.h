@@ -0,0 +1,161 @@
+/**
+ * @file journal.h
+ *
+ * @brief append only journal in flash for high rate event and telemetry logs
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Records are batched in a ram buffer and written to flash a block at a time,
+ * so each flush is one long nvm_write (close to the raw program rate) instead
+ * of a short write per record. A block is only trusted once the commit word
+ * after it is in, so a power loss part way through a flush loses that block
+ * and nothing before it. The sectors are used as a ring with the one after the
+ * head kept erased as a spare, when the head sector is full the spare becomes
+ * the new head and the oldest sector is erased to be the next spare (so the
+ * ring holds sectors - 1 of records).
+ *
+ * The flash is reached through the erase/write callbacks (nvm_erase and
+ * nvm_write on all the ports) and read directly, so it must be memory mapped.
+ * The spare is erased by journal_poll from the main loop (in the background
+ * with erase_async, eg nvm_erase_async on the f4), so a flush only ever
+ * programs. If journal_poll has not got the spare erased by the time the head
+ * fills the flush has to do it (see stalls).
+ */
+
+
+#ifndef __JOURNAL__
+#define __JOURNAL__
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+
+
+// what a record looks like in a block, followed by the data padded to a word
+struct journal_record
+{
+	uint16_t len;			// bytes of data
+	uint16_t tag;			// user record type
+};
+
+
+// what a block looks like in flash, followed by len bytes of records and the commit word
+struct journal_block
+{
+	uint32_t len;			// bytes of records (a whole number of words), erased at the end of a sector
+	uint32_t crc;			// crc of the records
+};
+
+
+struct journal_h
+{
+	// setup
+	uint8_t *base;			// first sector of the journal
+	uint32_t sector_size;	// bytes in each sector, a whole number of nvm erase pages/sectors
+	uint8_t sectors;		// number of sectors in the ring (at least 2, one is always the erased spare)
+	struct crc_h *crc;		// crc used to check the blocks (crc_init must have been called)
+	uint8_t *buf;			// ram batch buffer (word aligned)
+	uint32_t buf_size;		// bytes in buf, the most written per flush (less than a sector)
+	uint32_t (*erase)(void *addr, uint32_t len); // eg nvm_erase
+	bool (*erase_async)(void *addr, uint32_t len,	// eg nvm_erase_async, used by journal_poll instead of erase (may be NULL)
+		void (*complete)(void *addr, uint32_t len, void *param), void *param);
+	bool (*write)(void *dst, const void *src, uint32_t len); // eg nvm_write
+
+	// working
+	uint8_t head;			// sector being appended to
+	uint32_t seq;			// sequence number of the head sector (highest wins)
+	uint32_t pos;			// offset of the next block in the head sector
+	uint32_t fill;			// bytes used in buf (including the block header)
+	uint32_t lost;			// records dropped because a flush failed
+	bool spare_erased;		// the sector after the head is erased and ready to be the next head
+	volatile bool erasing;	// erase_async is running
+	volatile uint32_t erase_len; // bytes it erased
+	bool erase_pending;		// erase_async has been started and not yet checked
+	uint32_t stalls;		// flushes that had to erase the spare themselves (call journal_poll more often)
+};
+
+
+// where a reader is up to, see journal_iter_start
+struct journal_iter
+{
+	uint8_t sector;			// sector being read
+	uint32_t seq;			// its sequence number
+	uint32_t pos;			// offset of the next record in the sector
+	uint32_t block_end;		// offset of the end of the records in the current block
+	bool done;				// nothing more to read
+};
+
+
+/**
+ * @brief find the head sector and where the next block goes
+ * @param h journal handle, the setup part must be filled in
+ * @note an empty (or unreadable) journal is formatted, this erases the first
+ * sector, the spare is left to journal_poll
+ * @return false if the setup is bad or the flash could not be formatted
+ */
+bool journal_init(struct journal_h *h);
+
+
+/**
+ * @brief erase the spare sector ahead of the head if it needs it
+ * @param h journal handle
+ * @note call this from the main loop, it erases at most one sector (blocking
+ * with erase, or starts erase_async and checks it on a later call) and does
+ * nothing once the spare is erased
+ * @return false if the erase failed (it is tried again next time)
+ */
+bool journal_poll(struct journal_h *h);
+
+
+/**
+ * @brief add a record to the ram batch
+ * @param h journal handle
+ * @param tag user record type, given back by journal_next
+ * @param data record data
+ * @param len bytes of data
+ * @note if the batch is full it is flushed first
+ * @return false if the record can never fit in buf or the flush failed (the
+ * batch is dropped, see lost)
+ */
+bool journal_append(struct journal_h *h, uint16_t tag, const void *data, uint16_t len);
+
+
+/**
+ * @brief write the ram batch to flash as one block with its commit word
+ * @param h journal handle
+ * @note moves on to the spare sector if the block does not fit in the head
+ * sector, this only erases if journal_poll has not erased the spare yet (and
+ * waits for an erase_async that is still running, the flash can not be
+ * programmed until it is done)
+ * @return false if the flash failed (the batch is dropped, see lost)
+ */
+bool journal_flush(struct journal_h *h);
+
+
+/**
+ * @brief start reading from the oldest record in flash
+ * @param h journal handle
+ * @param it iterator to set up
+ * @note records still in the ram batch are not seen until they are flushed,
+ * nor are any left in the spare sector (it is about to be erased)
+ */
+void journal_iter_start(struct journal_h *h, struct journal_iter *it);
+
+
+/**
+ * @brief get the next record, oldest first
+ * @param h journal handle
+ * @param it iterator from journal_iter_start
+ * @param tag set to the record tag (may be NULL)
+ * @param len set to the bytes of data
+ * @note a block that does not check out ends its sector and the reader moves on
+ * to the next, the journal must not be written (flushed) while reading
+ * @return pointer to the record data in flash, NULL at the end
+ */
+const void *journal_next(struct journal_h *h, struct journal_iter *it, uint16_t *tag, uint16_t *len);
+
+
+#endif
@@ -0,0 +1,330 @@
+/**
+ * @file kv.c
+ *
+ * @brief small wear levelled key value store for settings in flash (see kv.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Each sector starts with a magic word, a sequence number and a commit word.
+ * The first two are written when a sector is started and the commit (the
+ * sequence number inverted) only once all the live records have been copied
+ * in, so the newest committed sector is always complete. An erase cut short
+ * can only set bits, so the header of a part erased sector either fails the
+ * check or still reads as the older sector it was (only ever an old sector is
+ * erased) and is never picked over the active one. Records are appended after
+ * it, header first, so a set cut short by a power loss leaves a record with a
+ * bad crc which ends the records (and the sector is treated as full so nothing
+ * is written over it).
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include "kv.h"
+
+
+#define KV_MAGIC (0x3153564b)	// "KVS1"
+#define KV_ERASED (0xffffffff)
+
+
+struct kv_sector
+{
+	uint32_t magic;			// KV_MAGIC
+	uint32_t seq;			// higher is newer (never 0)
+	uint32_t commit;		// ~seq once the sector is complete
+};
+
+
+static uint8_t *kv_sector_addr(struct kv_h *h, uint8_t n)
+{
+	return h->base + n * h->sector_size;
+}
+
+
+// bytes a record takes in flash
+static uint32_t kv_record_size(uint16_t len)
+{
+	if (len == KV_DELETED)
+		return sizeof(struct kv_record);
+	return sizeof(struct kv_record) + ((len + 3) & ~0x03);
+}
+
+
+// crc of the key/len word and the value with its last word padded like erased flash
+static uint32_t kv_record_crc(struct kv_h *h, uint16_t key, uint16_t len, const uint8_t *value)
+{
+	struct kv_record rec = {0, key, len};
+	uint32_t crc, tail = KV_ERASED, n;
+
+	crc = crc_buf(h->crc, &rec.key, sizeof(rec.key) + sizeof(rec.len), true);
+	if (len == KV_DELETED)
+		return crc;
+	n = len & ~0x03;
+	if (n)
+		crc = crc_buf(h->crc, value, n, false);
+	if (len & 0x03)
+	{
+		memcpy(&tail, value + n, len & 0x03);
+		crc = crc_buf(h->crc, &tail, sizeof(tail), false);
+	}
+	return crc;
+}
+
+
+static bool kv_blank(const uint8_t *p, uint32_t len)
+{
+	while (len--)
+		if (*p++ != 0xff)
+			return false;
+	return true;
+}
+
+
+// point the index at a new record for key (offset from base, 0 for none)
+static void kv_index_set(struct kv_h *h, uint16_t key, uint32_t offset)
+{
+	const struct kv_record *old;
+
+	if (h->index[key])
+	{
+		old = (const struct kv_record *)(h->base + h->index[key]);
+		h->live -= kv_record_size(old->len);
+	}
+	h->index[key] = offset;
+	if (offset)
+		h->live += kv_record_size(((const struct kv_record *)(h->base + offset))->len);
+}
+
+
+// build the index from the records in the active sector
+static void kv_scan(struct kv_h *h)
+{
+	uint8_t *sector = kv_sector_addr(h, h->active);
+	const struct kv_record *rec;
+	uint32_t size;
+
+	memset(h->index, 0, h->keys * sizeof(*h->index));
+	h->live = 0;
+	h->pos = sizeof(struct kv_sector);
+	while (h->sector_size - h->pos >= sizeof(struct kv_record))
+	{
+		rec = (const struct kv_record *)(sector + h->pos);
+		if (kv_blank((const uint8_t *)rec, sizeof(*rec)))
+			break;
+
+		// a record cut short, nothing after this can be trusted
+		size = kv_record_size(rec->len);
+		if (size > h->sector_size - h->pos || rec->crc != kv_record_crc(h, rec->key, rec->len, (const uint8_t *)(rec + 1)))
+		{
+			h->pos = h->sector_size;
+			return;
+		}
+
+		// keys past the end of the index are dropped
+		if (rec->key < h->keys)
+			kv_index_set(h, rec->key, (rec->len == KV_DELETED)? 0: sector + h->pos - h->base);
+		h->pos += size;
+	}
+
+	// part of a header may have gone in before the power went, do not write over it
+	if (!kv_blank(sector + h->pos, h->sector_size - h->pos))
+		h->pos = h->sector_size;
+}
+
+
+// erase sector n and start it with seq (it is not marked complete yet)
+static bool kv_start_sector(struct kv_h *h, uint8_t n, uint32_t seq)
+{
+	struct kv_sector header = {KV_MAGIC, seq, KV_ERASED};
+	uint8_t *sector = kv_sector_addr(h, n);
+
+	if (h->erase(sector, h->sector_size) < h->sector_size)
+		return false;
+	return h->write(sector, &header, offsetof(struct kv_sector, commit));
+}
+
+
+static bool kv_commit_sector(struct kv_h *h, uint8_t n, uint32_t seq)
+{
+	uint32_t commit = ~seq;
+
+	return h->write(kv_sector_addr(h, n) + offsetof(struct kv_sector, commit), &commit, sizeof(commit));
+}
+
+
+static bool kv_sector_valid(const struct kv_sector *sector)
+{
+	return sector->magic == KV_MAGIC && sector->seq != 0 && sector->commit == ~sector->seq;
+}
+
+
+// move the live records to the next sector so there is room for need more bytes
+static bool kv_gc(struct kv_h *h, uint32_t need)
+{
+	uint8_t next = (h->active + 1) % h->sectors;
+	uint8_t *sector = kv_sector_addr(h, next);
+	const struct kv_record *rec;
+	uint32_t pos = sizeof(struct kv_sector), size;
+	uint32_t seq = (h->seq + 1)? h->seq + 1: 1;
+	uint16_t key;
+
+	if (h->live + need > h->sector_size - sizeof(struct kv_sector))
+		return false;
+
+	// copy the live records as they are (the crc does not depend on where they are)
+	if (!kv_start_sector(h, next, seq))
+		return false;
+	for (key = 0; key < h->keys; key++)
+	{
+		if (h->index[key] == 0)
+			continue;
+		rec = (const struct kv_record *)(h->base + h->index[key]);
+		size = kv_record_size(rec->len);
+		if (!h->write(sector + pos, rec, size))
+			return false;
+		pos += size;
+	}
+	if (!kv_commit_sector(h, next, seq))
+		return false;
+
+	// only now the new sector is the real one move the index over
+	pos = sizeof(struct kv_sector);
+	for (key = 0; key < h->keys; key++)
+	{
+		if (h->index[key] == 0)
+			continue;
+		rec = (const struct kv_record *)(h->base + h->index[key]);
+		h->index[key] = sector + pos - h->base;
+		pos += kv_record_size(rec->len);
+	}
+	h->active = next;
+	h->seq = seq;
+	h->pos = pos;
+	h->gc_count++;
+	return true;
+}
+
+
+static bool kv_append(struct kv_h *h, uint16_t key, const void *buf, uint16_t len)
+{
+	struct kv_record rec;
+	uint32_t size = kv_record_size(len);
+	uint8_t *dst;
+
+	if (size > h->sector_size - h->pos && !kv_gc(h, size))
+		return false;
+
+	rec.crc = kv_record_crc(h, key, len, buf);
+	rec.key = key;
+	rec.len = len;
+	dst = kv_sector_addr(h, h->active) + h->pos;
+
+	// the header goes first so a power loss before the value is in leaves a bad crc
+	if (!h->write(dst, &rec, sizeof(rec)) ||
+		(len != KV_DELETED && len && !h->write(dst + sizeof(rec), buf, len)))
+	{
+		// what is there now is unknown, move on next time
+		h->pos = h->sector_size;
+		return false;
+	}
+	kv_index_set(h, key, (len == KV_DELETED)? 0: dst - h->base);
+	h->pos += size;
+	return true;
+}
+
+
+bool kv_init(struct kv_h *h)
+{
+	const struct kv_sector *sector;
+	int16_t best = -1;
+	uint8_t n;
+
+	if (h->base == NULL || h->sectors < 2 || (h->sector_size & 0x03) ||
+		h->sector_size < sizeof(struct kv_sector) + sizeof(struct kv_record) ||
+		h->crc == NULL || h->index == NULL || h->keys == 0 || h->erase == NULL || h->write == NULL)
+		return false;
+
+	// newest complete sector (the compare copes with seq wrapping)
+	for (n = 0; n < h->sectors; n++)
+	{
+		sector = (const struct kv_sector *)kv_sector_addr(h, n);
+		if (!kv_sector_valid(sector))
+			continue;
+		if (best < 0 || (int32_t)(sector->seq - h->seq) > 0)
+		{
+			best = n;
+			h->seq = sector->seq;
+		}
+	}
+
+	h->gc_count = 0;
+	if (best < 0)
+	{
+		// nothing there yet so format it
+		h->active = 0;
+		h->seq = 1;
+		memset(h->index, 0, h->keys * sizeof(*h->index));
+		h->live = 0;
+		h->pos = sizeof(struct kv_sector);
+		return kv_start_sector(h, 0, h->seq) && kv_commit_sector(h, 0, h->seq);
+	}
+
+	h->active = best;
+	kv_scan(h);
+	return true;
+}
+
+
+const void *kv_ptr(struct kv_h *h, uint16_t key, uint16_t *len)
+{
+	const struct kv_record *rec;
+
+	if (key >= h->keys || h->index[key] == 0)
+		return NULL;
+	rec = (const struct kv_record *)(h->base + h->index[key]);
+	if (len != NULL)
+		*len = rec->len;
+	return rec + 1;
+}
+
+
+int32_t kv_get(struct kv_h *h, uint16_t key, void *buf, uint16_t len)
+{
+	const void *value;
+	uint16_t value_len;
+
+	value = kv_ptr(h, key, &value_len);
+	if (value == NULL)
+		return -1;
+	memcpy(buf, value, (len < value_len)? len: value_len);
+	return value_len;
+}
+
+
+bool kv_set(struct kv_h *h, uint16_t key, const void *buf, uint16_t len)
+{
+	const void *value;
+	uint16_t value_len;
+
+	if (key >= h->keys || len == KV_DELETED)
+		return false;
+
+	// already set to this, save the flash
+	value = kv_ptr(h, key, &value_len);
+	if (value != NULL && value_len == len && memcmp(value, buf, len) == 0)
+		return true;
+
+	return kv_append(h, key, buf, len);
+}
+
+
+bool kv_del(struct kv_h *h, uint16_t key)
+{
+	if (key >= h->keys)
+		return false;
+	if (h->index[key] == 0)
+		return true;
+	return kv_append(h, key, NULL, KV_DELETED);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file kv.h
+ *
+ * @brief small wear levelled key value store for settings in flash
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Values are appended to the active sector as crc protected records and a
+ * ram index (one word per key) points at the newest record for each key, so a
+ * get is a single look up. When the active sector is full the live records
+ * are copied to the next sector (the sectors are used round robin so they wear
+ * evenly) which is only marked in use once the copy is done. If power is lost
+ * part way through a set or a copy the store comes back with the last value
+ * that was completely written.
+ *
+ * The flash is reached through the erase/write callbacks (nvm_erase and
+ * nvm_write on all the ports) and read directly, so it must be memory mapped.
+ */
+
+
+#ifndef __KV__
+#define __KV__
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "crc.h"
+
+
+// len of a delete record
+#define KV_DELETED 0xffff
+
+
+// what a record looks like in flash, followed by the value padded to a word
+struct kv_record
+{
+	uint32_t crc;			// crc of key, len and the padded value
+	uint16_t key;			// 0xffff means erased, the end of the records
+	uint16_t len;			// bytes in the value, KV_DELETED if the key was deleted
+};
+
+
+struct kv_h
+{
+	// setup
+	uint8_t *base;			// first sector of the store
+	uint32_t sector_size;	// bytes in each sector, a whole number of nvm erase pages/sectors
+	uint8_t sectors;		// number of sectors in the store (at least 2)
+	struct crc_h *crc;		// crc used to check the records (crc_init must have been called)
+	uint32_t *index;		// ram index, one word per key
+	uint16_t keys;			// number of words in index, keys go from 0 to keys - 1
+	uint32_t (*erase)(void *addr, uint32_t len); // eg nvm_erase
+	bool (*write)(void *dst, const void *src, uint32_t len); // eg nvm_write
+
+	// working
+	uint8_t active;			// sector being appended to
+	uint32_t pos;			// offset of the next record in the active sector
+	uint32_t seq;			// sequence number of the active sector (highest wins)
+	uint32_t live;			// bytes of live records (what a copy to a new sector needs)
+	uint32_t gc_count;		// number of times the live records have been moved to a new sector
+};
+
+
+/**
+ * @brief find the newest complete sector and build the index from it
+ * @param h kv handle, the setup part must be filled in
+ * @note an empty (or unreadable) store is formatted
+ * @return false if the setup is bad or the flash could not be formatted
+ */
+bool kv_init(struct kv_h *h);
+
+
+/**
+ * @brief look up a value
+ * @param h kv handle
+ * @param key key to look up
+ * @param len set to the number of bytes in the value (may be NULL)
+ * @return pointer to the value in flash, NULL if the key is not set
+ */
+const void *kv_ptr(struct kv_h *h, uint16_t key, uint16_t *len);
+
+
+/**
+ * @brief copy a value out
+ * @param h kv handle
+ * @param key key to look up
+ * @param buf where to copy the value
+ * @param len size of buf, at most this many bytes are copied
+ * @return number of bytes in the value (may be more than len), -1 if the key is not set
+ */
+int32_t kv_get(struct kv_h *h, uint16_t key, void *buf, uint16_t len);
+
+
+/**
+ * @brief set a value
+ * @param h kv handle
+ * @param key key to set
+ * @param buf value
+ * @param len number of bytes in the value (less than KV_DELETED)
+ * @note nothing is written if the value is already set to this, if the active
+ * sector is full this copies the live records to the next sector first
+ * @return false if the key is out of range, the live values no longer fit in
+ * a sector or the flash failed
+ */
+bool kv_set(struct kv_h *h, uint16_t key, const void *buf, uint16_t len);
+
+
+/**
+ * @brief remove a value
+ * @param h kv handle
+ * @param key key to remove
+ * @return false if the flash failed
+ */
+bool kv_del(struct kv_h *h, uint16_t key);
+
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file lz4.c
+ *
+ * @brief small lz4 block decoder (see lz4.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * A block is a list of sequences, each is a token byte (literal count in the
+ * top nibble, match length - 4 in the bottom), the literals, then a 16 bit
+ * little endian offset back in to the output to copy the match from. A nibble
+ * of 15 means more length bytes follow (added until one is not 255). The
+ * last sequence is literals only.
+ */
+
+
+#include "lz4.h"
+
+
+#define LZ4_MIN_MATCH	(4)
+
+
+static bool lz4_flush(struct lz4_h *h)
+{
+	uint8_t *dst = h->dst + h->len - h->pos;
+	uint32_t n = h->pos;
+
+	h->pos = 0;
+	if (n == 0)
+		return true;
+	return h->flush(h, dst, h->buf, n);
+}
+
+
+// output byte n, from buf if it has not been flushed yet
+static inline uint8_t lz4_get(struct lz4_h *h, uint32_t n)
+{
+	uint32_t flushed = h->len - h->pos;
+
+	if (n < flushed)
+		return h->dst[n];
+	return h->buf[n - flushed];
+}
+
+
+static inline bool lz4_put(struct lz4_h *h, uint8_t b)
+{
+	h->buf[h->pos++] = b;
+	h->len++;
+	if (h->pos == h->buf_size)
+		return lz4_flush(h);
+	return true;
+}
+
+
+// read a length, nibble 15 means keep adding bytes until one is not 255
+static bool lz4_len(const uint8_t **src, const uint8_t *end, uint32_t *len)
+{
+	uint8_t b;
+
+	if (*len != 15)
+		return true;
+
+	do
+	{
+		if (*src >= end)
+			return false;
+		b = *(*src)++;
+		*len += b;
+	} while (b == 255);
+
+	return true;
+}
+
+
+int32_t lz4_unpack(struct lz4_h *h, const void *src, uint32_t len)
+{
+	const uint8_t *_src = src;
+	const uint8_t *end = _src + len;
+	uint32_t lit, match, offset, n;
+	uint8_t token;
+
+	h->len = 0;
+	h->pos = 0;
+
+	while (_src < end)
+	{
+		token = *_src++;
+
+		// literals (copied straight in to buf a chunk at a time)
+		lit = token >> 4;
+		if (!lz4_len(&_src, end, &lit) || lit > (uint32_t)(end - _src) || lit > h->max_len - h->len)
+			return -1;
+		while (lit)
+		{
+			n = h->buf_size - h->pos;
+			if (n > lit)
+				n = lit;
+			lit -= n;
+			h->len += n;
+			while (n--)
+				h->buf[h->pos++] = *_src++;
+			if (h->pos == h->buf_size && !lz4_flush(h))
+				return -1;
+		}
+
+		// the last sequence has no match
+		if (_src == end)
+			break;
+
+		// match
+		if (end - _src < 2)
+			return -1;
+		offset = _src[0] | (_src[1] << 8);
+		_src += 2;
+		match = token & 0x0f;
+		if (!lz4_len(&_src, end, &match))
+			return -1;
+		match += LZ4_MIN_MATCH;
+		if (offset == 0 || offset > h->len || match > h->max_len - h->len)
+			return -1;
+
+		// byte at a time as the match can overlap what it is writing
+		n = h->len - offset;
+		while (match--)
+			if (!lz4_put(h, lz4_get(h, n++)))
+				return -1;
+	}
+
+	if (!lz4_flush(h))
+		return -1;
+	return h->len;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file lz4.h
+ *
+ * @brief small lz4 block decoder for unpacking compressed programs and data
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Only the lz4 block format is handled (no frame header, see lib/lz4.py for
+ * the matching compressor). The output is staged in a caller supplied buffer
+ * and handed to a flush callback a buffer at a time, so it can go straight in
+ * to flash. Matches copy from earlier output so anything already flushed must
+ * be readable at dst (true for flash and ram).
+ */
+
+
+#ifndef __LZ4__
+#define __LZ4__
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+struct lz4_h
+{
+	// setup
+	uint8_t *dst;			// where the output ends up
+	uint32_t max_len;		// most bytes the output can take
+	uint8_t *buf;			// output is staged here until it is flushed
+	uint32_t buf_size;		// size of buf in bytes (a multiple of 4 keeps every flush but the last whole words)
+	bool (*flush)(struct lz4_h *h, uint8_t *dst, const uint8_t *buf, uint32_t len); // put len bytes of output at dst, false to stop
+	void *param;			// anything the flush callback needs
+
+	// working
+	uint32_t len;			// bytes unpacked so far
+	uint32_t pos;			// bytes waiting in buf
+};
+
+
+/**
+ * @brief unpack a lz4 block
+ * @param h lz4 handle, the setup part must be filled in
+ * @param src lz4 block to unpack
+ * @param len size of the lz4 block in bytes
+ * @note flush is called each time buf fills and once more at the end with
+ * whatever is left, dst goes up by buf_size each time
+ * @return number of bytes unpacked, or -1 if the block is corrupt, bigger than
+ * max_len or flush failed
+ */
+int32_t lz4_unpack(struct lz4_h *h, const void *src, uint32_t len);
+
+
+#endif
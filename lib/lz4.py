@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+
+# lz4 block compressor for packing mos programs, this is the host side of
+# lib/lz4.c so only the block format is done (no frame header). It is a
+# plain greedy compressor, slow but fine for program sized images.
+#
+# usage: lz4.py [-d] <in> <out>
+
+import sys
+
+MIN_MATCH = 4
+MAX_OFFSET = 0xffff
+LAST_LITERALS = 5	# the last 5 bytes are always literals
+MF_LIMIT = 12		# and the last match starts at least 12 bytes from the end
+
+
+def _put_len(out, n):
+	''' extra length bytes for a nibble of 15 '''
+	n -= 15
+	while n >= 255:
+		out.append(255)
+		n -= 255
+	out.append(n)
+
+
+def _put_sequence(out, lit, match, offset):
+	''' add a sequence, match == 0 for the last one (literals only) '''
+	token = min(len(lit), 15) << 4
+	if match:
+		token |= min(match - MIN_MATCH, 15)
+	out.append(token)
+	if len(lit) >= 15:
+		_put_len(out, len(lit))
+	out += lit
+	if match:
+		out.append(offset & 0xff)
+		out.append(offset >> 8)
+		if match - MIN_MATCH >= 15:
+			_put_len(out, match - MIN_MATCH)
+
+
+def compress(data):
+	''' compress data to a lz4 block, returns a bytearray '''
+	data = bytearray(data)
+	out = bytearray()
+	last = {} # last place each 4 byte string was seen
+	limit = len(data) - MF_LIMIT
+	end = len(data) - LAST_LITERALS
+	anchor = 0
+	i = 0
+	while i < limit:
+		key = bytes(data[i:i + MIN_MATCH])
+		ref = last.get(key)
+		last[key] = i
+		if ref is None or i - ref > MAX_OFFSET:
+			i += 1
+			continue
+
+		# grow the match as far as it goes
+		m = MIN_MATCH
+		while i + m < end and data[ref + m] == data[i + m]:
+			m += 1
+		_put_sequence(out, data[anchor:i], m, i - ref)
+
+		# remember the strings inside the match too
+		for k in range(i + 1, min(i + m, limit)):
+			last[bytes(data[k:k + MIN_MATCH])] = k
+		i += m
+		anchor = i
+
+	_put_sequence(out, data[anchor:], 0, 0)
+	return out
+
+
+def decompress(data, max_len=None):
+	''' unpack a lz4 block (same checks as lz4_unpack), returns a bytearray '''
+	data = bytearray(data)
+	out = bytearray()
+	i = 0
+
+	while i < len(data):
+		token = data[i]
+		i += 1
+
+		lit = token >> 4
+		if lit == 15:
+			while True:
+				b = data[i]
+				i += 1
+				lit += b
+				if b != 255:
+					break
+		if i + lit > len(data):
+			raise ValueError('lz4 literals run past the end of the block')
+		out += data[i:i + lit]
+		i += lit
+		if i == len(data):
+			break
+
+		offset = data[i] | (data[i + 1] << 8)
+		i += 2
+		match = token & 0x0f
+		if match == 15:
+			while True:
+				b = data[i]
+				i += 1
+				match += b
+				if b != 255:
+					break
+		match += MIN_MATCH
+		if offset == 0 or offset > len(out):
+			raise ValueError('lz4 match offset out of range')
+		for k in range(match):
+			out.append(out[-offset])
+
+	if max_len is not None and len(out) > max_len:
+		raise ValueError('lz4 block unpacks to more than %d bytes' % max_len)
+	return out
+
+
+if __name__ == '__main__':
+	args = sys.argv[1:]
+	unpack = '-d' in args
+	if unpack:
+		args.remove('-d')
+	if len(args) != 2:
+		sys.exit('usage: %s [-d] <in> <out>' % sys.argv[0])
+	data = open(args[0], 'rb').read()
+	data = decompress(data) if unpack else compress(data)
+	open(args[1], 'wb').write(data)
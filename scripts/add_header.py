@@ -10,9 +10,15 @@ except ImportError:
     from io import StringIO
 sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'lib'))
 import crc
+import lz4
+import delta
 from argparse import *
 
 header_format = '<LLBLBLLH'
+lz4_header_format = '<LLL'
+delta_header_format = '<LLLLL'
+PROG_HEADER_LZ4 = 0x02
+PROG_HEADER_DELTA = 0x03
 global header_addr
 
 def ih2header(ih):
@@ -37,6 +43,8 @@ parser = ArgumentParser('add_header.py read a mos header, update it with given p
 parser.add_argument('-p', '--pid', type=auto_int, help='option to change the pid for this program')
 parser.add_argument('-k', '--key', type=auto_int, help='option to change the key for this program')
 parser.add_argument('--hw', type=auto_int, help='option to change the hardware id for this program')
+parser.add_argument('-z', '--compress', type=auto_int, metavar='ADDR', help='option to store this program lz4 packed at ADDR, the bootstrap unpacks it to where it was linked (its slot must start on a flash page/sector)')
+parser.add_argument('-d', '--delta', nargs=2, metavar=('BASE', 'ADDR'), help='option to store this program at ADDR as a delta against BASE (a hex file already through add_header.py and on the target), the bootstrap rebuilds it where it was linked (which must not be where BASE is)')
 parser.add_argument('filename', nargs=1, help='mandatory hex file to read header data from')
 args = parser.parse_args()
 filename = args.filename[0]
@@ -64,14 +72,54 @@ header['len'] = l
 prog = header2ih(prog, header) # put the length back into the intel hex file for crc
 
 # update the header crc (note we do no include the CRC word in the CRC)
-crc_start_addr = prog.minaddr() + 4
-prog.padding = 0xff
-buf = prog.tobinstr(start=crc_start_addr)
-crc.crc_init(crc.stm32f10x_crc_h)
-crc = crc.crc_buf(crc.stm32f10x_crc_h, buf, len(buf)) & 0xffffffff
-header['crc'] = crc
+def prog_crc(prog):
+	crc_start_addr = prog.minaddr() + 4
+	prog.padding = 0xff
+	buf = prog.tobinstr(start=crc_start_addr)
+	crc.crc_init(crc.stm32f10x_crc_h)
+	return crc.crc_buf(crc.stm32f10x_crc_h, buf, len(buf)) & 0xffffffff
+header['crc'] = prog_crc(prog)
 prog = header2ih(prog, header) # put the crc back into the intel hex file so we can write it out
 
+# optionally pack it, the packed program is its own program with a header
+# saying where to unpack the original to (see bootstrap_lz4_header)
+if args.compress != None:
+	raw = prog.tobinstr(start=prog.minaddr())
+	packed = lz4.compress(raw)
+	if lz4.decompress(packed) != bytearray(raw):
+		sys.exit("lz4 round trip failed")
+	lz4_header = struct.pack(lz4_header_format, prog.minaddr(), header['len'], header['crc'])
+	header['type'] = PROG_HEADER_LZ4
+	header['len'] = struct.calcsize(header_format) + len(lz4_header) + len(packed)
+	header_addr = args.compress
+	prog = IntelHex()
+	prog.puts(header_addr, struct.pack(header_format, *header.values()) + lz4_header + bytes(packed))
+	header['crc'] = prog_crc(prog)
+	prog = header2ih(prog, header)
+	sys.stderr.write("packed %d bytes to %d (%d%%)\n" % (len(raw), header['len'], 100 * header['len'] // len(raw)))
+
+# optionally store it as a delta against a program already on the target, the
+# delta is its own program with a header saying what to rebuild and from what
+# (see bootstrap_delta_header)
+elif args.delta != None:
+	base = IntelHex(args.delta[0])
+	base.padding = 0xff
+	base_raw = base.tobinstr(start=base.minaddr())
+	base_crc = struct.unpack('<L', base_raw[0:4])[0]
+	raw = prog.tobinstr(start=prog.minaddr())
+	ops = delta.diff(base_raw, raw)
+	if delta.patch(base_raw, ops) != bytearray(raw):
+		sys.exit("delta round trip failed")
+	delta_header = struct.pack(delta_header_format, prog.minaddr(), header['len'], header['crc'], base.minaddr(), base_crc)
+	header['type'] = PROG_HEADER_DELTA
+	header['len'] = struct.calcsize(header_format) + len(delta_header) + len(ops)
+	header_addr = auto_int(args.delta[1])
+	prog = IntelHex()
+	prog.puts(header_addr, struct.pack(header_format, *header.values()) + delta_header + bytes(ops))
+	header['crc'] = prog_crc(prog)
+	prog = header2ih(prog, header)
+	sys.stderr.write("delta of %d bytes is %d (%d%%)\n" % (len(raw), header['len'], 100 * header['len'] // len(raw)))
+
 # write header back to hex file
 prog.write_hex_file(sys.stdout)
 
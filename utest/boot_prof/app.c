@@ -0,0 +1,72 @@
+/**
+ * @file app.c
+ *
+ * @brief boot profiler unit test (application started by the bootstrap)
+ *
+ * Collect the boot profile, the bootstrap stages followed by this apps own
+ * sys_init, in to boot_prof_dump for debug_boot_prof_utest.gdbinit to print
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <hal.h>
+#include <string.h>
+
+// program header for bootstrap
+extern void *g_pfnVectors;
+struct bootstrap_prog_header app_program_header at_symbol(".program_header") = 
+{
+	.type = BOOTSTRAP_PROG_HEADER,
+	.pid = 1,
+	.isr_vector = &g_pfnVectors,
+	.max_len = (8 * 1024),	// copied from linker script (yuk, surely it can fill this in for me somehow)
+	.hw_id = BOOTSTRAP_PROG_HEADER_HW_ID,
+};
+
+struct
+{
+	const char *stage;
+	uint32_t cycles;
+} boot_prof_dump[BOOTSTRAP_PROF_SAMPLES];
+int boot_prof_stages = 0;
+uint32_t boot_prof_total = 0;
+char boot_prof_result = 'f';
+
+
+// somewhere for the debugger to stop
+void __attribute__((noinline)) boot_prof_done(void)
+{
+	__asm volatile ("nop");
+}
+
+
+int main(void)
+{
+	int n;
+
+	sys_init();
+	bootstrap_prof_mark("app");
+
+	// grab the whole profile
+	boot_prof_stages = bootstrap_prof_count();
+	for (n = 0; n < boot_prof_stages; n++)
+	{
+		if (!bootstrap_prof_get(n, &boot_prof_dump[n].stage, &boot_prof_dump[n].cycles))
+			break;
+		boot_prof_total += boot_prof_dump[n].cycles;
+	}
+
+	// it should start in the bootstrap and end here
+	if (n == boot_prof_stages && n > 2 &&
+		strcmp(boot_prof_dump[0].stage, "start") == 0 &&
+		strcmp(boot_prof_dump[n - 1].stage, "app") == 0)
+		boot_prof_result = 'p';
+	boot_prof_done();
+
+	while (1)
+	{}
+	return 0;
+}
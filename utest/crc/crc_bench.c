@@ -0,0 +1,274 @@
+/**
+ * @file crc_bench.c
+ *
+ * @brief benchmark and cross check every crc method over the model catalogue
+ * and a sweep of buffer sizes (make bench, or EMBEDDED=1 make bench on target)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * Each model in lib/crc_models.def is run through every method crc_init will
+ * give it for sizes from 4B to BENCH_MAX_LEN. Every method must match the soft
+ * method at every size and give the catalogue check value for "123456789".
+ *
+ * Timing is in cpu cycles, the DWT cycle counter on target and the time stamp
+ * counter on x86 hosts (other hosts fall back to ns so read bytes/cycle as
+ * bytes/ns). On the host the results are printed, on target break on
+ * bench_done and look at bench_cycles and bench_fails (see debug_crc_bench.gdbinit).
+ */
+
+
+#include <crc.h>
+#ifdef EMBEDDED
+#include <hal.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef PRINT_RESULT
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+#if !defined EMBEDDED && defined __x86_64__
+#include <x86intrin.h>
+#elif !defined EMBEDDED
+#include <time.h>
+#endif
+
+
+#ifndef BENCH_MAX_LEN
+#ifdef EMBEDDED
+#define BENCH_MAX_LEN (128*1024)	// crc straight out of flash, every part has at least this much
+#else
+#define BENCH_MAX_LEN (16*1024*1024)	// well past the caches, where the folding methods pull ahead
+#endif
+#endif
+
+// small sizes are repeated until at least this many bytes are crc'd so the timing means something
+#ifndef BENCH_MIN_BYTES
+#ifdef EMBEDDED
+#define BENCH_MIN_BYTES (4*1024)
+#else
+#define BENCH_MIN_BYTES (256*1024)
+#endif
+#endif
+
+#define BENCH_SIZES (12)	// 4B, 16B, 64B ... 16MB (stops at BENCH_MAX_LEN)
+
+
+struct bench_model
+{
+	const char *name;
+	cm_t cm;
+	uint32_t check;
+};
+
+#define CRC_MODEL(name, width, poly, init, refin, refot, xorot, check) \
+	{#name, {width, poly, init, refin, refot, xorot, 0}, check},
+static const struct bench_model models[] =
+{
+#include "crc_models.def"
+};
+#undef CRC_MODEL
+#define BENCH_MODELS (sizeof(models) / sizeof(models[0]))
+
+static const struct
+{
+	const char *name;
+	int method;
+} methods[] =
+{
+	{"soft",		CRC_METHOD_SOFT},	// must be first, the others are checked against it
+	{"table_8w",	CRC_METHOD_TABLE_8W},
+	{"table_16w",	CRC_METHOD_TABLE_16W},
+	{"table_32w",	CRC_METHOD_TABLE_32W},
+	{"hard",		CRC_METHOD_HARD},
+};
+#define BENCH_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+
+// results, cycles per crc (0 if the method does not apply to the model)
+uint32_t bench_cycles[BENCH_MODELS][BENCH_METHODS][BENCH_SIZES];
+uint32_t bench_fails = 0;
+
+static uint32_t table[4*256];
+
+
+#ifdef EMBEDDED
+// dwt registers (not all the cmsis versions we use define these)
+#define DWT_CTRL	(*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT	(*(volatile uint32_t *)0xE0001004)
+#define DEMCR		(*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA	(1 << 24)
+#define DWT_CTRL_CYCCNTENA	(1 << 0)
+#endif
+
+
+static void bench_cycles_init(void)
+{
+	#ifdef EMBEDDED
+	DEMCR |= DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	#endif
+}
+
+
+static uint64_t bench_now(void)
+{
+	#if defined EMBEDDED
+	return DWT_CYCCNT;
+	#elif defined __x86_64__
+	return __rdtsc();
+	#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+	#endif
+}
+
+
+static uint32_t bench_size(int k)
+{
+	return 4ul << (2*k);
+}
+
+
+// setup h for model m with the given method, false if crc_init gave it a different method
+static bool bench_init(struct crc_h *h, int m, int method)
+{
+	h->cm = models[m].cm;
+	h->table = table;
+	h->table_size = sizeof(table);
+	h->method = method;
+	crc_init(h);
+	return h->method == method;
+}
+
+
+// time one model/method over all the sizes and check the results against ref
+static void bench_run(int m, int k, const void *buf, uint32_t *ref)
+{
+	struct crc_h h;
+	uint64_t t;
+	uint32_t len, reps, n, crc = 0;
+	int s;
+
+	if (!bench_init(&h, m, methods[k].method))
+		return;
+
+	// catalogue check value
+	crc_update(&h, "123456789", 9);
+	if (crc_final(&h) != models[m].check)
+		bench_fails++;
+
+	for (s = 0; s < BENCH_SIZES && bench_size(s) <= BENCH_MAX_LEN; s++)
+	{
+		len = bench_size(s);
+		reps = (len < BENCH_MIN_BYTES)? BENCH_MIN_BYTES / len: 1;
+
+		t = bench_now();
+		for (n = 0; n < reps; n++)
+			crc = crc_buf(&h, buf, len, true);
+		t = bench_now() - t;
+		bench_cycles[m][k][s] = (uint32_t)(t / reps);
+		if (bench_cycles[m][k][s] == 0)
+			bench_cycles[m][k][s] = 1;
+
+		// soft is the reference for everything else
+		if (k == 0)
+			ref[s] = crc;
+		else if (crc != ref[s])
+			bench_fails++;
+	}
+}
+
+
+#ifdef PRINT_RESULT
+static void bench_print(int m)
+{
+	struct crc_h h;
+	int k, s;
+
+	printf("%s (check 0x%.*lX)\n", models[m].name, (models[m].cm.cm_width + 3) / 4, (unsigned long)models[m].check);
+	printf("%10s", "bytes");
+	for (k = 0; k < BENCH_METHODS; k++)
+		if (bench_cycles[m][k][0])
+			printf("%12s", methods[k].name);
+	printf("   (bytes/cycle)\n");
+
+	for (s = 0; s < BENCH_SIZES && bench_size(s) <= BENCH_MAX_LEN; s++)
+	{
+		printf("%10lu", (unsigned long)bench_size(s));
+		for (k = 0; k < BENCH_METHODS; k++)
+			if (bench_cycles[m][k][s])
+				printf("%12.3f", (double)bench_size(s) / bench_cycles[m][k][s]);
+		printf("\n");
+	}
+
+	// recheck so a failure can be pinned on a method
+	for (k = 1; k < BENCH_METHODS; k++)
+	{
+		if (!bench_cycles[m][k][0] || !bench_init(&h, m, methods[k].method))
+			continue;
+		crc_update(&h, "123456789", 9);
+		if (crc_final(&h) != models[m].check)
+			printf("  %s fails the check value\n", methods[k].name);
+	}
+	printf("\n");
+}
+#endif
+
+
+// somewhere for the debugger to stop
+void __attribute__((noinline)) bench_done(void)
+{
+	#ifdef PRINT_RESULT
+	printf("bench fails %lu\n", (unsigned long)bench_fails);
+	printf("\nbench result %c\n\n", (bench_fails == 0)? 'p': 'f');
+	#endif
+}
+
+
+int main(void)
+{
+	uint32_t ref[BENCH_SIZES];
+	const void *buf;
+	int m, k;
+
+	#ifdef EMBEDDED
+	sys_init();
+	buf = (const void *)FLASH_BASE;
+	#else
+	uint32_t *_buf = malloc(BENCH_MAX_LEN);
+	if (_buf == NULL)
+		return 1;
+	srand(1);
+	for (m = 0; m < BENCH_MAX_LEN / sizeof(uint32_t); m++)
+		_buf[m] = rand();
+	buf = _buf;
+	#endif
+
+	bench_cycles_init();
+	for (m = 0; m < BENCH_MODELS; m++)
+	{
+		memset(ref, 0, sizeof(ref));
+		for (k = 0; k < BENCH_METHODS; k++)
+			bench_run(m, k, buf, ref);
+		#ifdef PRINT_RESULT
+		bench_print(m);
+		#endif
+	}
+	bench_done();
+
+	#ifdef EMBEDDED
+	// done
+	while (1)
+	{}
+	#else
+	free(_buf);
+	return (bench_fails == 0)? 0: 1;
+	#endif
+}
@@ -40,6 +40,30 @@ struct crc_h h =
 	CRC_METHOD_BEST,
 };
 
+// crc of msg[1..35] in memory order (unaligned and not a whole number of words)
+static uint32_t known_stream_crc unused = 0x89007ec4;
+
+// 16bit models used on the serial links (crc16/ccitt-false and modbus)
+static uint32_t known_msg_crc16_ccitt unused = 0x2d7f;
+static uint32_t known_msg_crc16_modbus unused = 0x8264;
+uint16_t crc16_tbl[4*256];
+const cm_t cm_crc16_ccitt = {16, 0x1021, 0xFFFF, FALSE, FALSE, 0, 0};
+const cm_t cm_crc16_modbus = {16, 0x8005, 0xFFFF, TRUE, TRUE, 0, 0};
+
+// crc16/xmodem and kermit never have a const table (see CRC_TABLES and
+// HOST_CRC_TABLES in lib/Makefile) so their tables are built in ram, which keeps gen_table16 and slice by 4 covered
+static uint32_t known_msg_crc16_xmodem unused = 0xa8a6;
+static uint32_t known_msg_crc16_kermit unused = 0xc2f5;
+const cm_t cm_crc16_xmodem = {16, 0x1021, 0x0000, FALSE, FALSE, 0, 0};
+const cm_t cm_crc16_kermit = {16, 0x1021, 0x0000, TRUE, TRUE, 0, 0};
+struct crc_h h16 =
+{
+	{16, 0x1021, 0xFFFF, FALSE, FALSE, 0, 0},
+	crc16_tbl,
+	sizeof(crc16_tbl),
+	CRC_METHOD_BEST,
+};
+
 
 void init(void)
 {
@@ -68,12 +92,63 @@ uint32_t run_crc(void)
 }
 
 
+uint32_t run_crc_stream(void)
+{
+	// feed it in odd sized chunks straight from the message (no padding or copying)
+	crc_init(&h);
+	crc_update(&h, &msg[1], 3);
+	crc_update(&h, &msg[4], 21);
+	crc_update(&h, &msg[25], 11);
+	return crc_final(&h);
+}
+
+
+uint32_t run_crc_combine(void)
+{
+	uint32_t crc_a, crc_b;
+
+	// crc the same stream in two separate pieces and merge them
+	crc_init(&h);
+	crc_update(&h, &msg[1], 7);
+	crc_a = crc_final(&h);
+	crc_update(&h, &msg[8], 28);
+	crc_b = crc_final(&h);
+	return crc_combine(&h, crc_a, crc_b, 28);
+}
+
+
+uint32_t run_crc16(const cm_t *cm, int method, uint16_t table_size)
+{
+	h16.cm = *cm;
+	h16.method = method;
+	h16.table_size = table_size;
+	crc_init(&h16);
+	return crc_buf(&h16, msg, sizeof(msg), true);
+}
+
+
+// set the handle up for a model with a const table then again for one without, the
+// second must build its table in the caller's buffer not over the const one
+uint32_t run_crc16_reinit(void)
+{
+	run_crc16(&cm_crc16_ccitt, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+	return run_crc16(&cm_crc16_xmodem, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+}
+
+
 #define CRC_MATCH(crc) ((crc == known_msg_crc)? 'p': 'f')
+#define CRC16_MATCH(crc, known) ((crc == known)? 'p': 'f')
 int main(void)
 {
 	uint32_t crc_soft unused;
 	uint32_t crc_tab unused;
 	uint32_t crc_best unused;
+	uint32_t crc_stream[3] unused;
+	uint32_t crc_comb unused;
+	uint32_t crc16_soft[4] unused;
+	uint32_t crc16_tab[4] unused;
+	uint32_t crc16_slice[4] unused;
+	uint32_t crc16_reinit unused;
 	#ifdef PRINT_RESULT
 	int i;
 	char res;
@@ -83,10 +158,28 @@ int main(void)
 	
 	h.method = CRC_METHOD_SOFT;
 	crc_soft = run_crc();
+	crc_stream[0] = run_crc_stream();
 	h.method = CRC_METHOD_TABLE_32W;
 	crc_tab  = run_crc();
+	crc_stream[1] = run_crc_stream();
 	h.method = CRC_METHOD_BEST;
 	crc_best = run_crc();
+	crc_stream[2] = run_crc_stream();
+	crc_comb = run_crc_combine();
+
+	crc16_soft[0] = run_crc16(&cm_crc16_ccitt, CRC_METHOD_SOFT, 0);
+	crc16_tab[0] = run_crc16(&cm_crc16_ccitt, CRC_METHOD_TABLE_16W, 256*sizeof(uint16_t));
+	crc16_slice[0] = run_crc16(&cm_crc16_ccitt, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+	crc16_soft[1] = run_crc16(&cm_crc16_modbus, CRC_METHOD_SOFT, 0);
+	crc16_tab[1] = run_crc16(&cm_crc16_modbus, CRC_METHOD_TABLE_16W, 256*sizeof(uint16_t));
+	crc16_slice[1] = run_crc16(&cm_crc16_modbus, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+	crc16_soft[2] = run_crc16(&cm_crc16_xmodem, CRC_METHOD_SOFT, 0);
+	crc16_tab[2] = run_crc16(&cm_crc16_xmodem, CRC_METHOD_TABLE_16W, 256*sizeof(uint16_t));
+	crc16_slice[2] = run_crc16(&cm_crc16_xmodem, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+	crc16_soft[3] = run_crc16(&cm_crc16_kermit, CRC_METHOD_SOFT, 0);
+	crc16_tab[3] = run_crc16(&cm_crc16_kermit, CRC_METHOD_TABLE_16W, 256*sizeof(uint16_t));
+	crc16_slice[3] = run_crc16(&cm_crc16_kermit, CRC_METHOD_TABLE_16W, sizeof(crc16_tbl));
+	crc16_reinit = run_crc16_reinit();
 
 	#ifdef PRINT_RESULT
 	printf("msg = ");
@@ -106,10 +199,61 @@ int main(void)
 	res = CRC_MATCH(crc_best);
 	printf("crc_best= 0x%.4X [%c]\n", crc_best, res);
 	printf("[crc_best method: %d]\n", h.method);
+	for (i = 0; i < 3; i++)
+	{
+		res = CRC16_MATCH(crc_stream[i], known_stream_crc);
+		printf("crc_stream[%d] = 0x%.4X [%c]\n", i, crc_stream[i], res);
+	}
+	res = CRC16_MATCH(crc_comb, known_stream_crc);
+	printf("crc_comb = 0x%.4X [%c]\n", crc_comb, res);
+	res = CRC16_MATCH(crc16_soft[0], known_msg_crc16_ccitt);
+	printf("crc16_ccitt_soft = 0x%.4X [%c]\n", crc16_soft[0], res);
+	res = CRC16_MATCH(crc16_tab[0], known_msg_crc16_ccitt);
+	printf("crc16_ccitt_tab = 0x%.4X [%c]\n", crc16_tab[0], res);
+	res = CRC16_MATCH(crc16_slice[0], known_msg_crc16_ccitt);
+	printf("crc16_ccitt_slice = 0x%.4X [%c]\n", crc16_slice[0], res);
+	res = CRC16_MATCH(crc16_soft[1], known_msg_crc16_modbus);
+	printf("crc16_modbus_soft = 0x%.4X [%c]\n", crc16_soft[1], res);
+	res = CRC16_MATCH(crc16_tab[1], known_msg_crc16_modbus);
+	printf("crc16_modbus_tab = 0x%.4X [%c]\n", crc16_tab[1], res);
+	res = CRC16_MATCH(crc16_slice[1], known_msg_crc16_modbus);
+	printf("crc16_modbus_slice = 0x%.4X [%c]\n", crc16_slice[1], res);
+	res = CRC16_MATCH(crc16_soft[2], known_msg_crc16_xmodem);
+	printf("crc16_xmodem_soft = 0x%.4X [%c]\n", crc16_soft[2], res);
+	res = CRC16_MATCH(crc16_tab[2], known_msg_crc16_xmodem);
+	printf("crc16_xmodem_tab = 0x%.4X [%c]\n", crc16_tab[2], res);
+	res = CRC16_MATCH(crc16_slice[2], known_msg_crc16_xmodem);
+	printf("crc16_xmodem_slice = 0x%.4X [%c]\n", crc16_slice[2], res);
+	res = CRC16_MATCH(crc16_soft[3], known_msg_crc16_kermit);
+	printf("crc16_kermit_soft = 0x%.4X [%c]\n", crc16_soft[3], res);
+	res = CRC16_MATCH(crc16_tab[3], known_msg_crc16_kermit);
+	printf("crc16_kermit_tab = 0x%.4X [%c]\n", crc16_tab[3], res);
+	res = CRC16_MATCH(crc16_slice[3], known_msg_crc16_kermit);
+	printf("crc16_kermit_slice = 0x%.4X [%c]\n", crc16_slice[3], res);
+	res = CRC16_MATCH(crc16_reinit, known_msg_crc16_xmodem);
+	printf("crc16_reinit = 0x%.4X [%c]\n", crc16_reinit, res);
 	res = 'f';
 	if (known_msg_crc == crc_soft && 
 		known_msg_crc == crc_tab  && 
-		known_msg_crc == crc_best)
+		known_msg_crc == crc_best &&
+		known_stream_crc == crc_stream[0] &&
+		known_stream_crc == crc_stream[1] &&
+		known_stream_crc == crc_stream[2] &&
+		known_stream_crc == crc_comb &&
+		known_msg_crc16_ccitt == crc16_soft[0] &&
+		known_msg_crc16_ccitt == crc16_tab[0] &&
+		known_msg_crc16_ccitt == crc16_slice[0] &&
+		known_msg_crc16_modbus == crc16_soft[1] &&
+		known_msg_crc16_modbus == crc16_tab[1] &&
+		known_msg_crc16_modbus == crc16_slice[1] &&
+		known_msg_crc16_xmodem == crc16_soft[2] &&
+		known_msg_crc16_xmodem == crc16_tab[2] &&
+		known_msg_crc16_xmodem == crc16_slice[2] &&
+		known_msg_crc16_kermit == crc16_soft[3] &&
+		known_msg_crc16_kermit == crc16_tab[3] &&
+		known_msg_crc16_kermit == crc16_slice[3] &&
+		known_msg_crc16_xmodem == crc16_reinit &&
+		h16.table == crc16_tbl)
 		res = 'p';
 	printf("\ntest result %c\n\n", res);
 	#endif
@@ -0,0 +1,69 @@
+#!/usr/bin/env python
+
+# make the flash image for the delta unit test, a base program in slot a and a
+# delta in the staging area that rebuilds a newer build of it in slot b. The
+# programs are made up (random code with literal pools of absolute addresses)
+# and go through scripts/add_header.py like a real build would
+
+import sys
+import os
+import struct
+import random
+import subprocess
+from intelhex import IntelHex
+
+FLASH_ORIGIN = 0x08000000
+FLASH_SIZE = 0x40000
+SLOT_A = 0x08008000
+SLOT_B = 0x08010000
+STAGE = 0x08020000
+SLOT_SIZE = 0x8000
+
+scripts = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'scripts')
+
+
+def make_prog(addr, code, filename):
+	''' program linked at addr, every 64 bytes ends in a literal pool entry pointing back in to itself '''
+	prog = bytearray(struct.pack('<LLBLBLLH', 0, 0, 0x01, addr + 24, 2, SLOT_SIZE, 0, 3))
+	for k in range(0, len(code), 60):
+		prog += code[k:k + 60]
+		prog += struct.pack('<L', addr + random.randrange(len(code)) & ~3)
+	ih = IntelHex()
+	ih.puts(addr, bytes(prog))
+	ih.write_hex_file(filename)
+
+
+def add_header(args, filename):
+	out = subprocess.check_output([sys.executable, os.path.join(scripts, 'add_header.py')] + args)
+	open(filename, 'wb').write(out)
+
+
+random.seed(1)
+code = bytearray(random.randrange(256) for k in range(12000))
+make_prog(SLOT_A, code, 'base_raw.hex')
+
+# the new build adds a function, changes some constants and drops some code, and is linked to run from slot b
+random.seed(1)
+code[3000:3000] = bytearray(random.randrange(256) for k in range(300))
+for k in range(20):
+	code[random.randrange(len(code))] ^= 0xff
+del code[8000:8200]
+make_prog(SLOT_B, code, 'new_raw.hex')
+
+add_header(['base_raw.hex'], 'base.hex')
+add_header(['new_raw.hex'], 'new.hex')
+add_header(['-d', 'base.hex', hex(STAGE), 'new_raw.hex'], 'delta.hex')
+
+# flash as the target would have it (the new program is only kept to check against)
+flash = IntelHex()
+flash.merge(IntelHex('base.hex'))
+flash.merge(IntelHex('delta.hex'))
+flash.padding = 0xff
+open('flash.bin', 'wb').write(flash.tobinstr(start=FLASH_ORIGIN, end=FLASH_ORIGIN + FLASH_SIZE - 1))
+new = IntelHex('new.hex')
+open('new.bin', 'wb').write(new.tobinstr(start=new.minaddr()))
+
+h = open('delta_flash.h', 'w')
+h.write('// made by delta_flash.py, do not edit\n')
+for name in ['FLASH_ORIGIN', 'FLASH_SIZE', 'SLOT_A', 'SLOT_B', 'STAGE', 'SLOT_SIZE']:
+	h.write('#define %s (0x%.8X)\n' % (name, globals()[name]))
@@ -0,0 +1,241 @@
+/**
+ * @file delta_utest.c
+ *
+ * @brief unit test delta updates against a file backed flash image
+ *
+ * flash.bin (see delta_flash.py) holds a program in slot a and a delta in the
+ * staging area, it is opened with the nvm simulator and the delta applied with
+ * lib/boot.c (what bootstrap_unpack_prog runs on target) to rebuild the new
+ * program in slot b, then check it matches new.bin and validates. Then make
+ * sure a delta is refused when the base is not the program it was made from,
+ * and that the validation cache only forgets the programs a flash change hits,
+ * and that a slot not on a page is refused
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <boot.h>
+#include <delta.h>
+#include <nvm_sim.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "delta_flash.h"
+
+
+#define PAGE_SIZE (0x800)
+#define UNPACK_BUF (256)
+#define CACHE (3)
+
+static uint8_t *flash;	// flash.bin opened with nvm_sim
+static uint32_t bkp[3 * CACHE]; // stand in for the backup registers
+static uint32_t unpack_buf[UNPACK_BUF / sizeof(uint32_t)];
+static struct crc_h crc_h =
+{
+	{32, 0x04C11DB7, 0xFFFFFFFF, FALSE, FALSE, 0, 0},
+	NULL,
+	0,
+	CRC_METHOD_SOFT,
+};
+static struct boot_h boot_h;
+
+
+static uint32_t bkp_read(int n)
+{
+	return bkp[n];
+}
+
+
+static void bkp_write(int n, uint32_t v)
+{
+	bkp[n] = v;
+}
+
+
+// nvm_erase/nvm_write tell the bootstrap what they change like the hal ones do
+static uint32_t flash_erase(void *addr, uint32_t len)
+{
+	boot_flash_changed(&boot_h, addr, len);
+	return nvm_erase(addr, len);
+}
+
+
+static bool flash_write(void *dst, const void *src, uint32_t len)
+{
+	boot_flash_changed(&boot_h, dst, len);
+	return nvm_write(dst, src, len);
+}
+
+
+// target address to where it is in the flash image
+static void *flash_addr(uint32_t addr)
+{
+	return flash + addr - FLASH_ORIGIN;
+}
+
+
+// true if the validation of the program at addr is cached
+static bool cached(uint32_t addr)
+{
+	int k;
+
+	for (k = 0; k < CACHE; k++)
+		if (bkp[3*k] == addr)
+			return true;
+	return false;
+}
+
+
+// what the bootstrap does with the staged program
+static const struct boot_header *apply(const struct boot_header *header)
+{
+	if (!boot_validate(&boot_h, header) || header->type != BOOTSTRAP_PROG_HEADER_DELTA)
+		return NULL;
+	return boot_unpack(&boot_h, header);
+}
+
+
+static bool bad_copy_flush(struct delta_h *h, uint8_t *dst, const uint8_t *buf, uint32_t len)
+{
+	return nvm_write(dst, buf, len);
+}
+
+
+// a copy reaching past the end of the base must be caught
+static bool run_bad_copy(void)
+{
+	static const uint8_t ops[] = {0x10, 0x00, 0x00, 0x00, 0xf8, 0xff, 0x00, 0x00};
+	static const uint8_t base[0x10000];
+	struct delta_h delta =
+	{
+		.base = base,
+		.base_len = sizeof(base),
+		.dst = flash_addr(SLOT_B),
+		.max_len = SLOT_SIZE,
+		.buf = (uint8_t *)unpack_buf,
+		.buf_size = sizeof(unpack_buf),
+		.flush = bad_copy_flush,
+	};
+
+	return delta_apply(&delta, ops, sizeof(ops)) < 0;
+}
+
+
+// a slot that does not start on a page is refused before anything is erased
+static bool run_mid_page(const struct boot_header *stage)
+{
+	struct boot_header *header = malloc(stage->len);
+	struct bootstrap_delta_header *delta_header = (void *)((uint8_t *)header + BOOT_HEADER_LEN);
+	uint32_t erases = nvm_sim.erases;
+	bool refused;
+
+	memcpy(header, stage, stage->len);
+	delta_header->dst += 0x100;
+	refused = boot_unpack(&boot_h, header) == NULL && nvm_sim.erases == erases;
+	free(header);
+	return refused;
+}
+
+
+static void *load(const char *filename, size_t *len)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return NULL;
+	*len = st.st_size;
+	p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return (p == MAP_FAILED)? NULL: p;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const struct boot_header *stage, *prog;
+	const uint8_t *new_bin;
+	size_t new_len;
+	bool rebuilt, again, forget, refused, bad_copy, mid_page, result;
+	uint32_t erases_first;
+	uint8_t *a;
+
+	crc_init(&crc_h);
+	flash = nvm_sim_open((argc > 1)? argv[1]: "flash.bin", FLASH_SIZE, PAGE_SIZE);
+	new_bin = load((argc > 2)? argv[2]: "new.bin", &new_len);
+	boot_h.crc = &crc_h;
+	boot_h.bkp_read = bkp_read;
+	boot_h.bkp_write = bkp_write;
+	boot_h.cache = CACHE;
+	boot_h.reverify = 16;
+	boot_h.flash = flash;
+	boot_h.flash_size = FLASH_SIZE;
+	boot_h.flash_addr = FLASH_ORIGIN;
+	boot_h.page_size = PAGE_SIZE;
+	boot_h.erase = flash_erase;
+	boot_h.write = flash_write;
+	boot_h.buf = (uint8_t *)unpack_buf;
+	boot_h.buf_size = sizeof(unpack_buf);
+	boot_h.mark = NULL;
+	stage = flash_addr(STAGE);
+	if (flash == NULL || new_bin == NULL || !boot_validate(&boot_h, stage))
+	{
+		printf("run delta_flash.py first\n");
+		return 1;
+	}
+
+	// rebuild the new program in slot b
+	prog = apply(stage);
+	rebuilt = prog == flash_addr(SLOT_B) && memcmp(prog, new_bin, new_len) == 0;
+	printf("delta %lu bytes rebuilt %lu byte program [%c]\n", (unsigned long)stage->len,
+		(unsigned long)new_len, rebuilt? 'p': 'f');
+
+	// second time it is already there so nothing is erased (and nothing is crc'd again)
+	erases_first = nvm_sim.erases;
+	again = apply(stage) == prog && nvm_sim.erases == erases_first && cached(STAGE) && cached(SLOT_B);
+	printf("already rebuilt [%c]\n", again? 'p': 'f');
+
+	// erasing slot b only forgets slot b
+	boot_validate(&boot_h, flash_addr(SLOT_A));
+	flash_erase(flash_addr(SLOT_B), SLOT_SIZE);
+	forget = !cached(SLOT_B) && cached(SLOT_A) && cached(STAGE);
+	printf("erase only drops what it hits [%c]\n", forget? 'p': 'f');
+
+	// a different base (or a damaged one) is refused, with nothing cached as
+	// the damage is done behind nvm's back
+	memset(bkp, 0, sizeof(bkp));
+	a = flash_addr(SLOT_A + 100);
+	*a ^= 0x01;
+	refused = apply(stage) == NULL;
+	*a ^= 0x01;
+	printf("wrong base refused [%c]\n", refused? 'p': 'f');
+
+	bad_copy = run_bad_copy();
+	printf("bad copy caught [%c]\n", bad_copy? 'p': 'f');
+
+	mid_page = run_mid_page(stage);
+	printf("slot off a page refused [%c]\n", mid_page? 'p': 'f');
+
+	// leave the flash image rebuilt
+	apply(stage);
+	printf("bad writes %lu\n", (unsigned long)nvm_sim.bad_writes);
+	result = rebuilt && again && forget && refused && bad_copy && mid_page &&
+		nvm_sim.bad_writes == 0;
+	nvm_sim_close();
+
+	printf("\ntest result %c\n\n", result? 'p': 'f');
+	return result? 0: 1;
+}
@@ -31,9 +31,254 @@ void dma_test_complete(dma_t *dma, void *dst, void *src, int len)
 		{}
 }
 
+#ifdef STM32F40_41xxx
+#include <stm32f4xx_conf.h>
+#include <dma_hw.h>
+
+// copies queued back to back on one stream must all run and complete in order,
+// and be counted in the stream's stats (check queue_ok from the debugger)
+#define QUEUE_LEN 3
+static dma_request_t queue_req[QUEUE_LEN];
+static WORD queue_dst[QUEUE_LEN][BUF_LEN];
+static volatile int queue_done = 0;
+bool queue_ok = false;
+
+static void queue_complete(dma_request_t *req, void *param)
+{
+	if (queue_done >= 0 && req == &queue_req[queue_done])
+		queue_done++;
+	else
+		queue_done = -1;
+}
+
+static void queue_test(void)
+{
+	dma_request_t *req;
+	dma_stats_t stats;
+	int k;
+
+	for (k = 0; k < QUEUE_LEN; k++)
+	{
+		req = &queue_req[k];
+		req->complete = queue_complete;
+		req->complete_param = NULL;
+		req->dma = &mem_dma;
+		DMA_StructInit(&req->st_dma_init);
+		req->st_dma_init.DMA_Channel = mem_dma.channel;
+		req->st_dma_init.DMA_PeripheralBaseAddr = (uint32_t)((k & 1)? pat1: pat0);
+		req->st_dma_init.DMA_Memory0BaseAddr = (uint32_t)queue_dst[k];
+		req->st_dma_init.DMA_DIR = DMA_DIR_MemoryToMemory;
+		req->st_dma_init.DMA_BufferSize = BUF_LEN;
+		req->st_dma_init.DMA_PeripheralInc = DMA_PeripheralInc_Enable;
+		req->st_dma_init.DMA_MemoryInc = DMA_MemoryInc_Enable;
+		req->st_dma_init.DMA_FIFOMode = DMA_FIFOMode_Enable;
+		dma_request(req);
+	}
+
+	while (queue_done >= 0 && queue_done < QUEUE_LEN)
+	{}
+	queue_ok = queue_done == QUEUE_LEN;
+	for (k = 0; k < QUEUE_LEN; k++)
+		queue_ok = queue_ok && memcmp(queue_dst[k], (k & 1)? pat1: pat0, sizeof(queue_dst[k])) == 0;
+
+	dma_get_stats(&mem_dma, &stats);
+	queue_ok = queue_ok && stats.transfers == QUEUE_LEN && stats.bytes == QUEUE_LEN * BUF_LEN &&
+		stats.errors == 0 && stats.latency_count == QUEUE_LEN && stats.latency_max >= stats.latency_last;
+}
+
+// cycles from dma_request to the complete callback of a single byte copy, the
+// copy itself is a few cycles so this is near enough all dma_start and the isr
+// path (read latency_min/max from the debugger, eg before and after a change to
+// the dma isr or ramfuncs)
+#define LATENCY_RUNS 16
+static dma_request_t latency_req;
+static WORD latency_dst;
+static volatile uint32_t latency_done;
+uint32_t latency_min = 0xffffffff, latency_max = 0;
+
+static void latency_complete(dma_request_t *req, void *param)
+{
+	latency_done = DWT->CYCCNT;
+}
+
+static void latency_test(void)
+{
+	dma_request_t *req = &latency_req;
+	uint32_t start, cycles;
+	int k;
+
+	req->complete = latency_complete;
+	req->complete_param = NULL;
+	req->dma = &mem_dma;
+	DMA_StructInit(&req->st_dma_init);
+	req->st_dma_init.DMA_Channel = mem_dma.channel;
+	req->st_dma_init.DMA_PeripheralBaseAddr = (uint32_t)pat0;
+	req->st_dma_init.DMA_Memory0BaseAddr = (uint32_t)&latency_dst;
+	req->st_dma_init.DMA_DIR = DMA_DIR_MemoryToMemory;
+	req->st_dma_init.DMA_BufferSize = 1;
+	req->st_dma_init.DMA_FIFOMode = DMA_FIFOMode_Enable;
+
+	for (k = 0; k < LATENCY_RUNS; k++)
+	{
+		latency_done = 0;
+		start = DWT->CYCCNT;
+		dma_request(req);
+		while (latency_done == 0)
+		{}
+		cycles = latency_done - start;
+		if (cycles < latency_min)
+			latency_min = cycles;
+		if (cycles > latency_max)
+			latency_max = cycles;
+	}
+}
+
+// spi1 rx can only use dma2 stream 0 or 2 and mem_dma has 0 for good, so only one
+// can be acquired and a waiter gets it once it is released (check alloc_ok from the debugger)
+static dma_t *alloc_waited = NULL;
+bool alloc_ok = false;
+
+static void alloc_acquired(dma_t *dma, void *param)
+{
+	alloc_waited = dma;
+}
+
+static void alloc_test(void)
+{
+	dma_waiter_t w = {SPI1, DMA_DIR_PeripheralToMemory, 1, alloc_acquired, NULL, NULL};
+	dma_t *dma;
+
+	dma = dma_acquire(SPI1, DMA_DIR_PeripheralToMemory, 1);
+	alloc_ok = dma != NULL && dma->stream == DMA2_Stream2 && dma->channel == DMA_Channel_3 &&
+		dma_acquire(SPI1, DMA_DIR_PeripheralToMemory, 1) == NULL;
+	dma_acquire_wait(&w);
+	alloc_ok = alloc_ok && alloc_waited == NULL;
+	dma_release(dma);
+	alloc_ok = alloc_ok && alloc_waited == dma;
+	dma_release(dma);
+	alloc_ok = alloc_ok && dma_acquire(USART6, DMA_DIR_PeripheralToMemory, 1)->stream == DMA2_Stream1;
+}
+
+// a dma_t fixed in hw.c whose driver starts after its stream was acquired must be
+// refused until the stream is released, then it owns it (check order_ok from the debugger)
+static dma_t late_dma =
+{
+	.stream = DMA2_Stream2,
+	.channel = DMA_Channel_3,
+};
+bool order_ok = false;
+
+static void order_test(void)
+{
+	dma_t *dma;
+
+	dma = dma_acquire(SPI1, DMA_DIR_PeripheralToMemory, 1);
+	order_ok = dma != NULL && dma->stream == late_dma.stream && !dma_init(&late_dma);
+	dma_release(dma);
+	order_ok = order_ok && dma_init(&late_dma) &&
+		dma_acquire(SPI1, DMA_DIR_PeripheralToMemory, 1) == NULL;
+}
+
+// copies and sets with every alignment, all in flight at once across the engine
+// streams, must each come out right (check mem_ok from the debugger)
+#define MEM_LEN 200
+#define MEM_OPS 8
+static dma_mem_t mem_op[MEM_OPS];
+static uint8_t mem_src[MEM_LEN + 16] __attribute__ ((aligned (16)));
+static uint8_t mem_dst[MEM_OPS][MEM_LEN + 16] __attribute__ ((aligned (16)));
+static volatile int mem_done = 0;
+bool mem_ok = false;
+
+static void mem_complete(dma_mem_t *op, void *param)
+{
+	mem_done++;
+}
+
+static void mem_test(void)
+{
+	int k, n;
+
+	for (n = 0; n < sizeof(mem_src); n++)
+		mem_src[n] = n * 7;
+	memset(mem_dst, 0, sizeof(mem_dst));
+
+	mem_ok = dma_mem_init(1) == 2;
+	for (k = 0; k < MEM_OPS; k++)
+	{
+		// odd ones are sets, the offsets give byte, half word, word and burst aligned sides
+		if (k & 1)
+			dma_mem_set(&mem_op[k], &mem_dst[k][k], 0xa5, MEM_LEN - k, mem_complete, NULL);
+		else
+			dma_mem_copy(&mem_op[k], &mem_dst[k][k & 3], &mem_src[k], MEM_LEN - k, mem_complete, NULL);
+	}
+
+	while (mem_done < MEM_OPS)
+	{}
+	for (k = 0; k < MEM_OPS; k++)
+	{
+		for (n = 0; n < MEM_LEN - k; n++)
+			if (k & 1)
+				mem_ok = mem_ok && mem_dst[k][k + n] == 0xa5;
+			else
+				mem_ok = mem_ok && mem_dst[k][(k & 3) + n] == mem_src[k + n];
+		// nothing past the end
+		mem_ok = mem_ok && mem_dst[k][MEM_LEN] == 0;
+	}
+}
+
+// a crc fed to the crc hw by the dma must come out the same as crc_buf, with a
+// partial last word, a second one is refused while it runs and crc_buf carries
+// on in software meanwhile (check crc_ok from the debugger)
+#define CRC_LEN 1021
+static uint32_t crc_src[(CRC_LEN + 3) / 4];
+static volatile uint32_t crc_async_result;
+static volatile bool crc_async_ok;
+static volatile bool crc_done = false;
+bool crc_ok = false;
+
+static void crc_complete(struct crc_h *h, uint32_t crc, bool ok)
+{
+	crc_async_result = crc;
+	crc_async_ok = ok;
+	crc_done = true;
+}
+
+static void crc_test(void)
+{
+	dma_t *dma;
+	uint32_t crc;
+	int k;
+
+	for (k = 0; k < sizeof(crc_src) / sizeof(crc_src[0]); k++)
+		crc_src[k] = k * 0x9e3779b9;
+	crc_init(&stm32f4_crc_h);
+
+	dma = dma_acquire(NULL, DMA_DIR_MemoryToMemory, 1);
+	crc_ok = dma != NULL && crc_buf_async(&stm32f4_crc_h, dma, crc_src, CRC_LEN, crc_complete) &&
+		!crc_buf_async(&stm32f4_crc_h, dma, crc_src, CRC_LEN, crc_complete);
+
+	// the dma has the crc hw so this is done in software (it does not wait)
+	crc = crc_buf(&stm32f4_crc_h, crc_src, CRC_LEN, true);
+	while (crc_ok && !crc_done)
+	{}
+	crc_ok = crc_ok && crc_async_ok && crc_async_result == crc && !crc_async_busy() &&
+		crc_buf(&stm32f4_crc_h, crc_src, CRC_LEN, true) == crc;
+	if (dma != NULL)
+		dma_release(dma);
+}
+#endif
+
 void dma_test(void)
 {
 	dma_init(&mem_dma);
+#ifdef STM32F40_41xxx
+	queue_test();
+	latency_test();
+	alloc_test();
+	order_test();
+	mem_test();
+	crc_test();
+#endif
 	dma_memcpy(&mem_dma, pat_dst, pat0, BUF_LEN, dma_test_complete);
 }
 
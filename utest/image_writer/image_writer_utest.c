@@ -0,0 +1,370 @@
+/**
+ * @file image_writer_utest.c
+ *
+ * @brief unit test the image writer against the file backed nvm simulator
+ *
+ * Stream a program image in odd sized chunks with image_writer_poll called in
+ * between (like a transport isr and the main loop would) and check it lands
+ * in the slot, is only made valid by image_writer_finish, and that a damaged
+ * or over sized image is refused, as is a slot not on a page/sector. This is
+ * done on even pages like the f107x/f373 and on the f4 sectors (where each
+ * erase ahead is a whole sector, done in the background like nvm_erase_async),
+ * each with the soft crc and a hard crc that pads to whole words like the
+ * stm32 hw
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <image_writer.h>
+#include <nvm_sim.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define PAGE_SIZE (0x800)
+#define FLASH_SIZE (0x10000)
+#define IMAGE_LEN (0x5000 + 7)
+#define BUF_SIZE (256)
+#define FILENAME "image_writer_utest.bin"
+
+// same layout as bootstrap_prog_header in hal/<arch>/bootstrap.h
+struct __attribute__((packed)) prog_header
+{
+	uint32_t crc;
+	uint32_t len;
+	uint8_t  type;
+	uint32_t isr_vector;
+	uint8_t  pid;
+	uint32_t max_len;
+	uint32_t key;
+	uint16_t hw_id;
+};
+
+static uint8_t image[(IMAGE_LEN + 3) & ~3];
+static uint8_t buf[2][BUF_SIZE];
+static uint8_t *flash;
+static uint32_t page_size;
+static uint8_t *slot;
+static uint32_t slot_size;
+static uint32_t max_write = 0;
+static uint32_t busy_writes = 0;
+static bool use_async = false;
+static struct crc_h crc_h =
+{
+	{32, 0x04C11DB7, 0xFFFFFFFF, FALSE, FALSE, 0, 0},
+	NULL,
+	0,
+	CRC_METHOD_SOFT,
+};
+
+
+// stand in for the stm32 crc hw, it only takes whole words so it crc's the
+// bytes up to the next word too
+bool crc_init_hard(struct crc_h *h)
+{
+	h->method = CRC_METHOD_HARD;
+	return true;
+}
+
+
+uint32_t crc_buf_hard_len(struct crc_h *h, uint32_t len)
+{
+	return (len + 3) & ~3;
+}
+
+
+uint32_t crc_buf_hard(struct crc_h *h, const void *buf, uint32_t len, bool reset)
+{
+	struct crc_h soft = *h;
+	uint32_t crc;
+
+	soft.method = CRC_METHOD_SOFT;
+	crc = crc_buf(&soft, buf, crc_buf_hard_len(h, len), reset);
+	h->cm = soft.cm;
+	return crc;
+}
+
+
+// stand in for nvm_erase_async, the erase is left running until the next
+// flash_isr (or done straight away once erase_now is set)
+static struct
+{
+	void *addr;
+	uint32_t len;
+	void (*complete)(void *addr, uint32_t len, void *param);
+	void *param;
+} erase_running;
+static bool erase_now = false;
+
+
+static void flash_isr(void)
+{
+	void (*complete)(void *addr, uint32_t len, void *param) = erase_running.complete;
+
+	if (complete == NULL)
+		return;
+	erase_running.complete = NULL;
+	complete(erase_running.addr, nvm_erase(erase_running.addr, erase_running.len), erase_running.param);
+}
+
+
+static bool slot_erase_async(void *addr, uint32_t len,
+	void (*complete)(void *addr, uint32_t len, void *param), void *param)
+{
+	if (erase_running.complete != NULL)
+		return false;
+	erase_running.addr = addr;
+	erase_running.len = len;
+	erase_running.complete = complete;
+	erase_running.param = param;
+	if (erase_now)
+		flash_isr();
+	return true;
+}
+
+
+// nvm_write keeping track of the largest write, and of writes while an erase is running
+static bool slot_write(void *dst, const void *src, uint32_t len)
+{
+	if (len > max_write)
+		max_write = len;
+	if (erase_running.complete != NULL)
+	{
+		busy_writes++;
+		return false;
+	}
+	return nvm_write(dst, src, len);
+}
+
+
+static bool validate_prog(const struct prog_header *header)
+{
+	if (header == NULL || header->len <= sizeof(*header) || header->len > slot_size)
+		return false;
+	return header->crc == crc_buf(&crc_h, &header->len, header->len - sizeof(header->crc), true);
+}
+
+
+// a program image the way scripts/add_header.py makes it
+static void make_image(void)
+{
+	struct prog_header *header = (struct prog_header *)image;
+	uint32_t k;
+
+	// crc_buf reads the last partial word whole, pad it like erased flash
+	srand(1);
+	memset(image, 0xff, sizeof(image));
+	for (k = sizeof(*header); k < IMAGE_LEN; k++)
+		image[k] = rand();
+	header->len = IMAGE_LEN;
+	header->type = IMAGE_WRITER_TYPE_PLAIN;
+	header->isr_vector = 0x08020000 + sizeof(*header);
+	header->pid = 1;
+	header->max_len = slot_size;
+	header->key = 0;
+	header->hw_id = 0;
+	header->crc = crc_buf(&crc_h, &header->len, IMAGE_LEN - sizeof(header->crc), true);
+}
+
+
+static bool start(struct image_writer *w, uint8_t *dst)
+{
+	// an erase a refused image left running is done by now
+	flash_isr();
+
+	w->dst = dst;
+	w->max_len = slot_size;
+	w->flash = flash;
+	w->page_size = page_size;
+	w->buf[0] = buf[0];
+	w->buf[1] = buf[1];
+	w->buf_size = BUF_SIZE;
+	w->crc = &crc_h;
+	w->erase = nvm_erase;
+	w->erase_async = use_async? slot_erase_async: NULL;
+	w->write = slot_write;
+	erase_now = false;
+	return image_writer_start(w);
+}
+
+
+// stream the image in, it must not be valid until the end
+static const struct prog_header *stream(struct image_writer *w, const uint8_t *data, uint32_t len)
+{
+	uint32_t pos = 0, n, chunk = 1;
+
+	// the old program is there until the first erase is done
+	if (!start(w, slot))
+		return NULL;
+	flash_isr();
+
+	while (pos < len)
+	{
+		// odd sized chunks like a transport would hand over
+		n = (len - pos < chunk)? len - pos: chunk;
+		pos += image_writer_put(w, data + pos, n);
+		chunk = chunk * 3 % 97 + 1;
+		if (!image_writer_poll(w))
+			return NULL;
+		if (validate_prog((const struct prog_header *)slot))
+			return NULL;
+		flash_isr();
+	}
+
+	// image_writer_finish waits for the flash isr so let it do erases straight away
+	erase_now = true;
+	flash_isr();
+	return image_writer_finish(w);
+}
+
+
+// a slot that does not start on a page/sector is refused before anything is erased
+static bool off_page(uint8_t *dst)
+{
+	struct image_writer w;
+	uint32_t erases = nvm_sim.erases;
+	bool refused;
+
+	refused = !start(&w, dst);
+	if (!refused)
+	{
+		flash_isr();
+		refused = !image_writer_poll(&w) && w.error;
+	}
+	return refused && nvm_sim.erases == erases;
+}
+
+
+// number of pages/sectors the image covers from the start of the slot
+static uint32_t image_sectors(void)
+{
+	uint8_t *start;
+	uint32_t size, n = 0, pos = 0;
+
+	while (pos < IMAGE_LEN)
+	{
+		nvm_sim_sector(slot + pos, &start, &size);
+		pos = start + size - slot;
+		n++;
+	}
+	return n;
+}
+
+
+static bool run(int method)
+{
+	struct image_writer w;
+	const struct prog_header *prog;
+	bool written, slice, damaged, too_big, mid_page;
+	uint64_t time_us;
+	uint32_t erases, k;
+
+	crc_h.method = method;
+	crc_init(&crc_h);
+	printf("crc method %s\n", (crc_h.method == CRC_METHOD_HARD)? "hard (word padded)": "soft");
+	make_image();
+
+	// old program in the slot so every page/sector has to be erased
+	memset(buf[0], 0x00, BUF_SIZE);
+	for (k = 0; k < slot_size; k += BUF_SIZE)
+		nvm_write(slot + k, buf[0], BUF_SIZE);
+	erases = nvm_sim.erases;
+	time_us = nvm_sim.time_us;
+	max_write = 0;
+	busy_writes = 0;
+
+	// a good image ends up in the slot and validates, erasing only what it needs
+	prog = stream(&w, image, IMAGE_LEN);
+	erases = nvm_sim.erases - erases;
+	time_us = nvm_sim.time_us - time_us;
+	written = prog == (const struct prog_header *)slot && validate_prog(prog) &&
+		memcmp(slot, image, IMAGE_LEN) == 0 && erases == image_sectors();
+	printf("image written %lu erases %lu ms of flash time [%c]\n", (unsigned long)erases,
+		(unsigned long)(time_us / 1000), written? 'p': 'f');
+
+	// flash is never held for more than a slice (or written while it is being erased)
+	slice = max_write <= IMAGE_WRITER_SLICE && busy_writes == 0;
+	printf("largest write %lu bytes, %lu while erasing [%c]\n", (unsigned long)max_write,
+		(unsigned long)busy_writes, slice? 'p': 'f');
+
+	// a flipped bit is caught and the slot is left invalid
+	image[IMAGE_LEN / 2] ^= 0x10;
+	damaged = stream(&w, image, IMAGE_LEN) == NULL && !w.error &&
+		!validate_prog((const struct prog_header *)slot);
+	image[IMAGE_LEN / 2] ^= 0x10;
+	printf("damaged image refused [%c]\n", damaged? 'p': 'f');
+
+	// more than the slot holds
+	((struct prog_header *)image)->len = slot_size + 4;
+	too_big = stream(&w, image, IMAGE_LEN) == NULL && w.error;
+	((struct prog_header *)image)->len = IMAGE_LEN;
+	printf("over sized image refused [%c]\n", too_big? 'p': 'f');
+
+	// half way into the first page/sector, and on the f4 a page_size multiple
+	// into the 64K sector (only its first erase can tell)
+	mid_page = off_page(slot + page_size / 2) && (!use_async || off_page(slot + 2 * page_size));
+	printf("slot off a page/sector refused [%c]\n\n", mid_page? 'p': 'f');
+
+	return written && slice && damaged && too_big && mid_page;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool pages, sectors, result;
+
+	if (sizeof(struct prog_header) != IMAGE_WRITER_HEADER_LEN)
+	{
+		printf("header is %lu bytes\n\ntest result f\n\n", (unsigned long)sizeof(struct prog_header));
+		return 1;
+	}
+
+	// even pages like the f107x/f373, the slot part way in
+	remove(FILENAME);
+	flash = nvm_sim_open(FILENAME, FLASH_SIZE, PAGE_SIZE);
+	if (flash == NULL)
+	{
+		printf("could not open %s\n\ntest result f\n\n", FILENAME);
+		return 1;
+	}
+	printf("pages of %u bytes\n", PAGE_SIZE);
+	page_size = PAGE_SIZE;
+	slot = flash + 4 * PAGE_SIZE;
+	slot_size = 16 * PAGE_SIZE;
+	pages = run(CRC_METHOD_SOFT);
+	pages = run(CRC_METHOD_HARD) && pages;
+	printf("bad writes %lu\n\n", (unsigned long)nvm_sim.bad_writes);
+	pages = pages && nvm_sim.bad_writes == 0;
+	nvm_sim_close();
+	remove(FILENAME);
+
+	// the f4 sectors, the slot is a 16K sector then the 64K one
+	flash = nvm_sim_open_f4(FILENAME);
+	if (flash == NULL)
+	{
+		printf("could not open %s\n\ntest result f\n\n", FILENAME);
+		return 1;
+	}
+	printf("f4 sectors, erased in the background\n");
+	use_async = true;
+	page_size = 0x4000;
+	slot = flash + 3 * 0x4000;
+	slot_size = 0x4000 + 0x10000;
+	sectors = run(CRC_METHOD_SOFT);
+	sectors = run(CRC_METHOD_HARD) && sectors;
+	printf("bad writes %lu\n", (unsigned long)nvm_sim.bad_writes);
+	sectors = sectors && nvm_sim.bad_writes == 0;
+	nvm_sim_close();
+	remove(FILENAME);
+
+	result = pages && sectors;
+	printf("\ntest result %c\n\n", result? 'p': 'f');
+	return result? 0: 1;
+}
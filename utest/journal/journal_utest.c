@@ -0,0 +1,267 @@
+/**
+ * @file journal_utest.c
+ *
+ * @brief unit test the journal against the file backed nvm simulator
+ *
+ * Log numbered records of odd sizes until the ring has wrapped a few times and
+ * check the reader gets an unbroken run of them ending with the newest, that
+ * they are still there after a re-init (like a reset), that with journal_poll
+ * called in between the flushes never erase, and that cutting the power at
+ * every byte of a flush (and of the spare sector erase after it) only ever
+ * loses the block being flushed
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <journal.h>
+#include <nvm_sim.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+
+#define PAGE_SIZE (0x800)
+#define SECTORS (4)
+#define FLASH_SIZE (SECTORS * PAGE_SIZE)
+#define BUF_SIZE (512)
+#define MAX_LEN (24)
+#define FILENAME "journal_utest.bin"
+
+static uint8_t *flash;
+static uint8_t snapshot[FLASH_SIZE];
+static uint32_t buf[BUF_SIZE / sizeof(uint32_t)];
+static struct journal_h journal;
+static struct crc_h crc_h =
+{
+	{32, 0x04C11DB7, 0xFFFFFFFF, FALSE, FALSE, 0, 0},
+	NULL,
+	0,
+	CRC_METHOD_SOFT,
+};
+
+
+static bool init(void)
+{
+	journal.base = flash;
+	journal.sector_size = PAGE_SIZE;
+	journal.sectors = SECTORS;
+	journal.crc = &crc_h;
+	journal.buf = (uint8_t *)buf;
+	journal.buf_size = BUF_SIZE;
+	journal.erase = nvm_erase;
+	journal.erase_async = NULL;
+	journal.write = nvm_write;
+	return journal_init(&journal);
+}
+
+
+// record n, its number then a pattern (odd lengths to check the padding)
+static uint16_t make_record(uint32_t n, uint8_t *data)
+{
+	uint16_t len = sizeof(n) + n % (MAX_LEN - sizeof(n));
+	uint16_t k;
+
+	memcpy(data, &n, sizeof(n));
+	for (k = sizeof(n); k < len; k++)
+		data[k] = n * 7 + k;
+	return len;
+}
+
+
+static bool append(uint32_t first, uint32_t last)
+{
+	uint8_t data[MAX_LEN];
+	uint32_t n;
+
+	for (n = first; n <= last; n++)
+		if (!journal_append(&journal, n & 0xffff, data, make_record(n, data)))
+			return false;
+	return true;
+}
+
+
+// read it all back, the records must be numbered one after the other and be
+// intact, returns how many and sets the first and last numbers
+static uint32_t read_back(uint32_t *first, uint32_t *last, bool *ok)
+{
+	struct journal_iter it;
+	uint8_t data[MAX_LEN];
+	const uint8_t *rec;
+	uint32_t count = 0, n;
+	uint16_t tag, len;
+
+	*ok = true;
+	journal_iter_start(&journal, &it);
+	while ((rec = journal_next(&journal, &it, &tag, &len)) != NULL)
+	{
+		memcpy(&n, rec, sizeof(n));
+		if ((count && n != *last + 1) || tag != (n & 0xffff) ||
+			len != make_record(n, data) || memcmp(rec, data, len) != 0)
+			*ok = false;
+		if (count++ == 0)
+			*first = n;
+		*last = n;
+	}
+	return count;
+}
+
+
+// cut the power at every byte of the next flush and check only its block can
+// be lost, returns the cuts tried
+static uint32_t power_cuts(uint32_t next, uint32_t records, bool *ok)
+{
+	uint32_t first, last, count, cut;
+	bool done = false, good;
+
+	memcpy(snapshot, flash, FLASH_SIZE);
+	for (cut = 1; !done; cut++)
+	{
+		memcpy(flash, snapshot, FLASH_SIZE);
+		if (!init() || !append(next, next + records - 1))
+			break;
+		nvm_sim_power_cut(cut);
+		journal_flush(&journal);
+		journal_poll(&journal);
+		done = !nvm_sim.off;
+		nvm_sim_power_on();
+
+		// like a reset, everything flushed before is there and the new block is all or nothing
+		if (!init())
+			break;
+		count = read_back(&first, &last, &good);
+		if (!good || count == 0 || (last != next - 1 && last != next + records - 1))
+			break;
+
+		// and it still works after
+		if (!append(last + 1, last + 1) || !journal_flush(&journal) ||
+			read_back(&first, &count, &good) == 0 || !good || count != last + 1)
+			break;
+	}
+	*ok = done;
+	return cut - 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool fresh, good, logged, wrapped, reinit, even, cut_ok, sector_cut_ok, no_poll, result;
+	uint32_t first, last, count, again, n, min, max, records, cuts, sector_cuts;
+	uint64_t bytes, payload = 0;
+	uint8_t data[MAX_LEN], head;
+	clock_t start;
+	double rate;
+
+	crc_init(&crc_h);
+	remove(FILENAME);
+	flash = nvm_sim_open(FILENAME, FLASH_SIZE, PAGE_SIZE);
+	if (flash == NULL)
+	{
+		printf("could not open %s\n\ntest result f\n\n", FILENAME);
+		return 1;
+	}
+
+	// an empty journal formats and has nothing in it
+	fresh = init() && read_back(&first, &last, &good) == 0;
+	printf("fresh journal [%c]\n", fresh? 'p': 'f');
+
+	// less than the ring holds is all there
+	logged = append(0, 99) && journal_flush(&journal) &&
+		read_back(&first, &last, &good) == 100 && good && first == 0 && last == 99;
+	printf("100 records logged [%c]\n", logged? 'p': 'f');
+
+	// lots more, the oldest sectors are recycled (erased by journal_poll in between, like a main loop)
+	memset(nvm_sim.page_erases, 0, SECTORS * sizeof(*nvm_sim.page_erases));
+	records = 100000;
+	bytes = nvm_sim.bytes_written;
+	start = clock();
+	for (n = 100; n < 100 + records; n++)
+	{
+		payload += make_record(n, data);
+		if (!journal_append(&journal, n & 0xffff, data, make_record(n, data)) || !journal_poll(&journal))
+			break;
+	}
+	wrapped = n == 100 + records && journal_flush(&journal);
+	rate = records / ((double)(clock() - start) / CLOCKS_PER_SEC + 1e-9);
+	bytes = nvm_sim.bytes_written - bytes;
+	count = read_back(&first, &last, &good);
+	wrapped = wrapped && good && first > 100 && last == 100 + records - 1 &&
+		count > (SECTORS - 2) * PAGE_SIZE / (sizeof(struct journal_record) + MAX_LEN) &&
+		journal.stalls == 0;
+	printf("ring wrapped, %lu records from %lu to %lu, %lu flushes erased [%c]\n", (unsigned long)count,
+		(unsigned long)first, (unsigned long)last, (unsigned long)journal.stalls, wrapped? 'p': 'f');
+	printf("%.0f records/s, %.1f%% of the bytes written are record data\n", rate, 100.0 * payload / bytes);
+
+	min = max = nvm_sim.page_erases[0];
+	for (n = 1; n < SECTORS; n++)
+	{
+		if (nvm_sim.page_erases[n] < min)
+			min = nvm_sim.page_erases[n];
+		if (nvm_sim.page_erases[n] > max)
+			max = nvm_sim.page_erases[n];
+	}
+	even = min > 0 && max - min <= 1;
+	printf("sector erases %lu to %lu [%c]\n", (unsigned long)min, (unsigned long)max, even? 'p': 'f');
+
+	// the same after a reset and it carries on from the end
+	reinit = init() && read_back(&n, &again, &good) == count && good && n == first && again == last &&
+		append(last + 1, last + 10) && journal_flush(&journal) &&
+		read_back(&n, &again, &good) && good && again == last + 10;
+	printf("re-init [%c]\n", reinit? 'p': 'f');
+	last += 10;
+
+	// power cuts during a flush that fits in the head sector
+	init();
+	if (journal.sector_size - journal.pos < 2 * BUF_SIZE)
+	{
+		append(last + 1, last + 40);
+		journal_flush(&journal);
+		last += 40;
+	}
+	cuts = power_cuts(last + 1, 5, &cut_ok);
+	printf("power cut at %lu points of a flush [%c]\n", (unsigned long)cuts, cut_ok? 'p': 'f');
+
+	// and one that has to start a new sector first, then journal_poll erases the next spare
+	init();
+	read_back(&first, &last, &good);
+	while (journal.sector_size - journal.pos >= sizeof(struct journal_block) + sizeof(struct journal_record) + MAX_LEN + sizeof(uint32_t))
+	{
+		append(last + 1, last + 1);
+		journal_flush(&journal);
+		last++;
+	}
+	sector_cuts = power_cuts(last + 1, BUF_SIZE / (sizeof(struct journal_record) + MAX_LEN), &sector_cut_ok);
+	sector_cut_ok = sector_cut_ok && sector_cuts > PAGE_SIZE;
+	printf("power cut at %lu points of a flush with a sector erase [%c]\n", (unsigned long)sector_cuts, sector_cut_ok? 'p': 'f');
+
+	// without journal_poll the second move on has to erase the spare in the flush
+	init();
+	read_back(&first, &last, &good);
+	head = journal.head;
+	for (n = 0; n < 2; n++)
+	{
+		while (journal.head == head)
+		{
+			append(last + 1, last + 1);
+			journal_flush(&journal);
+			last++;
+		}
+		head = journal.head;
+	}
+	no_poll = journal.stalls == 1 && read_back(&first, &again, &good) && good && again == last;
+	printf("flush erases when journal_poll is not called [%c]\n", no_poll? 'p': 'f');
+
+	printf("bad writes %lu\n", (unsigned long)nvm_sim.bad_writes);
+	nvm_sim_close();
+	remove(FILENAME);
+
+	result = fresh && logged && wrapped && even && reinit && cut_ok && sector_cut_ok && no_poll &&
+		nvm_sim.bad_writes == 0;
+	printf("\ntest result %c\n\n", result? 'p': 'f');
+	return result? 0: 1;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file kv_utest.c
+ *
+ * @brief unit test the key value store against the file backed nvm simulator
+ *
+ * Set, get and delete values and check they are still there after a re-init
+ * (like a reset), that many sets wear the sectors evenly, and that cutting the
+ * power at every byte of a set (and of the copy to a new sector it causes)
+ * always leaves each key with its old or new value
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <kv.h>
+#include <nvm_sim.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+
+#define PAGE_SIZE (0x800)
+#define SECTORS (4)
+#define FLASH_SIZE (SECTORS * PAGE_SIZE)
+#define KEYS (16)
+#define VALUE_LEN (24)
+#define FILENAME "kv_utest.bin"
+
+static uint8_t *flash;
+static uint8_t snapshot[FLASH_SIZE];
+static uint32_t kv_index[KEYS];
+static uint8_t values[KEYS][VALUE_LEN];
+static int32_t values_len[KEYS];
+static struct kv_h kv;
+static struct crc_h crc_h =
+{
+	{32, 0x04C11DB7, 0xFFFFFFFF, FALSE, FALSE, 0, 0},
+	NULL,
+	0,
+	CRC_METHOD_SOFT,
+};
+
+
+static bool init(void)
+{
+	kv.base = flash;
+	kv.sector_size = PAGE_SIZE;
+	kv.sectors = SECTORS;
+	kv.crc = &crc_h;
+	kv.index = kv_index;
+	kv.keys = KEYS;
+	kv.erase = nvm_erase;
+	kv.write = nvm_write;
+	return kv_init(&kv);
+}
+
+
+// a value that is different for each key and version (odd lengths to check the padding)
+static uint16_t make_value(uint16_t key, uint32_t version, uint8_t *buf)
+{
+	uint16_t len = 1 + (key + version) % VALUE_LEN;
+	uint16_t k;
+
+	for (k = 0; k < len; k++)
+		buf[k] = key * 31 + version * 7 + k;
+	return len;
+}
+
+
+static bool check(uint16_t key, const uint8_t *value, uint16_t len)
+{
+	uint8_t buf[VALUE_LEN];
+
+	return kv_get(&kv, key, buf, sizeof(buf)) == len && memcmp(buf, value, len) == 0;
+}
+
+
+// set every key and check it all survives a re-init
+static bool basic(void)
+{
+	uint8_t buf[VALUE_LEN];
+	uint16_t key, len;
+
+	for (key = 0; key < KEYS; key++)
+	{
+		len = make_value(key, 0, buf);
+		if (!kv_set(&kv, key, buf, len))
+			return false;
+	}
+	if (!kv_del(&kv, 3) || kv_get(&kv, 3, buf, sizeof(buf)) != -1)
+		return false;
+	if (kv_set(&kv, KEYS, buf, 1))
+		return false;
+
+	if (!init())
+		return false;
+	for (key = 0; key < KEYS; key++)
+	{
+		len = make_value(key, 0, buf);
+		if (key == 3)
+		{
+			if (kv_ptr(&kv, key, NULL) != NULL)
+				return false;
+		}
+		else if (!check(key, buf, len))
+			return false;
+	}
+	return true;
+}
+
+
+// lots of sets, the sectors should be erased in turn
+static bool wear(uint32_t sets, double *rate, double *bytes_per_set)
+{
+	uint8_t buf[VALUE_LEN];
+	uint32_t n, min, max, gcs, bytes = nvm_sim.bytes_written;
+	uint16_t key, len;
+	clock_t start;
+
+	memset(nvm_sim.page_erases, 0, SECTORS * sizeof(*nvm_sim.page_erases));
+	start = clock();
+	for (n = 1; n <= sets; n++)
+	{
+		key = n % KEYS;
+		len = make_value(key, n, buf);
+		if (!kv_set(&kv, key, buf, len))
+			return false;
+	}
+	*rate = sets / ((double)(clock() - start) / CLOCKS_PER_SEC + 1e-9);
+	*bytes_per_set = (double)(nvm_sim.bytes_written - bytes) / sets;
+	gcs = kv.gc_count;
+
+	// every key has its last value, after a re-init too
+	if (!init())
+		return false;
+	for (n = sets - KEYS + 1; n <= sets; n++)
+	{
+		key = n % KEYS;
+		len = make_value(key, n, buf);
+		if (!check(key, buf, len))
+			return false;
+	}
+
+	min = max = nvm_sim.page_erases[0];
+	for (n = 1; n < SECTORS; n++)
+	{
+		if (nvm_sim.page_erases[n] < min)
+			min = nvm_sim.page_erases[n];
+		if (nvm_sim.page_erases[n] > max)
+			max = nvm_sim.page_erases[n];
+	}
+	printf("sector erases %lu to %lu after %lu gcs\n", (unsigned long)min, (unsigned long)max, (unsigned long)gcs);
+	return min > 0 && max - min <= 1;
+}
+
+
+// keep the current values as the known state to roll back to
+static void save(void)
+{
+	uint16_t key;
+
+	memcpy(snapshot, flash, FLASH_SIZE);
+	for (key = 0; key < KEYS; key++)
+		values_len[key] = kv_get(&kv, key, values[key], VALUE_LEN);
+}
+
+
+// cut the power at every byte of a set of key and check the store comes back
+// with the old or the new value and nothing else changed, returns the cuts tried
+static uint32_t power_cuts(uint16_t key, uint32_t version, bool *ok)
+{
+	uint8_t buf[VALUE_LEN], old[VALUE_LEN];
+	uint16_t len, old_len, k;
+	uint32_t cut;
+	bool done = false;
+
+	old_len = kv_get(&kv, key, old, sizeof(old));
+	len = make_value(key, version, buf);
+	for (cut = 1; !done; cut++)
+	{
+		memcpy(flash, snapshot, FLASH_SIZE);
+		if (!init())
+			break;
+		nvm_sim_power_cut(cut);
+		kv_set(&kv, key, buf, len);
+		done = !nvm_sim.off;
+		nvm_sim_power_on();
+
+		// like a reset
+		if (!init() || !(check(key, buf, len) || check(key, old, old_len)))
+			break;
+		for (k = 0; k < KEYS; k++)
+			if (k != key && !check(k, values[k], values_len[k]))
+				break;
+		if (k < KEYS)
+			break;
+
+		// and it still works after
+		if (!kv_set(&kv, key, buf, len) || !check(key, buf, len))
+			break;
+	}
+	*ok = done;
+	return cut - 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool fresh, basic_ok, wear_ok, cut_ok, gc_cut_ok, result;
+	uint8_t buf[VALUE_LEN];
+	double rate, bytes_per_set;
+	uint32_t cuts, gc_cuts, n;
+	uint16_t key, len;
+
+	crc_init(&crc_h);
+	remove(FILENAME);
+	flash = nvm_sim_open(FILENAME, FLASH_SIZE, PAGE_SIZE);
+	if (flash == NULL)
+	{
+		printf("could not open %s\n\ntest result f\n\n", FILENAME);
+		return 1;
+	}
+
+	// an empty store formats and has nothing in it
+	fresh = init() && kv_ptr(&kv, 0, NULL) == NULL;
+	printf("fresh store [%c]\n", fresh? 'p': 'f');
+
+	basic_ok = basic();
+	printf("set/get/del and re-init [%c]\n", basic_ok? 'p': 'f');
+
+	wear_ok = wear(20000, &rate, &bytes_per_set);
+	printf("wear levelling [%c]\n", wear_ok? 'p': 'f');
+	printf("%.0f sets/s, %.1f bytes written per set\n", rate, bytes_per_set);
+
+	// known values for every key then power cuts during a plain set
+	for (key = 0; key < KEYS; key++)
+		kv_set(&kv, key, buf, make_value(key, 0, buf));
+	save();
+	cuts = power_cuts(5, 1, &cut_ok);
+	printf("power cut at %lu points of a set [%c]\n", (unsigned long)cuts, cut_ok? 'p': 'f');
+
+	// fill the active sector so the next set has to move the records first
+	init();
+	len = make_value(7, 1, buf);
+	for (n = 1; kv.sector_size - kv.pos >= sizeof(struct kv_record) + len + 3; n++)
+		kv_set(&kv, 0, buf, make_value(0, n, buf));
+	len = make_value(7, 1, buf);
+	save();
+	gc_cuts = power_cuts(7, 1, &gc_cut_ok);
+	gc_cut_ok = gc_cut_ok && gc_cuts > PAGE_SIZE;
+	printf("power cut at %lu points of a set with a gc [%c]\n", (unsigned long)gc_cuts, gc_cut_ok? 'p': 'f');
+
+	printf("bad writes %lu\n", (unsigned long)nvm_sim.bad_writes);
+	nvm_sim_close();
+	remove(FILENAME);
+
+	result = fresh && basic_ok && wear_ok && cut_ok && gc_cut_ok && nvm_sim.bad_writes == 0;
+	printf("\ntest result %c\n\n", result? 'p': 'f');
+	return result? 0: 1;
+}
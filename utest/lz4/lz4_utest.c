@@ -0,0 +1,154 @@
+/**
+ * @file lz4_utest.c
+ *
+ * @brief unit test the lz4 decoder
+ *
+ * Unpack the vectors in lz4_vectors.h (packed by lib/lz4.py) with a few
+ * staging buffer sizes so matches come from both the flushed output and buf,
+ * then make sure broken blocks are caught
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <lz4.h>
+#ifdef EMBEDDED
+#include <hal.h>
+#endif
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef PRINT_RESULT
+#include <stdio.h>
+#endif
+
+
+struct lz4_vector
+{
+	const char *name;
+	const uint8_t *raw;
+	uint32_t raw_len;
+	const uint8_t *packed;
+	uint32_t packed_len;
+};
+#include "lz4_vectors.h"
+#define LZ4_VECTORS (sizeof(lz4_vectors) / sizeof(lz4_vectors[0]))
+
+static const uint32_t buf_sizes[] = {4, 16, 100, 4096};
+#define BUF_SIZES (sizeof(buf_sizes) / sizeof(buf_sizes[0]))
+
+static uint8_t out[4096];
+static uint8_t stage[4096];
+static uint32_t flush_fail_at;	// fail the flush that would write past this
+
+// results
+uint32_t lz4_fails = 0;
+uint32_t lz4_bad_caught = 0;
+char lz4_result = 'f';
+
+
+static bool flush(struct lz4_h *h, uint8_t *dst, const uint8_t *buf, uint32_t len)
+{
+	// every flush but the last is a full buf, one after the other
+	if ((dst - h->dst) % h->buf_size != 0 || len > h->buf_size)
+		lz4_fails++;
+	if (dst + len > out + flush_fail_at)
+		return false;
+	memcpy(dst, buf, len);
+	return true;
+}
+
+
+static int32_t unpack(const uint8_t *src, uint32_t len, uint32_t max_len, uint32_t buf_size)
+{
+	struct lz4_h h =
+	{
+		.dst = out,
+		.max_len = max_len,
+		.buf = stage,
+		.buf_size = buf_size,
+		.flush = flush,
+	};
+
+	memset(out, 0xff, sizeof(out));
+	return lz4_unpack(&h, src, len);
+}
+
+
+static void run_vectors(void)
+{
+	const struct lz4_vector *v;
+	int k, s;
+
+	flush_fail_at = sizeof(out);
+	for (k = 0; k < LZ4_VECTORS; k++)
+	{
+		v = &lz4_vectors[k];
+		for (s = 0; s < BUF_SIZES; s++)
+		{
+			if (unpack(v->packed, v->packed_len, sizeof(out), buf_sizes[s]) != v->raw_len ||
+				memcmp(out, v->raw, v->raw_len) != 0)
+			{
+				lz4_fails++;
+				#ifdef PRINT_RESULT
+				printf("%s failed with a %lu byte buf\n", v->name, (unsigned long)buf_sizes[s]);
+				#endif
+			}
+		}
+	}
+}
+
+
+// each of these should give -1
+static void run_bad(void)
+{
+	const struct lz4_vector *text = &lz4_vectors[2];
+	static const uint8_t zero_offset[] = {0x10, 'a', 0x00, 0x00, 0x00};
+	static const uint8_t far_offset[] = {0x10, 'a', 0x02, 0x00, 0x00};
+	static const uint8_t long_lit[] = {0xf0, 0x10, 'a'};
+
+	flush_fail_at = sizeof(out);
+	lz4_bad_caught += unpack(text->packed, text->packed_len - 5, sizeof(out), 16) < 0;	// truncated
+	lz4_bad_caught += unpack(text->packed, text->packed_len, text->raw_len - 1, 16) < 0;	// too big
+	lz4_bad_caught += unpack(zero_offset, sizeof(zero_offset), sizeof(out), 16) < 0;
+	lz4_bad_caught += unpack(far_offset, sizeof(far_offset), sizeof(out), 16) < 0;
+	lz4_bad_caught += unpack(long_lit, sizeof(long_lit), sizeof(out), 16) < 0;
+
+	flush_fail_at = 64;
+	lz4_bad_caught += unpack(text->packed, text->packed_len, sizeof(out), 16) < 0;		// flush failed
+}
+#define LZ4_BAD 6
+
+
+// somewhere for the debugger to stop
+void __attribute__((noinline)) lz4_done(void)
+{
+	#ifdef PRINT_RESULT
+	printf("lz4 fails %lu, bad blocks caught %lu/%d\n", (unsigned long)lz4_fails, (unsigned long)lz4_bad_caught, LZ4_BAD);
+	printf("\ntest result %c\n\n", lz4_result);
+	#endif
+}
+
+
+int main(void)
+{
+	#ifdef EMBEDDED
+	sys_init();
+	#endif
+
+	run_vectors();
+	run_bad();
+	if (lz4_fails == 0 && lz4_bad_caught == LZ4_BAD)
+		lz4_result = 'p';
+	lz4_done();
+
+	#ifdef EMBEDDED
+	// done
+	while (1)
+	{}
+	#endif
+	return (lz4_result == 'p')? 0: 1;
+}
@@ -0,0 +1,40 @@
+#!/usr/bin/env python
+
+# make the lz4 unit test vectors (lz4_vectors.h), each is packed with lib/lz4.py
+# so the test covers the host compressor and the target decoder together
+
+import sys
+import os
+import random
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..', 'lib'))
+import lz4
+
+random.seed(1)
+text = b'Hello world this is a message to pack, it says the same thing a few times. ' * 8
+vectors = [
+	('empty', b''),
+	('short', b'mos'),
+	('text', text),
+	('zeros', bytearray(2000)),
+	('overlap', b'ab' * 700),	# offset 2 match that overlaps what it writes
+	('random', bytearray(random.randrange(256) for k in range(700))),
+	('mixed', bytearray(random.randrange(4) for k in range(1500)) + text),
+]
+
+def c_array(name, data):
+	data = bytearray(data)
+	s = 'static const uint8_t %s[] = {' % name
+	for k in range(len(data)):
+		if k % 16 == 0:
+			s += '\n\t'
+		s += '0x%.2x,' % data[k]
+	return s + '\n\t0x00};\n' # dummy so empty vectors still compile
+
+print('// made by lz4_vectors.py, do not edit\n')
+for name, raw in vectors:
+	print(c_array(name + '_raw', raw))
+	print(c_array(name + '_packed', lz4.compress(raw)))
+print('static const struct lz4_vector lz4_vectors[] =\n{')
+for name, raw in vectors:
+	print('\t{"%s", %s_raw, %d, %s_packed, %d},' % (name, name, len(raw), name, len(lz4.compress(raw))))
+print('};')
@@ -25,6 +25,31 @@ const char page0[PAGE_SIZE] at_symbol(".free_page0") = {1,2,3,4,};
 char page0_ram[sizeof(page0)];
 const char msg[32] at_symbol(".free_page1") = "hello";
 char msg_ram[sizeof(msg)] = {0,};
+bool erase_needed_ok = false; // check from the debugger
+
+#ifdef STM32F40_41xxx
+// async erase/write results (check async_ok from the debugger)
+volatile uint32_t async_len;
+volatile bool async_done;
+volatile bool async_in_isr;
+bool async_ok = false;
+
+static void async_complete(void *addr, uint32_t len, void *param)
+{
+	async_len = len;
+	async_in_isr = __get_IPSR() != 0;
+	async_done = true;
+}
+
+
+static uint32_t async_wait(void)
+{
+	while (!async_done)
+		;
+	async_done = false;
+	return async_len;
+}
+#endif
 
 
 void init(void)
@@ -49,7 +74,32 @@ int main(void)
 		for (n = 0; n < sizeof(page0_ram); n++)
 			page0_ram[n] = 1;
 		nvm_write((void*)page0, page0_ram, sizeof(page0));
+
+		// programming can clear bits but not set them
+		erase_needed_ok = !nvm_erase_needed(page0, sizeof(page0), page0_ram);
+		page0_ram[5] = 0;
+		erase_needed_ok = erase_needed_ok && !nvm_erase_needed(page0, sizeof(page0), page0_ram);
+		page0_ram[5] = 3;
+		erase_needed_ok = erase_needed_ok && nvm_erase_needed(page0, sizeof(page0), page0_ram);
+		page0_ram[5] = 1;
+
+		// a blank page is skipped but still counts as erased
+		nvm_erase((void*)page0, sizeof(page0));
+		erase_needed_ok = erase_needed_ok && nvm_erase((void*)page0, sizeof(page0)) >= sizeof(page0);
+
+#ifdef STM32F40_41xxx
+		// same again in the background from the flash isr, page0 is programmed
+		// first so there is a real erase (a blank sector finishes straight away),
+		// the erase takes far longer than getting back here so the callback must
+		// not have come yet, and it has to come from the isr
+		nvm_write((void*)page0, page0_ram, sizeof(page0));
+		async_ok = nvm_erase_async((void*)page0, sizeof(page0), async_complete, NULL) &&
+			!async_done && async_wait() == sizeof(page0) && async_in_isr &&
+			(uint8_t)page0[0] == 0xff && (uint8_t)page0[sizeof(page0) - 1] == 0xff &&
+			nvm_write_async((void*)page0, page0_ram, sizeof(page0), async_complete, NULL) &&
+			async_wait() == sizeof(page0) && async_in_isr && memcmp(page0, page0_ram, sizeof(page0)) == 0;
 		nvm_erase((void*)page0, sizeof(page0));
+#endif
 
 		// check we can write to flash and save it after a power cycle
 		nvm_erase((void*)msg, 32);
@@ -0,0 +1,273 @@
+/**
+ * @file nvm_sim.c
+ *
+ * @brief file backed flash for host tests of things built on the nvm api (see nvm_sim.h)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * The times are the typical figures from the datasheets. The f4 sector erase
+ * is about 250ms for 16K, 550ms for 64K and 1s for 128K, which a fixed part
+ * plus a part per KB fits well, and a word program is 16us. The f107x/f373
+ * erase a 2K page in about 20ms and program a half word in about 52us. A
+ * program step that would not change the flash costs nothing as the hal skips
+ * those.
+ */
+
+#include "nvm_sim.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+struct nvm_sim nvm_sim = {NULL,};
+
+const uint32_t nvm_sim_f4_sector_size[12] = {
+	0x04000, 0x04000, 0x04000, 0x04000, 0x10000, 0x20000, 0x20000, 0x20000,
+	0x20000, 0x20000, 0x20000, 0x20000
+};
+
+
+// map the file and reset the counters, the layout and timing are up to the caller
+static uint8_t *nvm_sim_map(const char *filename, uint32_t size, uint32_t sectors)
+{
+	struct stat st;
+	bool fresh;
+	int fd;
+
+	// reopening without a close, let go of the old flash first
+	nvm_sim_close();
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return NULL;
+	fresh = st.st_size != size;
+	if (fresh && ftruncate(fd, size) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	nvm_sim.flash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (nvm_sim.flash == MAP_FAILED)
+	{
+		nvm_sim.flash = NULL;
+		return NULL;
+	}
+
+	nvm_sim.size = size;
+	nvm_sim.sectors = sectors;
+	nvm_sim.page_erases = calloc(sectors, sizeof(uint32_t));
+	nvm_sim.time_us = 0;
+	nvm_sim.erases = 0;
+	nvm_sim.writes = 0;
+	nvm_sim.bytes_written = 0;
+	nvm_sim.bad_writes = 0;
+	nvm_sim_power_on();
+	if (fresh)
+		memset(nvm_sim.flash, 0xff, size);
+	return nvm_sim.flash;
+}
+
+
+uint8_t *nvm_sim_open(const char *filename, uint32_t size, uint32_t page_size)
+{
+	nvm_sim.page_size = page_size;
+	nvm_sim.sector_size = NULL;
+	nvm_sim.sector_start = false;
+	nvm_sim.erase_us = 20000;
+	nvm_sim.erase_us_per_kb = 0;
+	nvm_sim.program_us = 52;
+	nvm_sim.program_width = 2;
+	return nvm_sim_map(filename, size, size / page_size);
+}
+
+
+uint8_t *nvm_sim_open_f4(const char *filename)
+{
+	uint32_t n, size = 0;
+
+	for (n = 0; n < sizeof(nvm_sim_f4_sector_size) / sizeof(uint32_t); n++)
+		size += nvm_sim_f4_sector_size[n];
+	nvm_sim.page_size = 0;
+	nvm_sim.sector_size = nvm_sim_f4_sector_size;
+	nvm_sim.sector_start = true;
+	nvm_sim.erase_us = 143000;
+	nvm_sim.erase_us_per_kb = 6700;
+	nvm_sim.program_us = 16;
+	nvm_sim.program_width = 4;
+	return nvm_sim_map(filename, size, n);
+}
+
+
+void nvm_sim_close(void)
+{
+	if (nvm_sim.flash == NULL)
+		return;
+	msync(nvm_sim.flash, nvm_sim.size, MS_SYNC);
+	munmap(nvm_sim.flash, nvm_sim.size);
+	free(nvm_sim.page_erases);
+	nvm_sim.flash = NULL;
+	nvm_sim.page_erases = NULL;
+}
+
+
+int32_t nvm_sim_sector(const void *addr, uint8_t **start, uint32_t *size)
+{
+	const uint8_t *_addr = addr;
+	uint8_t *sector = nvm_sim.flash;
+	uint32_t n, sector_size = 0;
+
+	if (_addr < nvm_sim.flash || _addr >= nvm_sim.flash + nvm_sim.size)
+		return -1;
+	for (n = 0; n < nvm_sim.sectors; n++)
+	{
+		sector_size = (nvm_sim.sector_size == NULL)? nvm_sim.page_size: nvm_sim.sector_size[n];
+		if (_addr < sector + sector_size)
+			break;
+		sector += sector_size;
+	}
+	if (start != NULL)
+		*start = sector;
+	if (size != NULL)
+		*size = sector_size;
+	return n;
+}
+
+
+void nvm_sim_power_cut(uint32_t bytes)
+{
+	nvm_sim.power = bytes;
+	nvm_sim.off = false;
+}
+
+
+void nvm_sim_power_on(void)
+{
+	nvm_sim.power = 0;
+	nvm_sim.off = false;
+}
+
+
+// use up n bytes of the power budget, returns how many can be done before it goes
+static uint32_t nvm_sim_budget(uint32_t n)
+{
+	if (nvm_sim.power == 0)
+		return n;
+	if (n >= nvm_sim.power)
+	{
+		n = nvm_sim.power;
+		nvm_sim.power = 0;
+		nvm_sim.off = true;
+		return n;
+	}
+	nvm_sim.power -= n;
+	return n;
+}
+
+
+static bool nvm_sim_blank(const uint8_t *p, uint32_t len)
+{
+	while (len--)
+		if (*p++ != 0xff)
+			return false;
+	return true;
+}
+
+
+uint32_t nvm_erase(void *addr, uint32_t len)
+{
+	uint8_t *start = addr, *end = start + len, *sector;
+	uint32_t size, erased = 0, n;
+	int32_t k;
+
+	if (nvm_sim.off || start < nvm_sim.flash || end > nvm_sim.flash + nvm_sim.size || len == 0)
+		return 0;
+
+	// the f4 only does sectors starting in the range, the others from the page addr is in
+	k = nvm_sim_sector(start, &sector, &size);
+	if (nvm_sim.sector_start && sector < start)
+	{
+		sector += size;
+		k++;
+	}
+
+	for (; k < nvm_sim.sectors && sector < end; k++, sector += size)
+	{
+		size = (nvm_sim.sector_size == NULL)? nvm_sim.page_size: nvm_sim.sector_size[k];
+
+		// already blank so skipped like the hal does
+		if (nvm_sim_blank(sector, size))
+		{
+			erased += size;
+			continue;
+		}
+
+		n = nvm_sim_budget(size);
+		memset(sector, 0xff, n);
+		if (n < size)
+			break;
+		nvm_sim.time_us += nvm_sim.erase_us + (uint64_t)nvm_sim.erase_us_per_kb * size / 1024;
+		nvm_sim.page_erases[k]++;
+		nvm_sim.erases++;
+		erased += size;
+	}
+	return erased;
+}
+
+
+bool nvm_read(void *dst, const void *src, uint32_t len)
+{
+	memcpy(dst, src, len);
+	return true;
+}
+
+
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data)
+{
+	const uint8_t *flash = addr, *src = data;
+
+	while (len--)
+		if (*src++ & ~*flash++)
+			return true;
+	return false;
+}
+
+
+bool nvm_write(void *dst, const void *src, uint32_t len)
+{
+	uint8_t *_dst = dst;
+	const uint8_t *_src = src;
+	uintptr_t step = ~(uintptr_t)0;
+	uint32_t n, k;
+
+	if (nvm_sim.off || _dst < nvm_sim.flash || _dst + len > nvm_sim.flash + nvm_sim.size)
+		return false;
+
+	nvm_sim.writes++;
+	n = nvm_sim_budget(len);
+	nvm_sim.bytes_written += n;
+	for (k = 0; k < n; k++)
+	{
+		// nor flash can only clear bits
+		if (_src[k] & ~_dst[k])
+		{
+			nvm_sim.bad_writes++;
+			return false;
+		}
+
+		// each program step that changes something costs program_us
+		if (_src[k] != _dst[k] && (uintptr_t)(_dst + k) / nvm_sim.program_width != step)
+		{
+			step = (uintptr_t)(_dst + k) / nvm_sim.program_width;
+			nvm_sim.time_us += nvm_sim.program_us;
+		}
+		_dst[k] &= _src[k];
+	}
+	return !nvm_sim.off && memcmp(dst, src, len) == 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file nvm_sim.h
+ *
+ * @brief file backed flash for host tests of things built on the nvm api
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ * nvm_erase, nvm_read, nvm_write and nvm_erase_needed work like the hal ports
+ * on a file mapped in to memory, so what is written is still there next run.
+ * nvm_sim_open gives even pages like the f107x/f373 (an erase starts at the
+ * page addr is in) and nvm_sim_open_f4 the f4 sectors from its sector_size[]
+ * (only sectors that start in the range are erased). Both erase to 0xff and
+ * skip blank pages/sectors like the hal. Like nor flash a write can only clear
+ * bits, one that would need a 0 to go back to 1 fails and is counted in
+ * bad_writes.
+ *
+ * Each erase and program step adds its typical datasheet time to time_us, so
+ * what is built on top can be benchmarked in flash time, the same every run.
+ * The power can be cut part way through the erases/writes to test what survives.
+ */
+
+#ifndef __NVM_SIM__
+#define __NVM_SIM__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+struct nvm_sim
+{
+	uint8_t *flash;			// the mapped file
+	uint32_t size;			// bytes in it
+	uint32_t page_size;		// erase unit if sector_size is NULL
+	const uint32_t *sector_size; // sizes of the sectors one after the other (NULL for even pages)
+	uint32_t sectors;		// number of pages/sectors
+	bool sector_start;		// only erase sectors that start in the range (f4), else from the one addr is in
+
+	// timing
+	uint32_t erase_us;		// time to erase a page/sector
+	uint32_t erase_us_per_kb; // plus this much per KB of it
+	uint32_t program_us;	// time to program a step
+	uint8_t program_width;	// bytes in a program step
+	uint64_t time_us;		// flash time used so far
+
+	// counters
+	uint32_t *page_erases;	// erase count of each page/sector (wear)
+	uint32_t erases;		// pages/sectors erased
+	uint32_t writes;		// nvm_write calls
+	uint64_t bytes_written;	// bytes programmed
+	uint32_t bad_writes;	// writes that needed a 0 to go back to 1
+	uint32_t power;			// bytes left to erase/program before the power goes (0 for no cut)
+	bool off;				// the power is off, everything fails until nvm_sim_power_on
+};
+
+extern struct nvm_sim nvm_sim;
+
+// the f4 sectors (the same as sector_size[] in hal/stm32f4/nvm.c)
+extern const uint32_t nvm_sim_f4_sector_size[12];
+
+
+/**
+ * @brief map a file as flash with even pages, timed like the f107x/f373
+ * @param filename file to use (made, and erased, if it is not there or the wrong size)
+ * @param size bytes of flash
+ * @param page_size erase unit
+ * @return start of the flash, NULL on error
+ */
+uint8_t *nvm_sim_open(const char *filename, uint32_t size, uint32_t page_size);
+
+
+/**
+ * @brief map a file as the 1M of f4 flash with its sectors, timed for VoltageRange_3 (word programming)
+ * @param filename file to use (made, and erased, if it is not there or the wrong size)
+ * @return start of the flash (where NVM_START_ADDRESS would be), NULL on error
+ */
+uint8_t *nvm_sim_open_f4(const char *filename);
+
+
+/**
+ * @brief write the flash back to the file and unmap it
+ */
+void nvm_sim_close(void);
+
+
+/**
+ * @brief find the page/sector an address is in
+ * @param addr address in the flash
+ * @param start set to the start of the page/sector (may be NULL)
+ * @param size set to its size (may be NULL)
+ * @return number of the page/sector, -1 if addr is not in the flash
+ */
+int32_t nvm_sim_sector(const void *addr, uint8_t **start, uint32_t *size);
+
+
+/**
+ * @brief cut the power after this many more bytes have been erased or programmed
+ * @param bytes budget, an erase part way through a page only erases the start of it
+ */
+void nvm_sim_power_cut(uint32_t bytes);
+
+
+/**
+ * @brief turn the power back on (and stop any cut)
+ */
+void nvm_sim_power_on(void);
+
+
+// same as the hal
+uint32_t nvm_erase(void *addr, uint32_t len);
+bool nvm_read(void *dst, const void *src, uint32_t len);
+bool nvm_write(void *dst, const void *src, uint32_t len);
+bool nvm_erase_needed(const void *addr, uint32_t len, const void *data);
+
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file nvm_sim_utest.c
+ *
+ * @brief unit test the nvm simulator and benchmark kv and journal in f4 flash time
+ *
+ * Check the f4 sector layout, that only sectors starting in the range are
+ * erased, that a write can only clear bits and that erases and program steps
+ * are charged their flash time. Then time kv sets on two 16K sectors and
+ * journal logging on three 128K sectors (the flushes apart from the spare
+ * erases journal_poll does) in simulated flash time, which is the same every
+ * run (the cpu time on the target is extra)
+ *
+ * @author OT
+ *
+ * @date Oct 2026
+ *
+ */
+
+#include <nvm_sim.h>
+#include <kv.h>
+#include <journal.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+
+#define FILENAME "nvm_sim_utest.bin"
+#define KV_KEYS (32)
+#define KV_SETS (5000)
+#define JOURNAL_BUF_SIZE (4096)
+#define JOURNAL_RECORDS (100000)
+#define RECORD_LEN (16)
+
+static uint8_t *flash;
+static uint32_t kv_index[KV_KEYS];
+static uint32_t journal_buf[JOURNAL_BUF_SIZE / sizeof(uint32_t)];
+static struct crc_h crc_h =
+{
+	{32, 0x04C11DB7, 0xFFFFFFFF, FALSE, FALSE, 0, 0},
+	NULL,
+	0,
+	CRC_METHOD_SOFT,
+};
+
+
+static bool layout(void)
+{
+	uint8_t *start;
+	uint32_t size;
+
+	return nvm_sim_sector(flash, &start, &size) == 0 && start == flash && size == 0x4000 &&
+		nvm_sim_sector(flash + 0x1ffff, &start, &size) == 4 && start == flash + 0x10000 && size == 0x10000 &&
+		nvm_sim_sector(flash + 0xfffff, &start, &size) == 11 && start == flash + 0xe0000 && size == 0x20000 &&
+		nvm_sim_sector(flash + 0x100000, NULL, NULL) == -1 && nvm_sim.size == 0x100000;
+}
+
+
+// like the f4 hal only sectors that start in the range are erased
+static bool erase_range(void)
+{
+	uint8_t zero[4] = {0,};
+
+	return nvm_write(flash + 0x10, zero, sizeof(zero)) && nvm_write(flash + 0x4010, zero, sizeof(zero)) &&
+		nvm_erase(flash + 0x100, 0x4000) == 0x4000 &&
+		flash[0x10] == 0 && flash[0x4010] == 0xff && nvm_sim.page_erases[0] == 0 && nvm_sim.page_erases[1] == 1;
+}
+
+
+// programming can only clear bits
+static bool one_to_zero(void)
+{
+	uint8_t v = 0x0f, w = 0xf0, x = 0x05;
+	uint32_t bad = nvm_sim.bad_writes;
+
+	return nvm_write(flash + 0x8000, &v, 1) && !nvm_write(flash + 0x8000, &w, 1) &&
+		nvm_sim.bad_writes == bad + 1 && !nvm_erase_needed(flash + 0x8000, 1, &x) &&
+		nvm_erase_needed(flash + 0x8000, 1, &w) && nvm_write(flash + 0x8000, &x, 1) && flash[0x8000] == 0x05;
+}
+
+
+// erases and the program steps that change something are charged
+static bool timing(void)
+{
+	uint8_t data[16];
+	uint64_t t;
+
+	memset(data, 0x5a, sizeof(data));
+	t = nvm_sim.time_us;
+	if (!nvm_write(flash + 0x20000, data, sizeof(data)) || nvm_sim.time_us - t != 4 * 16)
+		return false;
+	t = nvm_sim.time_us;
+	if (!nvm_write(flash + 0x20000, data, sizeof(data)) || nvm_sim.time_us != t)
+		return false;
+	if (nvm_erase(flash + 0x20000, 0x20000) != 0x20000 || nvm_sim.time_us - t != 143000 + 6700 * 128)
+		return false;
+
+	// nothing to do for a blank sector
+	t = nvm_sim.time_us;
+	return nvm_erase(flash + 0x20000, 0x20000) == 0x20000 && nvm_sim.time_us == t;
+}
+
+
+static bool bench_kv(void)
+{
+	struct kv_h kv;
+	uint8_t value[RECORD_LEN];
+	uint64_t t;
+	uint32_t n;
+
+	kv.base = flash + 0x4000;
+	kv.sector_size = 0x4000;
+	kv.sectors = 2;
+	kv.crc = &crc_h;
+	kv.index = kv_index;
+	kv.keys = KV_KEYS;
+	kv.erase = nvm_erase;
+	kv.write = nvm_write;
+	if (!kv_init(&kv))
+		return false;
+
+	t = nvm_sim.time_us;
+	for (n = 0; n < KV_SETS; n++)
+	{
+		memset(value, n, sizeof(value));
+		if (!kv_set(&kv, n % KV_KEYS, value, sizeof(value)))
+			return false;
+	}
+	t = nvm_sim.time_us - t;
+	printf("kv %u byte sets on 2x16K: %.0f sets/s in flash time, %lu gcs\n", RECORD_LEN,
+		KV_SETS * 1e6 / t, (unsigned long)kv.gc_count);
+	return true;
+}
+
+
+static bool bench_journal(void)
+{
+	struct journal_h journal;
+	uint8_t record[RECORD_LEN];
+	uint64_t t, t_poll = 0, t_erase, bytes;
+	uint32_t n;
+	double rate, raw;
+
+	journal.base = flash + 0x60000;
+	journal.sector_size = 0x20000;
+	journal.sectors = 3;
+	journal.crc = &crc_h;
+	journal.buf = (uint8_t *)journal_buf;
+	journal.buf_size = JOURNAL_BUF_SIZE;
+	journal.erase = nvm_erase;
+	journal.erase_async = NULL;
+	journal.write = nvm_write;
+	if (!journal_init(&journal))
+		return false;
+
+	// the spare is erased by journal_poll from the main loop, which is timed on its own
+	t = nvm_sim.time_us;
+	bytes = nvm_sim.bytes_written;
+	for (n = 0; n < JOURNAL_RECORDS; n++)
+	{
+		memset(record, n, sizeof(record));
+		if (!journal_append(&journal, 0, record, sizeof(record)))
+			return false;
+		t_erase = nvm_sim.time_us;
+		if (!journal_poll(&journal))
+			return false;
+		t_poll += nvm_sim.time_us - t_erase;
+	}
+	if (!journal_flush(&journal))
+		return false;
+	t = nvm_sim.time_us - t - t_poll;
+	bytes = nvm_sim.bytes_written - bytes;
+
+	// against programming the same bytes back to back with no erases
+	rate = JOURNAL_RECORDS * 1e6 / t;
+	raw = (double)nvm_sim.program_width * 1e6 / nvm_sim.program_us;
+	printf("journal %u byte records on 3x128K: %.0f records/s, %.0f KB/s written (raw %.0f KB/s) in flush flash time,\n"
+		"    %.0f ms of erases in journal_poll, %lu flushes erased\n", RECORD_LEN, rate, bytes * 1e6 / t / 1024,
+		raw / 1024, t_poll / 1000.0, (unsigned long)journal.stalls);
+	return journal.stalls == 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool layout_ok, erase_ok, bits_ok, timing_ok, bench_ok, result;
+
+	crc_init(&crc_h);
+	remove(FILENAME);
+	flash = nvm_sim_open_f4(FILENAME);
+	if (flash == NULL)
+	{
+		printf("could not open %s\n\ntest result f\n\n", FILENAME);
+		return 1;
+	}
+
+	layout_ok = layout();
+	printf("f4 sector layout [%c]\n", layout_ok? 'p': 'f');
+
+	erase_ok = erase_range();
+	printf("only sectors starting in the range erased [%c]\n", erase_ok? 'p': 'f');
+
+	bits_ok = one_to_zero();
+	printf("writes only clear bits [%c]\n", bits_ok? 'p': 'f');
+
+	timing_ok = timing();
+	printf("erase and program time charged [%c]\n", timing_ok? 'p': 'f');
+
+	bench_ok = bench_kv() && bench_journal();
+	printf("benchmarks [%c]\n", bench_ok? 'p': 'f');
+
+	nvm_sim_close();
+	remove(FILENAME);
+
+	result = layout_ok && erase_ok && bits_ok && timing_ok && bench_ok;
+	printf("\ntest result %c\n\n", result? 'p': 'f');
+	return result? 0: 1;
+}
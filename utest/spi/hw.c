@@ -132,16 +132,7 @@
 		.channel = DMA_Channel_3,
 	};
 
-	dma_t spim_rx_dma =
-	{
-		.stream = DMA1_Stream3,
-		.channel = DMA_Channel_0,
-	};
-	dma_t spim_tx_dma =
-	{
-		.stream = DMA1_Stream4,
-		.channel = DMA_Channel_0,
-	};
+	// the spim gets its streams with dma_acquire for each transfer
 
 	#include <spis_hw.h>
 	spis_t spis_dev =
@@ -178,8 +169,7 @@
 		.miso = &gpio_spi2_miso, // miso gpio
 		.mosi = &gpio_spi2_mosi, // mosi gpio
 
-		.rx_dma = &spim_rx_dma,
-		.tx_dma = &spim_tx_dma,
+		.acquire_dma = true,
 	};
 
 #endif
@@ -63,11 +63,7 @@
 		.stream = DMA2_Stream5,
 		.channel = DMA_Channel_4,
 	};
-	dma_t uart_tx_dma =
-	{
-		.stream = DMA2_Stream7,
-		.channel = DMA_Channel_4,
-	};
+	// tx gets its stream with dma_acquire for each write
 
 	#include <uart_hw.h>
 	uart_t uart_dev =
@@ -87,7 +83,7 @@
 		},
 
 		.rx_dma = &uart_rx_dma,
-		.tx_dma = &uart_tx_dma,
+		.acquire_tx_dma = true,
 	};
 
 #else